@@ -0,0 +1,655 @@
+/*
+ * Decode path microbenchmarks. Every result is printed as one JSON object
+ * per line so runs can be diffed between releases:
+ *   make bench [BENCH_CORPUS="a.wmcp b.wmcp"]
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "capture.h"
+#include "device.h"
+#include "emulator.h"
+#include "latency.h"
+#include "logger.h"
+#include "pool.h"
+#include "spoofer.h"
+#include "uring.h"
+#include "wiimote.h"
+
+#define CORPUS_REPORTS 4096
+#define REPORT_SIZE 64
+#define MIN_ITERATIONS 200000
+#define ENGINE_DEVICES 8
+#define ENGINE_ROUNDS 1000
+
+typedef struct {
+    uint8_t (*reports)[REPORT_SIZE];
+    size_t count;
+} corpus_t;
+
+static uint32_t rng_state = 0x12345678;
+static uint8_t rng_byte(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return (uint8_t)rng_state;
+}
+
+static void corpus_random(corpus_t *c, uint8_t type) {
+    c->count = CORPUS_REPORTS;
+    c->reports = calloc(c->count, REPORT_SIZE);
+    for (size_t i = 0; i < c->count; i++) {
+        c->reports[i][0] = type;
+        for (size_t k = 1; k < REPORT_SIZE; k++) {
+            c->reports[i][k] = rng_byte();
+        }
+    }
+}
+
+static int corpus_load(corpus_t *c, const char *path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "cannot open corpus %s\n", path);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED || size < sizeof(capture_header_t)
+        || memcmp(data, CAPTURE_MAGIC, 4) != 0) {
+        fprintf(stderr, "%s is not a capture file\n", path);
+        return -1;
+    }
+    c->count = 0;
+    c->reports = calloc(size / sizeof(capture_record_t), REPORT_SIZE);
+    size_t off = sizeof(capture_header_t);
+    while (off + sizeof(capture_record_t) <= size) {
+        const capture_record_t *rec = (const capture_record_t *)(data + off);
+        if (off + sizeof(*rec) + rec->len > size) {
+            break;
+        }
+        if (rec->dir == CAPTURE_IN && rec->len > 0) {
+            memcpy(c->reports[c->count++], data + off + sizeof(*rec),
+                    rec->len < REPORT_SIZE ? rec->len : REPORT_SIZE);
+        }
+        off += sizeof(*rec) + rec->len;
+    }
+    munmap(data, size);
+    return c->count > 0 ? 0 : -1;
+}
+
+static void report(const char *name, const char *corpus,
+        size_t n, uint64_t elapsed_ns) {
+    double ns = (double)elapsed_ns / (double)n;
+    printf("{\"bench\":\"%s\",\"corpus\":\"%s\",\"reports\":%zu,"
+            "\"ns_per_report\":%.2f,\"reports_per_sec\":%.0f}\n",
+            name, corpus, n, ns, 1e9 / ns);
+}
+
+static size_t iterations(const corpus_t *c) {
+    return (MIN_ITERATIONS + c->count - 1) / c->count * c->count;
+}
+
+// a Wiimote that finished its handshake, and its IR camera set up for it
+static void ready_state(wiimote_state_t *state, enum extension_status ext) {
+    memset(state, 0, sizeof(*state));
+    state->initialized = 1;
+    state->status_flags = 0x02;
+    state->ext_status = ext;
+    state->classic_controller.data_format = 1;
+    state->ir.mode = ext == EXT_NONE ? IR_MODE_EXTENDED : IR_MODE_BASIC;
+    build_axis_luts(state);
+}
+
+static void bench_parse_wiimote(const corpus_t *c, const char *corpus) {
+    wiimote_state_t state;
+    ready_state(&state, EXT_NONE);
+    size_t n = iterations(c);
+    uint64_t start = lat_now_ns();
+    for (size_t i = 0; i < n; i++) {
+        parse_wiimote(c->reports[i % c->count] + 1, NULL, NULL, &state);
+    }
+    report("parse_wiimote", corpus, n, lat_now_ns() - start);
+}
+
+static void bench_parse_nunchuck(const corpus_t *c, const char *corpus) {
+    nunchuck_state_t state = {0};
+    size_t n = iterations(c);
+    uint64_t start = lat_now_ns();
+    for (size_t i = 0; i < n; i++) {
+        parse_nunchuck(c->reports[i % c->count] + 3, &state);
+    }
+    report("parse_nunchuck", corpus, n, lat_now_ns() - start);
+}
+
+static void bench_parse_cc(const corpus_t *c, const char *corpus) {
+    classic_controller_state_t state = {.data_format = 1};
+    size_t n = iterations(c);
+    uint64_t start = lat_now_ns();
+    for (size_t i = 0; i < n; i++) {
+        parse_cc(c->reports[i % c->count] + 3, &state);
+    }
+    report("parse_cc", corpus, n, lat_now_ns() - start);
+}
+
+static void bench_dispatch(const corpus_t *c, const char *corpus,
+        const char *name, enum extension_status ext) {
+    wiimote_state_t state;
+    msg_queue_t msgs;
+    msg_queue_init(&msgs, MSGQ_DEFAULT_DEPTH);
+    ready_state(&state, ext);
+    size_t n = iterations(c);
+    uint64_t start = lat_now_ns();
+    for (size_t i = 0; i < n; i++) {
+        handle_wiimote_event(&msgs, &state, c->reports[i % c->count]);
+        msgs.count = msgs.head = msgs.tail = 0;
+        state.ext_status = ext;
+    }
+    report(name, corpus, n, lat_now_ns() - start);
+    msg_queue_free(&msgs);
+}
+
+static void bench_spoofer(const corpus_t *c, const char *corpus,
+        int sink_fd) {
+    wiimote_state_t state;
+    msg_queue_t msgs;
+    msg_queue_init(&msgs, MSGQ_DEFAULT_DEPTH);
+    uinput_device_t dev = {.fd = sink_fd};
+    ready_state(&state, EXT_CLASSIC_CONTROLLER);
+    size_t n = iterations(c);
+    uint64_t start = lat_now_ns();
+    for (size_t i = 0; i < n; i++) {
+        handle_wiimote_event(&msgs, &state, c->reports[i % c->count]);
+        msgs.count = msgs.head = msgs.tail = 0;
+        state.ext_status = EXT_CLASSIC_CONTROLLER;
+        wiimote_to_uinput(&state, &dev);
+    }
+    report("handle_event+wiimote_to_uinput", corpus, n,
+            lat_now_ns() - start);
+    msg_queue_free(&msgs);
+}
+
+/*
+ * Batch decoding of a backlog: the corpus cut into full batches, each
+ * decoded and applied to the state report by report, per kernel.
+ */
+static void bench_batch(const corpus_t *c, const char *corpus,
+        enum extension_status ext) {
+    size_t batches = c->count / REPORT_BATCH_MAX;
+    report_batch_t *rx = calloc(batches, sizeof(*rx));
+    batch_samples_t samples;
+    wiimote_state_t state;
+    char name[48];
+    for (size_t b = 0; b < batches; b++) {
+        for (size_t i = 0; i < REPORT_BATCH_MAX; i++) {
+            memcpy(rx[b].reports[i], c->reports[b * REPORT_BATCH_MAX + i],
+                    REPORT_BATCH_STRIDE);
+            rx[b].len[i] = REPORT_BATCH_STRIDE;
+        }
+        rx[b].count = REPORT_BATCH_MAX;
+    }
+    for (const batch_kernel_t *const *k = batch_kernels(); *k; k++) {
+        batch_select((*k)->name);
+        ready_state(&state, ext);
+        size_t n = iterations(c) / REPORT_BATCH_MAX;
+        uint64_t start = lat_now_ns();
+        for (size_t r = 0; r < n; r++) {
+            const report_batch_t *batch = &rx[r % batches];
+            size_t run = batch_run_length(batch, 0, &state);
+            batch_decode(batch, 0, run, &state, &samples);
+            for (size_t i = 0; i < run; i++) {
+                batch_apply(&samples, i, batch->reports[i][0], &state);
+            }
+        }
+        snprintf(name, sizeof(name), "batch_decode/%s/%s", (*k)->name,
+                ext == EXT_NUNCHUCK ? "nunchuck" : "cc");
+        report(name, corpus, n * REPORT_BATCH_MAX, lat_now_ns() - start);
+    }
+    batch_select(batch_kernels()[0]->name);
+    free(rx);
+}
+
+static int same_ir(const ir_state_t *a, const ir_state_t *b) {
+    for (int i = 0; i < IR_POINTS; i++) {
+        if ((a->visible >> i & 1) && (a->points[i].x != b->points[i].x
+                || a->points[i].y != b->points[i].y
+                || a->points[i].size != b->points[i].size)) {
+            return 0;
+        }
+    }
+    return a->visible == b->visible && a->seq == b->seq;
+}
+
+static int same_inputs(const wiimote_state_t *a, const wiimote_state_t *b) {
+    const nunchuck_state_t *na = &a->nunchuck, *nb = &b->nunchuck;
+    const classic_controller_state_t *ca = &a->classic_controller;
+    const classic_controller_state_t *cb = &b->classic_controller;
+    return a->buttons == b->buttons
+        && memcmp(a->accel, b->accel, sizeof(a->accel)) == 0
+        && memcmp(na->accel, nb->accel, sizeof(na->accel)) == 0
+        && na->sx == nb->sx && na->sy == nb->sy
+        && na->buttons == nb->buttons
+        && ca->lx == cb->lx && ca->ly == cb->ly
+        && ca->rx == cb->rx && ca->ry == cb->ry
+        && ca->lt == cb->lt && ca->rt == cb->rt
+        && ca->buttons == cb->buttons
+        && same_ir(&a->ir, &b->ir);
+}
+
+/*
+ * Every batch kernel has to decode like the parse_* reference path: random
+ * reports of each type, with each extension and every run length, go
+ * through both. Returns the number of mismatching reports.
+ */
+static size_t check_batch(const uint8_t *types, size_t ntypes) {
+    static const enum extension_status exts[] = {
+        EXT_NONE, EXT_NUNCHUCK, EXT_CLASSIC_CONTROLLER,
+    };
+    report_batch_t rx;
+    batch_samples_t samples;
+    wiimote_state_t ref, got;
+    msg_queue_t msgs;
+    size_t failed = 0;
+    msg_queue_init(&msgs, MSGQ_DEFAULT_DEPTH);
+    for (const batch_kernel_t *const *k = batch_kernels(); *k; k++) {
+        size_t checked = 0, mismatches = 0;
+        batch_select((*k)->name);
+        for (size_t t = 0; t < ntypes; t++) {
+            for (size_t e = 0; e < sizeof(exts) / sizeof(exts[0]); e++) {
+                ready_state(&ref, exts[e]);
+                ready_state(&got, exts[e]);
+                for (size_t round = 0; round < 4 * REPORT_BATCH_MAX; round++) {
+                    rx.count = round % REPORT_BATCH_MAX + 1;
+                    for (size_t i = 0; i < rx.count; i++) {
+                        rx.reports[i][0] = types[t];
+                        for (size_t b = 1; b < REPORT_BATCH_STRIDE; b++) {
+                            rx.reports[i][b] = rng_byte();
+                        }
+                        rx.len[i] = REPORT_BATCH_STRIDE;
+                    }
+                    size_t run = batch_run_length(&rx, 0, &got);
+                    if (run == 0) {
+                        break;
+                    }
+                    batch_decode(&rx, 0, run, &got, &samples);
+                    for (size_t i = 0; i < run; i++) {
+                        handle_wiimote_event(&msgs, &ref, rx.reports[i]);
+                        batch_apply(&samples, i, types[t], &got);
+                        mismatches += !same_inputs(&ref, &got);
+                        checked++;
+                    }
+                }
+            }
+        }
+        printf("{\"check\":\"batch_decode\",\"kernel\":\"%s\","
+                "\"reports\":%zu,\"mismatches\":%zu}\n",
+                (*k)->name, checked, mismatches);
+        failed += mismatches;
+    }
+    batch_select(batch_kernels()[0]->name);
+    msg_queue_free(&msgs);
+    return failed;
+}
+
+/*
+ * The MotionPlus probe at 0xa600fa and the extension signature at
+ * 0xa400fa share the reply offset 0x00fa. Both are started together
+ * against the emulator and the first read reply is lost; each completion
+ * still has to get its own bytes. Returns the number of wrong answers.
+ */
+typedef struct {
+    int calls;
+    uint8_t error;
+    uint8_t data[6];
+} read_answer_t;
+
+static read_answer_t answer_mp, answer_ext;
+
+static void record_answer(read_answer_t *a, const mem_read_t *rd) {
+    a->calls++;
+    a->error = rd->error;
+    memcpy(a->data, rd->data, sizeof(a->data));
+}
+
+static void got_mp_id(msg_queue_t *msgs, struct wiimote_state *state,
+        const mem_read_t *rd) {
+    (void)msgs;
+    (void)state;
+    record_answer(&answer_mp, rd);
+}
+
+static void got_ext_id(msg_queue_t *msgs, struct wiimote_state *state,
+        const mem_read_t *rd) {
+    (void)msgs;
+    (void)state;
+    record_answer(&answer_ext, rd);
+}
+
+typedef struct {
+    uint8_t buf[8][EMU_REPORT_SIZE];
+    size_t count;
+} reply_log_t;
+
+static void collect_reply(void *ctx, const uint8_t *buf, size_t len) {
+    reply_log_t *log = ctx;
+    if (log->count < 8 && len <= EMU_REPORT_SIZE) {
+        memcpy(log->buf[log->count++], buf, len);
+    }
+}
+
+static size_t check_memread(void) {
+    static wiimote_emu_t emu;
+    static wiimote_state_t state;
+    msg_queue_t msgs;
+    reply_log_t replies;
+    uint8_t scratch[CMD_MAX_LEN], given_up[MSG_PIPELINE];
+    uint64_t now = 0;
+    int lost = 0;
+    memset(&state, 0, sizeof(state));
+    memset(&answer_mp, 0, sizeof(answer_mp));
+    memset(&answer_ext, 0, sizeof(answer_ext));
+    emu_init(&emu);
+    emu_set_extension(&emu, EMU_EXT_NUNCHUCK, NULL, NULL);
+    msg_queue_init(&msgs, MSGQ_DEFAULT_DEPTH);
+    // unencrypted, as after the handshake writes
+    enqueue_msg(&msgs, CMD_EXT_DECRYPT_1, NULL);
+    enqueue_msg(&msgs, CMD_EXT_DECRYPT_2, NULL);
+    memread_start(&state.reads, &msgs, MEMREAD_REGISTER, MP_ID_ADDR, 6,
+            got_mp_id);
+    memread_start(&state.reads, &msgs, MEMREAD_REGISTER, EXT_ID_ADDR, 6,
+            got_ext_id);
+    for (int round = 0; round < 16; round++) {
+        const msg_t *msg;
+        replies.count = 0;
+        while ((msg = next_msg(&msgs)) != NULL) {
+            size_t len;
+            const uint8_t *out = encode_msg(&msgs, msg, scratch, &len);
+            msg_sent(&msgs, now);
+            emu_handle_output(&emu, out, len, collect_reply, &replies);
+        }
+        for (size_t i = 0; i < replies.count; i++) {
+            if (replies.buf[i][0] == ACK_OUT_RETURN) {
+                msg_replied(&msgs, replies.buf[i][3]);
+                continue;
+            }
+            if (replies.buf[i][0] != READ_MEMREG_REPLY) {
+                continue;
+            }
+            if (!lost) {
+                lost = 1;
+                continue;
+            }
+            memread_reply(&state.reads, &msgs, &state, replies.buf[i]);
+        }
+        now += MSG_TIMEOUT_NS << MSG_MAX_RETRIES;
+        size_t n = msg_timeout(&msgs, now, given_up);
+        for (size_t i = 0; i < n; i++) {
+            memread_abort_oldest(&state.reads, &msgs, &state);
+        }
+    }
+    msg_queue_free(&msgs);
+    size_t wrong = 0;
+    if (answer_mp.calls != 1 || answer_mp.error != 0
+        || answer_mp.data[2] != 0xa6 || answer_mp.data[3] != 0x20) {
+        wrong++;
+    }
+    if (answer_ext.calls != 1 || answer_ext.error != 0
+        || answer_ext.data[2] != 0xa4 || answer_ext.data[3] != 0x20) {
+        wrong++;
+    }
+    printf("{\"check\":\"memread_overlap\",\"lost\":%d,"
+            "\"mismatches\":%zu}\n", lost, wrong);
+    return wrong;
+}
+
+/*
+ * Event engines: ENGINE_DEVICES socketpairs stand in for hidraw, each round
+ * queues a burst of button reports per device and times how long the
+ * engine takes to read, translate and write all of them to a second
+ * socketpair, drained between rounds. Like uinput it can be polled, so the
+ * engines watch it for force feedback as they would a real device.
+ * A burst of 1 is the usual case, bursts show how well backlogs drain.
+ */
+typedef struct {
+    pool_t pool;
+    wiimote_context_t *devices[ENGINE_DEVICES];
+    int inputs[ENGINE_DEVICES];
+    int peers[ENGINE_DEVICES];
+    int outputs[ENGINE_DEVICES];
+    int output_peers[ENGINE_DEVICES];
+    unsigned int toggle;
+} engine_rig_t;
+
+// outputs are looked up by input fd, like the load generator does
+static engine_rig_t *bench_rig;
+
+static int open_sink(int input_fd) {
+    for (size_t d = 0; d < ENGINE_DEVICES; d++) {
+        if (bench_rig->inputs[d] == input_fd) {
+            return bench_rig->outputs[d];
+        }
+    }
+    return -1;
+}
+
+static void close_fd(int fd) {
+    close(fd);
+}
+
+static const io_backend_t bench_backend = {
+    .name = "bench",
+    .read = read,
+    .write = write,
+    .close = close_fd,
+    .open_output = open_sink,
+    .close_output = close_fd,
+};
+
+static int rig_init(engine_rig_t *rig) {
+    device_backend = &bench_backend;
+    bench_rig = rig;
+    rig->toggle = 0;
+    pool_init(&rig->pool, sizeof(wiimote_context_t), ENGINE_DEVICES);
+    for (size_t d = 0; d < ENGINE_DEVICES; d++) {
+        int sv[2], out[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+            return -1;
+        }
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, out) < 0) {
+            return -1;
+        }
+        fcntl(sv[0], F_SETFL, O_NONBLOCK);
+        rig->inputs[d] = sv[0];
+        rig->peers[d] = sv[1];
+        rig->outputs[d] = out[0];
+        rig->output_peers[d] = out[1];
+        rig->devices[d] = create_wiimote_context(&rig->pool, sv[0], "bench",
+                NULL);
+        if (rig->devices[d] == NULL) {
+            return -1;
+        }
+        ready_state(&rig->devices[d]->state, EXT_NONE);
+    }
+    return 0;
+}
+
+static void rig_destroy(engine_rig_t *rig) {
+    for (size_t d = 0; d < ENGINE_DEVICES; d++) {
+        release_wiimote_context(&rig->pool, rig->devices[d]);
+        close(rig->peers[d]);
+        close(rig->output_peers[d]);
+    }
+    pool_destroy(&rig->pool);
+}
+
+// every report toggles A so each one ends in a uinput write
+static void rig_feed(engine_rig_t *rig, size_t burst) {
+    for (size_t d = 0; d < ENGINE_DEVICES; d++) {
+        for (size_t i = 0; i < burst; i++) {
+            uint8_t r[3] = {0x30, 0x00, (uint8_t)(rig->toggle++ & 1 ? 0x08 : 0x00)};
+            if (write(rig->peers[d], r, sizeof(r)) < 0) {
+                perror("bench feed");
+            }
+        }
+    }
+}
+
+// outside the timed part, as a reading game would
+static void rig_drain(engine_rig_t *rig) {
+    struct input_event events[64];
+    for (size_t d = 0; d < ENGINE_DEVICES; d++) {
+        while (read(rig->output_peers[d], events, sizeof(events)) > 0) {
+        }
+    }
+}
+
+static uint64_t rig_translated(const engine_rig_t *rig) {
+    uint64_t n = 0;
+    for (size_t d = 0; d < ENGINE_DEVICES; d++) {
+        n += rig->devices[d]->latency.read_to_emit.count;
+    }
+    return n;
+}
+
+static void bench_engine_epoll(size_t burst) {
+    engine_rig_t rig;
+    char name[32];
+    struct epoll_event events[ENGINE_DEVICES];
+    int epoll_fd = epoll_create1(0);
+    if (rig_init(&rig) < 0) {
+        perror("bench epoll rig");
+        return;
+    }
+    for (size_t d = 0; d < ENGINE_DEVICES; d++) {
+        if (watch_wiimote(rig.devices[d], epoll_fd) < 0) {
+            rig_destroy(&rig);
+            close(epoll_fd);
+            return;
+        }
+    }
+    uint64_t elapsed = 0, target = 0;
+    for (size_t round = 0; round < ENGINE_ROUNDS; round++) {
+        rig_feed(&rig, burst);
+        target += ENGINE_DEVICES * burst;
+        uint64_t start = lat_now_ns();
+        while (rig_translated(&rig) < target) {
+            int n = epoll_wait(epoll_fd, events, ENGINE_DEVICES, 1000);
+            for (int i = 0; i < n; i++) {
+                serve_wiimote_event(events[i].data.ptr,
+                        events[i].events, epoll_fd);
+            }
+        }
+        elapsed += lat_now_ns() - start;
+        rig_drain(&rig);
+    }
+    snprintf(name, sizeof(name), "socketpair_burst%zu", burst);
+    report("engine/epoll", name, (size_t)target, elapsed);
+    rig_destroy(&rig);
+    close(epoll_fd);
+}
+
+static void bench_engine_uring(size_t burst) {
+    engine_rig_t rig;
+    char name[32];
+    uring_engine_t ring;
+    if (uring_init(&ring) < 0) {
+        fprintf(stderr, "io_uring unavailable, skipping engine/io_uring\n");
+        return;
+    }
+    if (rig_init(&rig) < 0) {
+        perror("bench io_uring rig");
+        uring_destroy(&ring);
+        return;
+    }
+    for (size_t d = 0; d < ENGINE_DEVICES; d++) {
+        if (uring_watch(&ring, rig.devices[d]) < 0) {
+            uring_destroy(&ring);
+            rig_destroy(&rig);
+            return;
+        }
+    }
+    uint64_t elapsed = 0, target = 0;
+    for (size_t round = 0; round < ENGINE_ROUNDS; round++) {
+        rig_feed(&rig, burst);
+        target += ENGINE_DEVICES * burst;
+        uint64_t start = lat_now_ns();
+        while (rig_translated(&rig) < target) {
+            uring_run(&ring, &rig.pool);
+        }
+        elapsed += lat_now_ns() - start;
+        rig_drain(&rig);
+    }
+    snprintf(name, sizeof(name), "socketpair_burst%zu", burst);
+    report("engine/io_uring", name, (size_t)target, elapsed);
+    // pending reads hold the fds, tear the ring down first
+    uring_destroy(&ring);
+    rig_destroy(&rig);
+}
+
+static const uint8_t report_types[] = {
+    0x20, 0x21, 0x22,
+    0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+    0x3d, 0x3e, 0x3f,
+};
+
+int main(int argc, char *argv[]) {
+    corpus_t c;
+    char name[48];
+    // logging stays disabled: we measure decoding, not stdio
+    int sink_fd = open("/dev/null", O_WRONLY);
+
+    if (check_batch(report_types, sizeof(report_types)) > 0) {
+        fprintf(stderr, "batch decoding differs from the parsers\n");
+        return 1;
+    }
+    if (check_memread() > 0) {
+        fprintf(stderr, "memory read replies went to the wrong read\n");
+        return 1;
+    }
+
+    for (size_t t = 0; t < sizeof(report_types); t++) {
+        corpus_random(&c, report_types[t]);
+        snprintf(name, sizeof(name), "synthetic_%02x", report_types[t]);
+        if (report_types[t] == 0x32) {
+            bench_parse_wiimote(&c, name);
+            bench_parse_nunchuck(&c, name);
+            bench_parse_cc(&c, name);
+            bench_spoofer(&c, name, sink_fd);
+        }
+        if (report_types[t] == 0x32 || report_types[t] == 0x37) {
+            bench_batch(&c, name, EXT_CLASSIC_CONTROLLER);
+            bench_batch(&c, name, EXT_NUNCHUCK);
+        }
+        bench_dispatch(&c, name, "handle_wiimote_event/cc",
+                EXT_CLASSIC_CONTROLLER);
+        bench_dispatch(&c, name, "handle_wiimote_event/nunchuck",
+                EXT_NUNCHUCK);
+        free(c.reports);
+    }
+
+    for (size_t burst = 1; burst <= 16; burst *= 4) {
+        bench_engine_epoll(burst);
+        bench_engine_uring(burst);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (corpus_load(&c, argv[i]) < 0) {
+            return 1;
+        }
+        bench_dispatch(&c, argv[i], "handle_wiimote_event/recorded",
+                EXT_CLASSIC_CONTROLLER);
+        bench_spoofer(&c, argv[i], sink_fd);
+        free(c.reports);
+    }
+    close(sink_fd);
+    return 0;
+}
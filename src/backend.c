@@ -0,0 +1,57 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "loadgen.h"
+#include "spoofer.h"
+
+static void close_fd(int fd) {
+    close(fd);
+}
+
+static int open_uinput(int input_fd) {
+    (void)input_fd;
+    return create_uinput_device();
+}
+
+static int open_motion_uinput(int input_fd) {
+    (void)input_fd;
+    return create_motion_device();
+}
+
+static int open_pointer_uinput(int input_fd) {
+    (void)input_fd;
+    return create_pointer_device();
+}
+
+// simulated Wiimotes only measure the gamepad path
+static int open_sink(int input_fd) {
+    (void)input_fd;
+    return open("/dev/null", O_WRONLY | O_CLOEXEC);
+}
+
+static void close_uinput(int fd) {
+    destroy_uinput_device(fd);
+}
+
+const io_backend_t hidraw_backend = {
+    .name = "hidraw",
+    .read = read,
+    .write = write,
+    .close = close_fd,
+    .open_output = open_uinput,
+    .open_motion = open_motion_uinput,
+    .open_pointer = open_pointer_uinput,
+    .close_output = close_uinput,
+};
+
+const io_backend_t sim_backend = {
+    .name = "simulated",
+    .read = read,
+    .write = write,
+    .close = close_fd,
+    .open_output = loadgen_output_fd,
+    .open_motion = open_sink,
+    .open_pointer = open_sink,
+    .close_output = close_fd,
+};
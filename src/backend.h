@@ -0,0 +1,26 @@
+#ifndef _GBACKEND_H_
+#define _GBACKEND_H_
+
+#include <sys/types.h>
+
+/*
+ * Device I/O used by the event loop. Input fds are opened by whoever
+ * discovers the controllers (udev for hidraw, the load generator for
+ * simulated ones), the output side is opened per input fd.
+ */
+typedef struct {
+    const char *name;
+    ssize_t (*read)(int fd, void *buf, size_t len);
+    ssize_t (*write)(int fd, const void *buf, size_t len);
+    void (*close)(int fd);
+    int (*open_output)(int input_fd);
+    // accelerometer and IR pointer outputs, closed with close_output
+    int (*open_motion)(int input_fd);
+    int (*open_pointer)(int input_fd);
+    void (*close_output)(int fd);
+} io_backend_t;
+
+extern const io_backend_t hidraw_backend;
+extern const io_backend_t sim_backend;
+
+#endif // _GBACKEND_H_
@@ -0,0 +1,412 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "batch.h"
+#include "commands.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BATCH_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Where the extension bytes start in each data report with core buttons,
+ * 0 when it carries none. Reports handle_wiimote_event() doesn't translate
+ * are left out and take the reference path.
+ */
+static const uint8_t ext_offset[8] = {
+    [DATA_REP_COREBTNS - DATA_REP_COREBTNS] = 0,
+    [DATA_REP_COREACC - DATA_REP_COREBTNS] = 0,
+    [DATA_REP_COREEXT8 - DATA_REP_COREBTNS] = 3,
+    [DATA_REP_COREACCIR12 - DATA_REP_COREBTNS] = 0,
+    [DATA_REP_COREACC16 - DATA_REP_COREBTNS] = 6,
+    [DATA_REP_COREIR10EXT9 - DATA_REP_COREBTNS] = 13,
+    [DATA_REP_COREACCIR10EXT6 - DATA_REP_COREBTNS] = 16,
+};
+
+// where the IR camera bytes start, 0 when the report has none
+static const uint8_t ir_offset[8] = {
+    [DATA_REP_COREACCIR12 - DATA_REP_COREBTNS] = 6,
+    [DATA_REP_COREIR10EXT9 - DATA_REP_COREBTNS] = 3,
+    [DATA_REP_COREACCIR10EXT6 - DATA_REP_COREBTNS] = 6,
+};
+
+static int has_accel(uint8_t type) {
+    return type == DATA_REP_COREACC
+        || type == DATA_REP_COREACCIR12
+        || type == DATA_REP_COREACC16
+        || type == DATA_REP_COREACCIR10EXT6;
+}
+
+static int batchable(uint8_t type) {
+    return type >= DATA_REP_COREBTNS
+        && type <= DATA_REP_COREACCIR10EXT6
+        && type != DATA_REP_COREEXT19;
+}
+
+// the extension decoded alongside the buttons, EXT_NONE for buttons only
+static enum extension_status decoded_ext(uint8_t type,
+        const wiimote_state_t *state) {
+    if (ext_offset[type - DATA_REP_COREBTNS] == 0) {
+        return EXT_NONE;
+    }
+    switch (state->ext_status) {
+        case EXT_NUNCHUCK:
+        case EXT_CLASSIC_CONTROLLER:
+            return state->ext_status;
+        case EXT_NONE:
+        case EXT_WAITING_DECRYPTION_0:
+        case EXT_WAITING_DECRYPTION_1:
+        case EXT_DECRYPTED:
+        case EXT_UNKNOWN:
+        default:
+            return EXT_NONE;
+    }
+}
+
+/*
+ * Number of reports from first on that can be decoded together: same data
+ * report type, long enough, and an extension format the kernels know.
+ * Everything else, including the rare Classic Controller data formats
+ * parse_cc() rejects and extension bytes an active MotionPlus sends, goes
+ * through handle_wiimote_event().
+ */
+size_t batch_run_length(const report_batch_t *batch, size_t first,
+        const wiimote_state_t *state) {
+    uint8_t type = batch->reports[first][0];
+    if (!batchable(type)) {
+        return 0;
+    }
+    if (decoded_ext(type, state) == EXT_CLASSIC_CONTROLLER
+        && state->classic_controller.data_format != 1) {
+        return 0;
+    }
+    // gyro samples and passthrough data take turns, one at a time
+    if (ext_offset[type - DATA_REP_COREBTNS] != 0
+        && (state->mp.status == MP_ACTIVATING
+            || state->mp.status == MP_ACTIVE
+            || state->mp.status == MP_DEACTIVATING)) {
+        return 0;
+    }
+    size_t off = ext_offset[type - DATA_REP_COREBTNS];
+    size_t ir = ir_offset[type - DATA_REP_COREBTNS];
+    size_t min_len = off ? off + 6 : has_accel(type) ? 6 : 3;
+    if (ir && ir + (ir == 3 ? 10 : 12) > min_len) {
+        min_len = ir + (ir == 3 ? 10 : 12);
+    }
+    size_t n = 0;
+    while (first + n < batch->count
+           && batch->reports[first + n][0] == type
+           && batch->len[first + n] >= min_len) {
+        n++;
+    }
+    return n;
+}
+
+// Kernels
+
+/*
+ * Every kernel decodes records laid out as the two core button bytes
+ * followed by the six extension bytes, the same fields parse_wiimote(),
+ * parse_nunchuck() and parse_cc() (data format 1) take from a report.
+ */
+static void decode_scalar(const uint8_t (*recs)[8], size_t n,
+        enum extension_status ext, batch_samples_t *out) {
+    for (size_t i = 0; i < n; i++) {
+        const uint8_t *e = recs[i] + 2;
+        out->buttons[i] = (uint16_t)
+            ((recs[i][0] << 8 | recs[i][1]) & WII_BTN_MASK);
+        if (ext == EXT_NUNCHUCK) {
+            out->axis[CAL_LX][i] = e[0];
+            out->axis[CAL_LY][i] = e[1];
+            out->ext_buttons[i] = (uint16_t)(~e[5] & (NC_BTN_C | NC_BTN_Z));
+        } else if (ext == EXT_CLASSIC_CONTROLLER) {
+            out->axis[CAL_LX][i] = e[0] & 0x3f;
+            out->axis[CAL_LY][i] = e[1] & 0x3f;
+            out->axis[CAL_RX][i] = (uint8_t)((e[2] & 0x80) >> 7
+                    | (e[1] & 0xc0) >> 5
+                    | (e[0] & 0xc0) >> 3);
+            out->axis[CAL_RY][i] = e[2] & 0x1f;
+            out->axis[CAL_LT][i] = (uint8_t)((e[3] & 0xe0) >> 5
+                    | (e[2] & 0x60) >> 2);
+            out->axis[CAL_RT][i] = e[3] & 0x1f;
+            out->ext_buttons[i] = (uint16_t)
+                (~(e[4] << 8 | e[5]) & CC_BTN_MASK);
+        }
+    }
+}
+
+#ifdef BATCH_X86
+/*
+ * 8 records in 4 registers become 4 registers of 16-bit words, one per
+ * record field pair: w0 = buttons, w1 = e0|e1, w2 = e2|e3, w3 = e4|e5
+ * (little endian, so the first byte of a pair is the low one).
+ */
+#define TRANSPOSE_8X4(unpacklo16, unpackhi16, unpacklo64, unpackhi64, \
+        r0, r1, r2, r3, w0, w1, w2, w3) do { \
+    __typeof__(r0) t0 = unpacklo16(r0, r1), t1 = unpackhi16(r0, r1); \
+    __typeof__(r0) t2 = unpacklo16(r2, r3), t3 = unpackhi16(r2, r3); \
+    __typeof__(r0) u0 = unpacklo16(t0, t1), u1 = unpackhi16(t0, t1); \
+    __typeof__(r0) u2 = unpacklo16(t2, t3), u3 = unpackhi16(t2, t3); \
+    w0 = unpacklo64(u0, u2); \
+    w1 = unpackhi64(u0, u2); \
+    w2 = unpacklo64(u1, u3); \
+    w3 = unpackhi64(u1, u3); \
+} while (0)
+
+__attribute__((target("sse2")))
+static void store_axes_sse2(batch_samples_t *out, size_t i,
+        enum calib_axis a, enum calib_axis b, __m128i va, __m128i vb) {
+    __m128i packed = _mm_packus_epi16(va, vb);
+    _mm_storel_epi64((__m128i *)(out->axis[a] + i), packed);
+    _mm_storel_epi64((__m128i *)(out->axis[b] + i),
+            _mm_unpackhi_epi64(packed, packed));
+}
+
+__attribute__((target("sse2")))
+static void decode_sse2(const uint8_t (*recs)[8], size_t n,
+        enum extension_status ext, batch_samples_t *out) {
+    const __m128i low = _mm_set1_epi16(0xff);
+    for (size_t i = 0; i < n; i += 8) {
+        __m128i r0 = _mm_loadu_si128((const __m128i *)recs[i]);
+        __m128i r1 = _mm_loadu_si128((const __m128i *)recs[i + 2]);
+        __m128i r2 = _mm_loadu_si128((const __m128i *)recs[i + 4]);
+        __m128i r3 = _mm_loadu_si128((const __m128i *)recs[i + 6]);
+        __m128i w0, w1, w2, w3;
+        TRANSPOSE_8X4(_mm_unpacklo_epi16, _mm_unpackhi_epi16,
+                _mm_unpacklo_epi64, _mm_unpackhi_epi64,
+                r0, r1, r2, r3, w0, w1, w2, w3);
+        // big endian button words
+        __m128i btns = _mm_or_si128(_mm_slli_epi16(w0, 8),
+                _mm_srli_epi16(w0, 8));
+        _mm_storeu_si128((__m128i *)(out->buttons + i),
+                _mm_and_si128(btns, _mm_set1_epi16(WII_BTN_MASK)));
+        if (ext == EXT_NUNCHUCK) {
+            store_axes_sse2(out, i, CAL_LX, CAL_LY,
+                    _mm_and_si128(w1, low), _mm_srli_epi16(w1, 8));
+            _mm_storeu_si128((__m128i *)(out->ext_buttons + i),
+                    _mm_andnot_si128(_mm_srli_epi16(w3, 8),
+                        _mm_set1_epi16(NC_BTN_C | NC_BTN_Z)));
+        } else if (ext == EXT_CLASSIC_CONTROLLER) {
+            __m128i e0 = _mm_and_si128(w1, low);
+            __m128i e1 = _mm_srli_epi16(w1, 8);
+            __m128i e2 = _mm_and_si128(w2, low);
+            __m128i e3 = _mm_srli_epi16(w2, 8);
+            __m128i rx = _mm_or_si128(_mm_srli_epi16(e2, 7),
+                    _mm_or_si128(
+                        _mm_srli_epi16(
+                            _mm_and_si128(e1, _mm_set1_epi16(0xc0)), 5),
+                        _mm_srli_epi16(
+                            _mm_and_si128(e0, _mm_set1_epi16(0xc0)), 3)));
+            __m128i lt = _mm_or_si128(_mm_srli_epi16(e3, 5),
+                    _mm_srli_epi16(
+                        _mm_and_si128(e2, _mm_set1_epi16(0x60)), 2));
+            __m128i m6 = _mm_set1_epi16(0x3f), m5 = _mm_set1_epi16(0x1f);
+            store_axes_sse2(out, i, CAL_LX, CAL_LY,
+                    _mm_and_si128(e0, m6), _mm_and_si128(e1, m6));
+            store_axes_sse2(out, i, CAL_RX, CAL_RY,
+                    rx, _mm_and_si128(e2, m5));
+            store_axes_sse2(out, i, CAL_LT, CAL_RT,
+                    lt, _mm_and_si128(e3, m5));
+            __m128i cc = _mm_or_si128(_mm_slli_epi16(w3, 8),
+                    _mm_srli_epi16(w3, 8));
+            _mm_storeu_si128((__m128i *)(out->ext_buttons + i),
+                    _mm_andnot_si128(cc, _mm_set1_epi16((short)CC_BTN_MASK)));
+        }
+    }
+}
+
+// records i..i+7 in the low lanes, i+8..i+15 in the high ones
+__attribute__((target("avx2")))
+static __m256i load_pairs_avx2(const uint8_t (*recs)[8], size_t i) {
+    return _mm256_inserti128_si256(
+            _mm256_castsi128_si256(
+                _mm_loadu_si128((const __m128i *)recs[i])),
+            _mm_loadu_si128((const __m128i *)recs[i + 8]), 1);
+}
+
+__attribute__((target("avx2")))
+static void store_axes_avx2(batch_samples_t *out, size_t i,
+        enum calib_axis a, enum calib_axis b, __m256i va, __m256i vb) {
+    // packus works per lane: a0-7 b0-7 | a8-15 b8-15, put a before b
+    __m256i packed = _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(va, vb), 0xd8);
+    _mm_storeu_si128((__m128i *)(out->axis[a] + i),
+            _mm256_castsi256_si128(packed));
+    _mm_storeu_si128((__m128i *)(out->axis[b] + i),
+            _mm256_extracti128_si256(packed, 1));
+}
+
+__attribute__((target("avx2")))
+static void decode_avx2(const uint8_t (*recs)[8], size_t n,
+        enum extension_status ext, batch_samples_t *out) {
+    const __m256i low = _mm256_set1_epi16(0xff);
+    for (size_t i = 0; i < n; i += 16) {
+        __m256i r0 = load_pairs_avx2(recs, i);
+        __m256i r1 = load_pairs_avx2(recs, i + 2);
+        __m256i r2 = load_pairs_avx2(recs, i + 4);
+        __m256i r3 = load_pairs_avx2(recs, i + 6);
+        __m256i w0, w1, w2, w3;
+        TRANSPOSE_8X4(_mm256_unpacklo_epi16, _mm256_unpackhi_epi16,
+                _mm256_unpacklo_epi64, _mm256_unpackhi_epi64,
+                r0, r1, r2, r3, w0, w1, w2, w3);
+        __m256i btns = _mm256_or_si256(_mm256_slli_epi16(w0, 8),
+                _mm256_srli_epi16(w0, 8));
+        _mm256_storeu_si256((__m256i *)(out->buttons + i),
+                _mm256_and_si256(btns, _mm256_set1_epi16(WII_BTN_MASK)));
+        if (ext == EXT_NUNCHUCK) {
+            store_axes_avx2(out, i, CAL_LX, CAL_LY,
+                    _mm256_and_si256(w1, low), _mm256_srli_epi16(w1, 8));
+            _mm256_storeu_si256((__m256i *)(out->ext_buttons + i),
+                    _mm256_andnot_si256(_mm256_srli_epi16(w3, 8),
+                        _mm256_set1_epi16(NC_BTN_C | NC_BTN_Z)));
+        } else if (ext == EXT_CLASSIC_CONTROLLER) {
+            __m256i e0 = _mm256_and_si256(w1, low);
+            __m256i e1 = _mm256_srli_epi16(w1, 8);
+            __m256i e2 = _mm256_and_si256(w2, low);
+            __m256i e3 = _mm256_srli_epi16(w2, 8);
+            __m256i rx = _mm256_or_si256(_mm256_srli_epi16(e2, 7),
+                    _mm256_or_si256(
+                        _mm256_srli_epi16(_mm256_and_si256(
+                                e1, _mm256_set1_epi16(0xc0)), 5),
+                        _mm256_srli_epi16(_mm256_and_si256(
+                                e0, _mm256_set1_epi16(0xc0)), 3)));
+            __m256i lt = _mm256_or_si256(_mm256_srli_epi16(e3, 5),
+                    _mm256_srli_epi16(_mm256_and_si256(
+                            e2, _mm256_set1_epi16(0x60)), 2));
+            __m256i m6 = _mm256_set1_epi16(0x3f);
+            __m256i m5 = _mm256_set1_epi16(0x1f);
+            store_axes_avx2(out, i, CAL_LX, CAL_LY,
+                    _mm256_and_si256(e0, m6), _mm256_and_si256(e1, m6));
+            store_axes_avx2(out, i, CAL_RX, CAL_RY,
+                    rx, _mm256_and_si256(e2, m5));
+            store_axes_avx2(out, i, CAL_LT, CAL_RT,
+                    lt, _mm256_and_si256(e3, m5));
+            __m256i cc = _mm256_or_si256(_mm256_slli_epi16(w3, 8),
+                    _mm256_srli_epi16(w3, 8));
+            _mm256_storeu_si256((__m256i *)(out->ext_buttons + i),
+                    _mm256_andnot_si256(cc, _mm256_set1_epi16((short)CC_BTN_MASK)));
+        }
+    }
+}
+#endif // BATCH_X86
+
+static const batch_kernel_t scalar_kernel = {"scalar", decode_scalar};
+#ifdef BATCH_X86
+static const batch_kernel_t sse2_kernel = {"sse2", decode_sse2};
+static const batch_kernel_t avx2_kernel = {"avx2", decode_avx2};
+#endif
+
+static const batch_kernel_t *kernels[4];
+static const batch_kernel_t *selected;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void detect_kernels(void) {
+    size_t n = 0;
+#ifdef BATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernels[n++] = &avx2_kernel;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        kernels[n++] = &sse2_kernel;
+    }
+#endif
+    kernels[n++] = &scalar_kernel;
+    kernels[n] = NULL;
+    selected = kernels[0];
+}
+
+const batch_kernel_t *const *batch_kernels(void) {
+    pthread_once(&kernels_once, detect_kernels);
+    return kernels;
+}
+
+const batch_kernel_t *batch_kernel(void) {
+    pthread_once(&kernels_once, detect_kernels);
+    return selected;
+}
+
+int batch_select(const char *name) {
+    for (const batch_kernel_t *const *k = batch_kernels(); *k; k++) {
+        if (strcmp((*k)->name, name) == 0) {
+            selected = *k;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Decodes the n reports from first on, a run found by batch_run_length().
+ * Column k of out holds report first + k.
+ */
+void batch_decode(const report_batch_t *batch, size_t first, size_t n,
+        const wiimote_state_t *state, batch_samples_t *out) {
+    // kernels read whole groups of REPORT_BATCH_LANES records
+    uint8_t recs[REPORT_BATCH_MAX][8] __attribute__((aligned(32))) = {{0}};
+    uint8_t type = batch->reports[first][0];
+    size_t off = ext_offset[type - DATA_REP_COREBTNS];
+    enum extension_status ext = decoded_ext(type, state);
+    for (size_t k = 0; k < n; k++) {
+        const uint8_t *rep = batch->reports[first + k];
+        recs[k][0] = rep[1];
+        recs[k][1] = rep[2];
+        if (off) {
+            memcpy(recs[k] + 2, rep + off, 6);
+        }
+        if (has_accel(type)) {
+            decode_wiimote_accel(rep + 1, rep + 3, out->accel[k]);
+        }
+        if (ext == EXT_NUNCHUCK) {
+            decode_nunchuck_accel(rep + off, out->ext_accel[k]);
+        }
+        if (ir_offset[type - DATA_REP_COREBTNS]) {
+            out->ir[k].mode = state->ir.mode;
+            out->ir[k].seq = (uint8_t)(state->ir.seq + k);
+            parse_ir(rep + ir_offset[type - DATA_REP_COREBTNS], &out->ir[k]);
+        }
+    }
+    size_t lanes = (n + REPORT_BATCH_LANES - 1)
+        / REPORT_BATCH_LANES * REPORT_BATCH_LANES;
+    batch_kernel()->decode(recs, lanes, ext, out);
+}
+
+// Applies column i to the state, as handle_wiimote_event() would
+void batch_apply(const batch_samples_t *samples, size_t i,
+        uint8_t type, wiimote_state_t *state) {
+    state->buttons = samples->buttons[i];
+    if (has_accel(type)) {
+        memcpy(state->accel, samples->accel[i], sizeof(state->accel));
+    }
+    if (ir_offset[type - DATA_REP_COREBTNS]) {
+        state->ir = samples->ir[i];
+    }
+    switch (decoded_ext(type, state)) {
+        case EXT_NUNCHUCK:
+            state->nunchuck.sx = samples->axis[CAL_LX][i];
+            state->nunchuck.sy = samples->axis[CAL_LY][i];
+            state->nunchuck.buttons = (uint8_t)samples->ext_buttons[i];
+            memcpy(state->nunchuck.accel, samples->ext_accel[i],
+                    sizeof(state->nunchuck.accel));
+            break;
+        case EXT_CLASSIC_CONTROLLER: {
+            classic_controller_state_t *cc = &state->classic_controller;
+            cc->lx = samples->axis[CAL_LX][i];
+            cc->ly = samples->axis[CAL_LY][i];
+            cc->rx = samples->axis[CAL_RX][i];
+            cc->ry = samples->axis[CAL_RY][i];
+            cc->lt = samples->axis[CAL_LT][i];
+            cc->rt = samples->axis[CAL_RT][i];
+            cc->buttons = samples->ext_buttons[i];
+            break;
+        }
+        case EXT_NONE:
+        case EXT_WAITING_DECRYPTION_0:
+        case EXT_WAITING_DECRYPTION_1:
+        case EXT_DECRYPTED:
+        case EXT_UNKNOWN:
+        default:
+            break;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef _GBATCH_H_
+#define _GBATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "calib.h"
+#include "wiimote.h"
+
+/*
+ * Batch decoding of buffered data reports. When a Wiimote has a backlog
+ * its pending reports are read into one buffer and every run of data
+ * reports of the same type is unpacked at once: the button and extension
+ * bytes of each report are gathered into 8-byte records, transposed and
+ * decoded REPORT_BATCH_LANES at a time by a SIMD kernel chosen at runtime.
+ * parse_wiimote(), parse_nunchuck() and parse_cc() stay the reference,
+ * `make bench` checks every kernel against them.
+ */
+#define REPORT_BATCH_MAX 32
+// hidraw input reports of a Wiimote are at most 22 bytes long
+#define REPORT_BATCH_STRIDE 32
+// widest kernel, REPORT_BATCH_MAX is a multiple of it
+#define REPORT_BATCH_LANES 16
+
+typedef struct {
+    uint8_t reports[REPORT_BATCH_MAX][REPORT_BATCH_STRIDE];
+    size_t len[REPORT_BATCH_MAX];
+    uint64_t t_read[REPORT_BATCH_MAX];
+    size_t count;
+} report_batch_t;
+
+/*
+ * Decoded reports, one column per report; nunchuck sticks use CAL_LX/LY.
+ * Accelerometer and IR samples are unpacked while gathering, not by the
+ * kernels.
+ */
+typedef struct {
+    uint16_t buttons[REPORT_BATCH_MAX];
+    uint16_t ext_buttons[REPORT_BATCH_MAX];
+    uint8_t axis[CAL_AXES][REPORT_BATCH_MAX];
+    uint16_t accel[REPORT_BATCH_MAX][ACC_AXES];
+    uint16_t ext_accel[REPORT_BATCH_MAX][ACC_AXES];
+    ir_state_t ir[REPORT_BATCH_MAX];
+} batch_samples_t;
+
+typedef struct {
+    const char *name;
+    // decodes n records, rounded up to the kernel width
+    void (*decode)(const uint8_t (*recs)[8], size_t n,
+            enum extension_status ext, batch_samples_t *out);
+} batch_kernel_t;
+
+// kernels usable on this CPU, best first; NULL terminated
+const batch_kernel_t *const *batch_kernels(void);
+const batch_kernel_t *batch_kernel(void);
+int batch_select(const char *name);
+
+size_t batch_run_length(const report_batch_t *batch, size_t first,
+        const wiimote_state_t *state);
+void batch_decode(const report_batch_t *batch, size_t first, size_t n,
+        const wiimote_state_t *state, batch_samples_t *out);
+void batch_apply(const batch_samples_t *samples, size_t i,
+        uint8_t type, wiimote_state_t *state);
+
+#endif // _GBATCH_H_
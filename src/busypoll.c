@@ -0,0 +1,117 @@
+#include <string.h>
+
+#include "busypoll.h"
+#include "device.h"
+#include "logger.h"
+
+void busypoll_init(busypoll_t *bp, uint64_t window_ns) {
+    memset(bp, 0, sizeof(*bp));
+    bp->window_ns = window_ns;
+    bp->since_ns = lat_now_ns();
+}
+
+// earliest predicted report among the Wiimotes with a known cadence
+static uint64_t next_arrival(const pool_t *wiimotes) {
+    uint64_t next = UINT64_MAX;
+    for (size_t i = 0; i < pool_capacity(wiimotes); i++) {
+        const wiimote_context_t *wm = pool_at(wiimotes, i);
+        if (!wm->active || wm->busy_missed || wm->read_failed
+            || wm->report_interval_ns == 0) {
+            continue;
+        }
+        uint64_t t = wm->last_report_ns + wm->report_interval_ns;
+        if (t < next) {
+            next = t;
+        }
+    }
+    return next;
+}
+
+static void mark_missed(pool_t *wiimotes, uint64_t deadline) {
+    for (size_t i = 0; i < pool_capacity(wiimotes); i++) {
+        wiimote_context_t *wm = pool_at(wiimotes, i);
+        if (wm->active && wm->report_interval_ns != 0
+            && wm->last_report_ns + wm->report_interval_ns <= deadline) {
+            wm->busy_missed = 1;
+        }
+    }
+}
+
+// one non-blocking read round over every Wiimote, 1 if any reported
+static int poll_round(pool_t *wiimotes, int epoll_fd) {
+    int hit = 0;
+    for (size_t i = 0; i < pool_capacity(wiimotes); i++) {
+        wiimote_context_t *wm = pool_at(wiimotes, i);
+        if (!wm->active || wm->read_failed) {
+            continue;
+        }
+        uint64_t before = wm->last_report_ns;
+        handle_wiimote_fd(wm, EPOLLIN, epoll_fd);
+        hit |= wm->last_report_ns != before;
+    }
+    return hit;
+}
+
+/*
+ * Drop-in for epoll_wait in the main loop. Returns the epoll events still
+ * to be served; reports caught while spinning are already handled, in
+ * which case 0 is returned.
+ */
+int busypoll_wait(busypoll_t *bp,
+        pool_t *wiimotes,
+        int epoll_fd,
+        struct epoll_event *events,
+        int max_events) {
+    uint64_t next = next_arrival(wiimotes);
+    if (next == UINT64_MAX) {
+        return epoll_wait(epoll_fd, events, max_events, 30000);
+    }
+    uint64_t half = bp->window_ns / 2;
+    uint64_t now = lat_now_ns();
+    if (now + half < next) {
+        // epoll only takes milliseconds: wake up early rather than late
+        int timeout_ms = (int)((next - half - now) / 1000000);
+        if (timeout_ms > 0) {
+            int n = epoll_wait(epoll_fd, events, max_events, timeout_ms);
+            if (n != 0) {
+                now = lat_now_ns();
+                if (n > 0 && now + half >= next) {
+                    lat_hist_add(&bp->late_epoll, now > next ? now - next : 0);
+                }
+                return n;
+            }
+        }
+    }
+
+    uint64_t start = lat_now_ns();
+    uint64_t deadline = next + half;
+    int hit = 0;
+    bp->spins++;
+    do {
+        hit = poll_round(wiimotes, epoll_fd);
+        now = lat_now_ns();
+    } while (!hit && now < deadline);
+    bp->spin_ns += now - start;
+    if (hit) {
+        bp->hits++;
+        lat_hist_add(&bp->late_spin, now > next ? now - next : 0);
+    } else {
+        mark_missed(wiimotes, deadline);
+    }
+    // the udev monitor may have fired meanwhile
+    return epoll_wait(epoll_fd, events, max_events, 0);
+}
+
+void busypoll_dump(busypoll_t *bp) {
+    uint64_t now = lat_now_ns();
+    uint64_t elapsed = now - bp->since_ns;
+    LOG_INFO("Busy poll (window %lluus): %.1f%% of a CPU spinning, "
+            "%llu of %llu spins caught a report",
+            (unsigned long long)(bp->window_ns / 1000),
+            elapsed ? 100.0 * (double)bp->spin_ns / (double)elapsed : 0.0,
+            (unsigned long long)bp->hits,
+            (unsigned long long)bp->spins);
+    lat_hist_dump(&bp->late_spin, "late (spin)");
+    lat_hist_dump(&bp->late_epoll, "late (epoll)");
+    busypoll_init(bp, bp->window_ns);
+}
@@ -0,0 +1,39 @@
+#ifndef _GBUSYPOLL_H_
+#define _GBUSYPOLL_H_
+
+#include <stdint.h>
+
+#include <sys/epoll.h>
+
+#include "latency.h"
+#include "pool.h"
+
+/*
+ * Adaptive busy polling. Continuous reporting Wiimotes send a report every
+ * ~10ms, so instead of sleeping in epoll until the kernel wakes us, the
+ * loop sleeps until shortly before the next predicted report and then
+ * spins with non-blocking reads for at most window_ns around it. Devices
+ * whose prediction misses fall back to plain epoll until they report
+ * again.
+ */
+typedef struct {
+    uint64_t window_ns;
+    // since the last dump
+    uint64_t since_ns;
+    uint64_t spin_ns;
+    uint64_t spins;
+    uint64_t hits;
+    // report pickup relative to its predicted arrival, by wakeup source
+    lat_hist_t late_spin;
+    lat_hist_t late_epoll;
+} busypoll_t;
+
+void busypoll_init(busypoll_t *bp, uint64_t window_ns);
+int busypoll_wait(busypoll_t *bp,
+        pool_t *wiimotes,
+        int epoll_fd,
+        struct epoll_event *events,
+        int max_events);
+void busypoll_dump(busypoll_t *bp);
+
+#endif // _GBUSYPOLL_H_
@@ -0,0 +1,155 @@
+#include <string.h>
+
+#include "calib.h"
+
+static const input_profile_t profiles[] = {
+    {"default", 5, 0, 2, 0, 2},
+    // small deadzone, softer center for aiming
+    {"precise", 2, 40, 0, 0, 2},
+    // no processing at all, for games with their own curves
+    {"raw", 0, 0, 0, 0, 0},
+};
+
+input_profile_t input_profile = {"default", 5, 0, 2, 0, 2};
+
+int calib_select_profile(const char *name) {
+    for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+        if (strcmp(profiles[i].name, name) == 0) {
+            input_profile = profiles[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Calibration blocks end with two checksum bytes: the sum of the first
+ * 14 bytes plus 0x55 and plus 0xaa.
+ */
+int calib_valid(const uint8_t calib[EXT_CALIB_SIZE]) {
+    uint8_t sum = 0;
+    for (size_t i = 0; i < EXT_CALIB_SIZE - 2; i++) {
+        sum = (uint8_t)(sum + calib[i]);
+    }
+    return calib[14] == (uint8_t)(sum + 0x55)
+        && calib[15] == (uint8_t)(sum + 0xaa);
+}
+
+// the Wiimote's own block has a single checksum: sum of 9 bytes + 0x55
+int calib_wiimote_valid(const uint8_t calib[WII_CALIB_SIZE]) {
+    uint8_t sum = 0;
+    for (size_t i = 0; i < WII_CALIB_SIZE - 1; i++) {
+        sum = (uint8_t)(sum + calib[i]);
+    }
+    return calib[WII_CALIB_SIZE - 1] == (uint8_t)(sum + 0x55);
+}
+
+typedef struct {
+    uint8_t min, center, max;
+} axis_range_t;
+
+// raw samples of `bits` bits, calibration values are 8 bit
+static axis_range_t full_range(unsigned int bits) {
+    uint8_t max = (uint8_t)(((1u << bits) - 1) << (8 - bits));
+    axis_range_t r = {0, (uint8_t)((max + 1) / 2), max};
+    return r;
+}
+
+static int round_to_int(double v) {
+    return (int)(v >= 0 ? v + 0.5 : v - 0.5);
+}
+
+static void build_stick(
+        int16_t lut[256],
+        unsigned int bits,
+        axis_range_t r,
+        int invert) {
+    double dz = input_profile.deadzone / 100.0;
+    double expo = input_profile.expo / 100.0;
+    if (!(r.min < r.center && r.center < r.max)) {
+        r = full_range(bits);
+    }
+    for (unsigned int raw = 0; raw < 256; raw++) {
+        int v = (int)((raw & ((1u << bits) - 1)) << (8 - bits));
+        double t = v >= r.center
+            ? (double)(v - r.center) / (r.max - r.center)
+            : (double)(v - r.center) / (r.center - r.min);
+        double a = t < 0 ? -t : t;
+        a = a > 1 ? 1 : a;
+        a = a <= dz ? 0 : (a - dz) / (1 - dz);
+        a = (1 - expo) * a + expo * a * a * a;
+        int out = round_to_int(t < 0 ? -a * 512 : a * 511);
+        if (invert) {
+            out = out == -512 ? 511 : -out;
+        }
+        lut[raw] = (int16_t)out;
+    }
+}
+
+static void build_trigger(int16_t lut[256], unsigned int bits, uint8_t zero) {
+    int max = (int)(((1u << bits) - 1) << (8 - bits));
+    if (zero >= max) {
+        zero = 0;
+    }
+    for (unsigned int raw = 0; raw < 256; raw++) {
+        int v = (int)((raw & ((1u << bits) - 1)) << (8 - bits));
+        int out = v <= zero ? 0 : (v - zero) * 255 / (max - zero);
+        lut[raw] = (int16_t)out;
+    }
+}
+
+static axis_range_t calib_range(const uint8_t *calib, size_t at,
+        unsigned int bits) {
+    if (calib == NULL) {
+        return full_range(bits);
+    }
+    // stored as max, min, center
+    axis_range_t r = {calib[at + 1], calib[at + 2], calib[at]};
+    return r;
+}
+
+// calib is the block at 0xa40020, NULL for the nominal ranges
+void calib_build_nunchuck(axis_luts_t *luts, const uint8_t *calib) {
+    memset(luts, 0, sizeof(*luts));
+    build_stick(luts->lut[CAL_LX], 8, calib_range(calib, 8, 8), 0);
+    build_stick(luts->lut[CAL_LY], 8, calib_range(calib, 11, 8), 1);
+}
+
+void calib_build_classic(axis_luts_t *luts, const uint8_t *calib) {
+    memset(luts, 0, sizeof(*luts));
+    build_stick(luts->lut[CAL_LX], 6, calib_range(calib, 0, 6), 0);
+    build_stick(luts->lut[CAL_LY], 6, calib_range(calib, 3, 6), 1);
+    build_stick(luts->lut[CAL_RX], 5, calib_range(calib, 6, 5), 0);
+    build_stick(luts->lut[CAL_RY], 5, calib_range(calib, 9, 5), 1);
+    build_trigger(luts->lut[CAL_LT], 5, calib != NULL ? calib[12] : 0);
+    build_trigger(luts->lut[CAL_RT], 5, calib != NULL ? calib[13] : 0);
+}
+
+// point `at` of a calibration: x, y, z bits 9:2 then their low bits
+static uint16_t accel_point(const uint8_t *calib, size_t at,
+        enum accel_axis axis) {
+    unsigned int low = calib[at + 3] >> (4 - 2 * axis) & 0x3;
+    return (uint16_t)(calib[at + axis] << 2 | low);
+}
+
+/*
+ * calib starts with the zero and 1g points, as in the Wiimote EEPROM at
+ * 0x16 and the nunchuck block at 0xa40020; NULL or an implausible one
+ * gives the nominal calibration.
+ */
+void calib_build_accel(accel_calib_t *ac, const uint8_t *calib,
+        uint8_t nominal_one_g) {
+    for (int axis = ACC_X; axis < ACC_AXES; axis++) {
+        int zero = 0x200, one_g = nominal_one_g << 2;
+        if (calib != NULL) {
+            zero = accel_point(calib, 0, (enum accel_axis)axis);
+            one_g = accel_point(calib, 4, (enum accel_axis)axis);
+        }
+        if (one_g - zero < 16) {
+            zero = 0x200;
+            one_g = nominal_one_g << 2;
+        }
+        ac->zero[axis] = (int16_t)zero;
+        ac->scale[axis] = (ACCEL_ONE_G << 10) / (one_g - zero);
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef _GCALIB_H_
+#define _GCALIB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Analog axes are translated through one 256-entry table per axis, indexed
+ * by the raw sample. The extension's factory calibration, the profile's
+ * deadzone and response curve and the axis direction are all folded in
+ * when the table is built, so decoding an axis is a single load.
+ */
+enum calib_axis {
+    CAL_LX,
+    CAL_LY,
+    CAL_RX,
+    CAL_RY,
+    CAL_LT,
+    CAL_RT,
+    CAL_AXES,
+};
+
+// stick outputs span [-512;511], triggers [0;255]
+typedef struct {
+    int16_t lut[CAL_AXES][256];
+} axis_luts_t;
+
+typedef struct {
+    const char *name;
+    uint8_t deadzone; // % of stick travel reported as centered
+    uint8_t expo;     // % of cubic response mixed in, 0 = linear
+    int32_t flat;     // uinput flat and fuzz of the stick axes
+    int32_t fuzz;
+    int32_t trigger_fuzz;
+} input_profile_t;
+
+// selected once at startup, before any device is created
+extern input_profile_t input_profile;
+
+#define EXT_CALIB_SIZE 16
+
+/*
+ * Accelerometers report 10-bit samples; their calibration gives the zero
+ * and 1g readings of every axis, turned here into an offset and a Q10
+ * factor so a sample converts to ACCEL_ONE_G units per g with one multiply.
+ */
+enum accel_axis {
+    ACC_X,
+    ACC_Y,
+    ACC_Z,
+    ACC_AXES,
+};
+
+#define ACCEL_ONE_G 256
+#define ACCEL_MAX (5 * ACCEL_ONE_G)
+// 1g reading of the nominal calibration, 8 bit as stored
+#define ACCEL_NOMINAL_WIIMOTE 0x9a
+#define ACCEL_NOMINAL_NUNCHUCK 0xb3
+
+typedef struct {
+    int16_t zero[ACC_AXES];
+    int32_t scale[ACC_AXES]; // Q10
+} accel_calib_t;
+
+// Wiimote EEPROM block: zero and 1g points, volume, checksum
+#define WII_CALIB_SIZE 10
+
+int calib_select_profile(const char *name);
+int calib_valid(const uint8_t calib[EXT_CALIB_SIZE]);
+int calib_wiimote_valid(const uint8_t calib[WII_CALIB_SIZE]);
+void calib_build_nunchuck(axis_luts_t *luts, const uint8_t *calib);
+void calib_build_classic(axis_luts_t *luts, const uint8_t *calib);
+void calib_build_accel(accel_calib_t *ac, const uint8_t *calib,
+        uint8_t nominal_one_g);
+
+static inline int32_t calib_accel(const accel_calib_t *ac,
+        enum accel_axis axis, uint16_t raw) {
+    int32_t v = ((int32_t)raw - ac->zero[axis]) * ac->scale[axis] >> 10;
+    return v > ACCEL_MAX ? ACCEL_MAX : v < -ACCEL_MAX ? -ACCEL_MAX : v;
+}
+
+#endif // _GCALIB_H_
@@ -0,0 +1,238 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "device.h"
+#include "latency.h"
+#include "logger.h"
+#include "realtime.h"
+#include "spoofer.h"
+#include "wiimote.h"
+
+static FILE *capture_file = NULL;
+
+int capture_open(const char *path) {
+    capture_header_t header = {
+        .magic = CAPTURE_MAGIC,
+        .version = CAPTURE_VERSION,
+    };
+    capture_file = fopen(path, "ab");
+    if (capture_file == NULL) {
+        LOG_ERROR("Cannot open capture file %s (errno=%d)", path, errno);
+        return -1;
+    }
+    setvbuf(capture_file, NULL, _IOFBF, 1 << 16);
+    fseek(capture_file, 0, SEEK_END);
+    if (ftell(capture_file) == 0
+        && fwrite(&header, sizeof(header), 1, capture_file) != 1) {
+        LOG_ERROR("Cannot write capture header to %s", path);
+        fclose(capture_file);
+        capture_file = NULL;
+        return -1;
+    }
+    LOG_INFO("Recording hidraw traffic to %s", path);
+    return 0;
+}
+
+void capture_record(
+        uint32_t slot,
+        enum capture_direction dir,
+        uint64_t t_ns,
+        const uint8_t *buf,
+        size_t len) {
+    // header and payload go out in one fwrite so that records from
+    // different worker threads never interleave
+    uint8_t out[sizeof(capture_record_t) + UINT8_MAX];
+    capture_record_t rec = {
+        .t_ns = t_ns,
+        .slot = slot,
+        .dir = (uint8_t)dir,
+        .len = (uint8_t)(len > UINT8_MAX ? UINT8_MAX : len),
+    };
+    FILE *file = capture_file;
+    if (file == NULL) {
+        return;
+    }
+    rt_check(RT_VIOLATION_STDIO);
+    memcpy(out, &rec, sizeof(rec));
+    memcpy(out + sizeof(rec), buf, rec.len);
+    if (fwrite(out, sizeof(rec) + rec.len, 1, file) != 1) {
+        LOG_ERROR("Capture write failed, recording stopped");
+        fclose(capture_file);
+        capture_file = NULL;
+    }
+}
+
+void capture_close(void) {
+    if (capture_file != NULL) {
+        fclose(capture_file);
+        capture_file = NULL;
+    }
+}
+
+// Replay
+
+static void sleep_until(uint64_t t_ns) {
+    struct timespec ts = {
+        .tv_sec = (time_t)(t_ns / 1000000000ull),
+        .tv_nsec = (long)(t_ns % 1000000000ull),
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+            == EINTR) {
+    }
+}
+
+// walks the records, returns the highest slot number or -1 if malformed
+static int scan_capture(const uint8_t *data, size_t size, size_t *n_records) {
+    int max_slot = -1;
+    size_t off = sizeof(capture_header_t);
+    *n_records = 0;
+    while (off + sizeof(capture_record_t) <= size) {
+        const capture_record_t *rec = (const capture_record_t *)(data + off);
+        if (off + sizeof(*rec) + rec->len > size) {
+            LOG_WARN("Capture truncated at offset %zu", off);
+            break;
+        }
+        if (rec->slot >= (uint32_t)INT_MAX) {
+            LOG_WARN("Capture has a bad slot number at offset %zu", off);
+            break;
+        }
+        if ((int)rec->slot > max_slot) {
+            max_slot = (int)rec->slot;
+        }
+        off += sizeof(*rec) + rec->len;
+        (*n_records)++;
+    }
+    return max_slot;
+}
+
+int replay_capture(const char *path, int paced) {
+    int ret = 0, fd;
+    struct stat st;
+    uint8_t *data;
+    wiimote_context_t *slots = NULL;
+    size_t n_records, n_reports = 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR("Cannot open capture file %s (errno=%d)", path, errno);
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(capture_header_t)) {
+        LOG_ERROR("Capture file %s is empty or unreadable", path);
+        ret = -1;
+        goto replay_failed_fd;
+    }
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        LOG_ERROR("Cannot map capture file %s (errno=%d)", path, errno);
+        ret = -1;
+        goto replay_failed_fd;
+    }
+    const capture_header_t *header = (const capture_header_t *)data;
+    if (memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != CAPTURE_VERSION) {
+        LOG_ERROR("%s is not a version %d capture file",
+                path, CAPTURE_VERSION);
+        ret = -1;
+        goto replay_failed_map;
+    }
+
+    int max_slot = scan_capture(data, (size_t)st.st_size, &n_records);
+    LOG_INFO("Replaying %zu records for %d Wiimotes from %s%s",
+            n_records, max_slot + 1, path, paced ? " (paced)" : "");
+    if (max_slot < 0) {
+        goto replay_failed_map;
+    }
+    slots = calloc((size_t)max_slot + 1, sizeof(*slots));
+    if (slots == NULL) {
+        LOG_ERROR("Cannot allocate replay state");
+        ret = -1;
+        goto replay_failed_map;
+    }
+    for (int i = 0; i <= max_slot; i++) {
+        slots[i].uinput.fd = create_uinput_device();
+        if (slots[i].uinput.fd < 0) {
+            LOG_WARN("No uinput device for slot %d, discarding output", i);
+            slots[i].uinput.fd = open("/dev/null", O_WRONLY);
+        }
+        if (msg_queue_init(&slots[i].msg_queue, device_queue_depth) < 0) {
+            LOG_ERROR("Cannot allocate command queue");
+            destroy_uinput_device(slots[i].uinput.fd);
+            ret = -1;
+            max_slot = i - 1;
+            goto replay_done;
+        }
+        // no bdaddr: the cache is not consulted, as the recording went
+        // through the whole handshake
+        slots[i].slot = (size_t)i;
+        start_wiimote_session(&slots[i]);
+    }
+
+    uint8_t event_buffer[64];
+    uint64_t first_t = 0, start = lat_now_ns();
+    size_t off = sizeof(capture_header_t);
+    for (size_t r = 0; r < n_records; r++) {
+        const capture_record_t *rec = (const capture_record_t *)(data + off);
+        const uint8_t *payload = data + off + sizeof(*rec);
+        off += sizeof(*rec) + rec->len;
+        if (r == 0) {
+            first_t = rec->t_ns;
+        }
+        if (rec->dir != CAPTURE_IN || rec->len == 0) {
+            continue;
+        }
+        if (paced) {
+            sleep_until(start + (rec->t_ns - first_t));
+        }
+        wiimote_context_t *slot = &slots[rec->slot];
+        size_t len = rec->len < sizeof(event_buffer)
+            ? rec->len : sizeof(event_buffer);
+        memset(event_buffer, 0, sizeof(event_buffer));
+        memcpy(event_buffer, payload, len);
+
+        uint64_t t_read = lat_now_ns();
+        if (handle_wiimote_event(
+                &slot->msg_queue, &slot->state, event_buffer) < 0) {
+            continue;
+        }
+        uint64_t t_parsed = lat_now_ns();
+        wiimote_to_uinput(&slot->state, &slot->uinput);
+        lat_record(&slot->latency, event_buffer[0],
+                t_read, t_parsed, lat_now_ns());
+        // nobody listens: pretend the queued commands went out, the
+        // recorded replies then complete the tracked ones
+        while (next_msg(&slot->msg_queue) != NULL) {
+            msg_sent(&slot->msg_queue, t_read);
+        }
+        n_reports++;
+    }
+    uint64_t elapsed = lat_now_ns() - start;
+    LOG_INFO("Replayed %zu reports in %llu us (%llu ns/report)",
+            n_reports,
+            (unsigned long long)(elapsed / 1000),
+            (unsigned long long)(n_reports ? elapsed / n_reports : 0));
+
+replay_done:
+    for (int i = 0; i <= max_slot; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "slot %d", i);
+        lat_dump(&slots[i].latency, name);
+        destroy_uinput_device(slots[i].uinput.fd);
+        msg_queue_free(&slots[i].msg_queue);
+    }
+    free(slots);
+replay_failed_map:
+    munmap(data, (size_t)st.st_size);
+replay_failed_fd:
+    close(fd);
+    return ret;
+}
@@ -0,0 +1,43 @@
+#ifndef _GCAPTURE_H_
+#define _GCAPTURE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Capture file layout (host endianness):
+ *   capture_header_t
+ *   capture_record_t + len bytes of report, repeated
+ */
+#define CAPTURE_MAGIC "WMCP"
+#define CAPTURE_VERSION 2
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t reserved;
+} capture_header_t;
+
+enum capture_direction {
+    CAPTURE_IN,  // report read from hidraw
+    CAPTURE_OUT, // report written to hidraw
+};
+
+typedef struct __attribute__((packed)) {
+    uint64_t t_ns; // CLOCK_MONOTONIC
+    uint32_t slot;
+    uint8_t dir;
+    uint8_t len;
+} capture_record_t;
+
+int capture_open(const char *path);
+void capture_record(
+        uint32_t slot,
+        enum capture_direction dir,
+        uint64_t t_ns,
+        const uint8_t *buf,
+        size_t len);
+void capture_close(void);
+
+int replay_capture(const char *path, int paced);
+
+#endif // _GCAPTURE_H_
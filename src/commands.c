@@ -0,0 +1,125 @@
+#include <string.h>
+
+#include "commands.h"
+
+static const uint8_t rumble[] = {RUMBLE, 0x00};
+
+static const uint8_t leds[] = {LEDS, 0x00};
+
+static const uint8_t report_mode[] = {
+    REPORTING_MODE,
+    0x04, // continuous reporting
+    DATA_REP_COREBTNS,
+};
+
+static const uint8_t status[] = {STATUS_INFO_REQUEST, 0x00};
+
+static const uint8_t ext_decrypt_1[CMD_MAX_LEN] = {
+    WRITE_MEMREG_REQUEST, // write
+    0x04, // addr space (in this case control registers)
+    0xa4, 0x00, 0xf0, // first encryption address
+    0x01, 0x55, // size and data, zero padded to 16 data bytes
+};
+
+static const uint8_t ext_decrypt_2[CMD_MAX_LEN] = {
+    WRITE_MEMREG_REQUEST, // write
+    0x04, // addr space (in this case control registers)
+    0xa4, 0x00, 0xfb, // second encryption address
+    0x01, 0x00, // size and data, zero padded to 16 data bytes
+};
+
+/*
+ * IR camera bring-up: both enables (with the ACK bit, so they are tracked
+ * like the writes), then the camera registers at 0xb00000. The
+ * sensitivity blocks are the ones the Wii uses at its default level.
+ */
+static const uint8_t ir_enable[] = {IR_CAMERA_ENABLE, 0x06};
+
+static const uint8_t ir_enable_2[] = {IR_CAMERA_ENABLE_2, 0x06};
+
+static const uint8_t ir_start[CMD_MAX_LEN] = {
+    WRITE_MEMREG_REQUEST, 0x04, 0xb0, 0x00, 0x30, 0x01, 0x01,
+};
+
+static const uint8_t ir_sens_1[CMD_MAX_LEN] = {
+    WRITE_MEMREG_REQUEST, 0x04, 0xb0, 0x00, 0x00, 0x09,
+    0x02, 0x00, 0x00, 0x71, 0x01, 0x00, 0xaa, 0x00, 0x64,
+};
+
+static const uint8_t ir_sens_2[CMD_MAX_LEN] = {
+    WRITE_MEMREG_REQUEST, 0x04, 0xb0, 0x00, 0x1a, 0x02, 0x63, 0x03,
+};
+
+// data format, patched in by start_ir_camera()
+static const uint8_t ir_mode[CMD_MAX_LEN] = {
+    WRITE_MEMREG_REQUEST, 0x04, 0xb0, 0x00, 0x33, 0x01, 0x00,
+};
+
+static const uint8_t ir_finish[CMD_MAX_LEN] = {
+    WRITE_MEMREG_REQUEST, 0x04, 0xb0, 0x00, 0x30, 0x01, 0x08,
+};
+
+/*
+ * MotionPlus: initialized before it answers at 0xa600fa, activated by
+ * writing the mode, patched in by settle_motionplus(), to 0xa600fe.
+ */
+static const uint8_t mp_init[CMD_MAX_LEN] = {
+    WRITE_MEMREG_REQUEST, 0x04, 0xa6, 0x00, 0xf0, 0x01, 0x55,
+};
+
+static const uint8_t mp_activate[CMD_MAX_LEN] = {
+    WRITE_MEMREG_REQUEST, 0x04, 0xa6, 0x00, 0xfe, 0x01, 0x00,
+};
+
+// address space, address and size are patched in by memread_start()
+static const uint8_t read_mem[] = {
+    READ_MEMREG_REQUEST, // read
+    0x00, // addr space
+    0x00, 0x00, 0x00, // address
+    0x00, 0x00, // size
+};
+
+#define TEMPLATE(b, at, n, f) { b, sizeof(b), at, n, f }
+const cmd_template_t cmd_templates[CMD_COUNT] = {
+    [CMD_RUMBLE]        = TEMPLATE(rumble, 1, 1, CMD_COALESCE),
+    [CMD_LEDS]          = TEMPLATE(leds, 1, 1, CMD_COALESCE),
+    [CMD_REPORT_MODE]   = TEMPLATE(report_mode, 2, 1, CMD_COALESCE),
+    [CMD_STATUS]        = TEMPLATE(status, 0, 0, CMD_TRACKED),
+    [CMD_EXT_DECRYPT_1] = TEMPLATE(ext_decrypt_1, 0, 0, CMD_TRACKED),
+    [CMD_EXT_DECRYPT_2] = TEMPLATE(ext_decrypt_2, 0, 0, CMD_TRACKED),
+    [CMD_READ_MEM]      = TEMPLATE(read_mem, 1, 6, CMD_TRACKED),
+    [CMD_IR_ENABLE]     = TEMPLATE(ir_enable, 0, 0, CMD_TRACKED),
+    [CMD_IR_ENABLE_2]   = TEMPLATE(ir_enable_2, 0, 0, CMD_TRACKED),
+    [CMD_IR_START]      = TEMPLATE(ir_start, 0, 0, CMD_TRACKED),
+    [CMD_IR_SENS_1]     = TEMPLATE(ir_sens_1, 0, 0, CMD_TRACKED),
+    [CMD_IR_SENS_2]     = TEMPLATE(ir_sens_2, 0, 0, CMD_TRACKED),
+    [CMD_IR_MODE]       = TEMPLATE(ir_mode, 6, 1, CMD_TRACKED),
+    [CMD_IR_FINISH]     = TEMPLATE(ir_finish, 0, 0, CMD_TRACKED),
+    [CMD_MP_INIT]       = TEMPLATE(mp_init, 0, 0, CMD_TRACKED),
+    [CMD_MP_ACTIVATE]   = TEMPLATE(mp_activate, 6, 1, CMD_TRACKED),
+};
+
+/*
+ * Returns the bytes to write for a command. Unpatched commands point into
+ * the table; the rest are copied into scratch first. Bit 0 of byte 1 is
+ * the rumble motor in every output report, so it is kept set while rumble
+ * is on.
+ */
+const uint8_t *cmd_encode(
+        uint8_t cmd,
+        const uint8_t *patch,
+        uint8_t rumble_on,
+        uint8_t scratch[CMD_MAX_LEN],
+        size_t *len) {
+    const cmd_template_t *t = &cmd_templates[cmd];
+    *len = t->len;
+    if (t->patch_len == 0 && !rumble_on) {
+        return t->bytes;
+    }
+    memcpy(scratch, t->bytes, t->len);
+    memcpy(scratch + t->patch_at, patch, t->patch_len);
+    if (rumble_on) {
+        scratch[1] |= 0x01;
+    }
+    return scratch;
+}
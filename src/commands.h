@@ -0,0 +1,94 @@
+#ifndef _GCOMMANDS_H_
+#define _GCOMMANDS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    RUMBLE = 0x10,
+    LEDS,
+    REPORTING_MODE,
+    IR_CAMERA_ENABLE,
+    SPEAKER_ENABLE,
+    STATUS_INFO_REQUEST,
+    WRITE_MEMREG_REQUEST,
+    READ_MEMREG_REQUEST,
+    SPEAKER_DATA,
+    SPEAKER_MUTE,
+    IR_CAMERA_ENABLE_2,
+
+    STATUS_INFO_REPLY = 0x20,
+    READ_MEMREG_REPLY,
+    ACK_OUT_RETURN,
+
+    DATA_REP_COREBTNS = 0x30,
+    DATA_REP_COREACC,
+    DATA_REP_COREEXT8,
+    DATA_REP_COREACCIR12,
+    DATA_REP_COREEXT19,
+    DATA_REP_COREACC16,
+    DATA_REP_COREIR10EXT9,
+    DATA_REP_COREACCIR10EXT6,
+
+    DATA_REP_EXT21 = 0x3D,
+    DATA_REP_INTERLEAVED1,
+    DATA_REP_INTERLEAVED2,
+} wiimote_report_type_t;
+
+/*
+ * Every output report the daemon sends, pre-encoded at compile time. A
+ * queued command names its template and carries the few bytes that vary
+ * (LED bits, reporting mode, read address); those are patched in at
+ * patch_at when the command is written, everything else goes out straight
+ * from the table.
+ */
+typedef enum {
+    CMD_RUMBLE,
+    CMD_LEDS,
+    CMD_REPORT_MODE,
+    CMD_STATUS,
+    CMD_EXT_DECRYPT_1,
+    CMD_EXT_DECRYPT_2,
+    CMD_READ_MEM,
+    CMD_IR_ENABLE,
+    CMD_IR_ENABLE_2,
+    CMD_IR_START,
+    CMD_IR_SENS_1,
+    CMD_IR_SENS_2,
+    CMD_IR_MODE,
+    CMD_IR_FINISH,
+    CMD_MP_INIT,
+    CMD_MP_ACTIVATE,
+    CMD_COUNT,
+} wiimote_cmd_t;
+
+// the Wiimote answers it: status, memory write and read, ACK requested
+#define CMD_TRACKED  0x01
+// only the latest queued one matters
+#define CMD_COALESCE 0x02
+
+#define CMD_MAX_LEN 22
+#define CMD_PATCH_MAX 6
+typedef struct {
+    const uint8_t *bytes;
+    uint8_t len;
+    uint8_t patch_at;
+    uint8_t patch_len;
+    uint8_t flags;
+} cmd_template_t;
+
+extern const cmd_template_t cmd_templates[CMD_COUNT];
+
+// output report id of a command
+static inline uint8_t cmd_report(uint8_t cmd) {
+    return cmd_templates[cmd].bytes[0];
+}
+
+const uint8_t *cmd_encode(
+        uint8_t cmd,
+        const uint8_t *patch,
+        uint8_t rumble_on,
+        uint8_t scratch[CMD_MAX_LEN],
+        size_t *len);
+
+#endif // _GCOMMANDS_H_
@@ -0,0 +1,612 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/uinput.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "batch.h"
+#include "capture.h"
+#include "device.h"
+#include "logger.h"
+#include "realtime.h"
+
+const io_backend_t *device_backend = &hidraw_backend;
+size_t device_queue_depth = MSGQ_DEFAULT_DEPTH;
+uint8_t device_features = 0;
+
+// contexts are created by the control thread but released by whichever
+// thread serves the device
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * A Wiimote seen before with an extension is translated with it from the
+ * first report; the status reply then starts the handshake to verify it.
+ */
+static void restore_cached_extension(wiimote_context_t *wm) {
+    ext_cache_entry_t entry;
+    if (!ext_cache_lookup(wm->bdaddr, &entry)) {
+        return;
+    }
+    wm->cached_ext = entry.ext_status;
+    wm->cached_format = entry.data_format;
+    if (entry.ext_status == EXT_NONE) {
+        return;
+    }
+    LOG_INFO("  Assuming the extension last seen on %s", wm->bdaddr);
+    wm->state.ext_status = entry.ext_status;
+    wm->state.classic_controller.data_format = entry.data_format;
+    wm->state.ext_calib_valid = entry.calib_valid;
+    memcpy(wm->state.ext_calib, entry.calib, sizeof(entry.calib));
+    build_axis_luts(&wm->state);
+    wm->cached_calib_gen = wm->state.calib_gen;
+    wm->state.ext_verify = EXT_VERIFY_CACHED;
+    // the status reply would not add anything we need to translate
+    wm->state.initialized = 1;
+    enqueue_report_mode(&wm->msg_queue, &wm->state);
+}
+
+/*
+ * Sets up the state of a new Wiimote and queues its handshake. Shared by
+ * connected and replayed Wiimotes, so a replay walks the same handshake
+ * the recorded replies answer.
+ */
+void start_wiimote_session(wiimote_context_t *wm) {
+    wm->state.features = device_features;
+    // player LEDs only go up to 4, wrap around after that
+    uint8_t leds = (uint8_t)(0x10 << (wm->slot % 4));
+    enqueue_msg(&wm->msg_queue, CMD_LEDS, &leds);
+    if (wm->bdaddr[0] != '\0') {
+        restore_cached_extension(wm);
+    }
+    enqueue_msg(&wm->msg_queue, CMD_STATUS, NULL);
+    // answered after the status reply, which initializes the state
+    if (device_features & WII_FEAT_ACCEL) {
+        request_wiimote_calibration(&wm->msg_queue, &wm->state);
+    }
+    if (device_features & WII_FEAT_MOTIONPLUS) {
+        request_motionplus(&wm->msg_queue, &wm->state);
+    }
+}
+
+// remembers the extension once the handshake settled on one
+static void update_ext_cache(wiimote_context_t *wm) {
+    const wiimote_state_t *state = &wm->state;
+    if (wm->bdaddr[0] == '\0' || state->ext_verify != EXT_VERIFY_NONE) {
+        return;
+    }
+    if (state->ext_status != EXT_NONE
+        && state->ext_status != EXT_NUNCHUCK
+        && state->ext_status != EXT_CLASSIC_CONTROLLER) {
+        return;
+    }
+    if (state->ext_status == wm->cached_ext
+        && state->classic_controller.data_format == wm->cached_format
+        && state->calib_gen == wm->cached_calib_gen) {
+        return;
+    }
+    wm->cached_ext = state->ext_status;
+    wm->cached_format = state->classic_controller.data_format;
+    wm->cached_calib_gen = state->calib_gen;
+    ext_cache_store(wm->bdaddr, state);
+}
+
+/*
+ * Force feedback requests are read from the uinput fd when it becomes
+ * readable. Outputs without a poll method, /dev/null or a regular file,
+ * are refused by epoll with EPERM and take no force feedback.
+ */
+static uint8_t output_pollable(int fd) {
+    struct epoll_event ev = {.events = EPOLLIN};
+    int probe = epoll_create1(EPOLL_CLOEXEC);
+    if (probe < 0) {
+        return 0;
+    }
+    int ok = epoll_ctl(probe, EPOLL_CTL_ADD, fd, &ev) == 0;
+    if (!ok && errno != EPERM) {
+        LOG_WARN("Cannot poll output fd %d (errno=%d), no force feedback",
+                fd, errno);
+    }
+    close(probe);
+    return (uint8_t)ok;
+}
+
+wiimote_context_t *create_wiimote_context(
+        pool_t *wiimotes,
+        int fd,
+        const char *name,
+        const char *bdaddr) {
+    size_t slot;
+    pthread_mutex_lock(&pool_lock);
+    wiimote_context_t *wm = pool_alloc(wiimotes, &slot);
+    pthread_mutex_unlock(&pool_lock);
+    if (wm == NULL) {
+        return NULL;
+    }
+    wm->cmd_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+            TFD_NONBLOCK | TFD_CLOEXEC);
+    if (wm->cmd_timer_fd < 0) {
+        LOG_ERROR("Cannot create command timer (errno=%d)", errno);
+        goto failed_timer;
+    }
+    wm->rumble_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+            TFD_NONBLOCK | TFD_CLOEXEC);
+    if (wm->rumble_timer_fd < 0) {
+        LOG_ERROR("Cannot create rumble timer (errno=%d)", errno);
+        goto failed_rumble_timer;
+    }
+    rumble_init(&wm->rumble);
+    wm->uinput.fd = device_backend->open_output(fd);
+    if (wm->uinput.fd < 0) {
+        LOG_ERROR("Cannot open %s output device", device_backend->name);
+        goto failed_output;
+    }
+    wm->ff_polled = output_pollable(wm->uinput.fd);
+    wm->motion.fd = -1;
+    if (device_features & WII_FEAT_ACCEL) {
+        wm->motion.fd = device_backend->open_motion(fd);
+        if (wm->motion.fd < 0) {
+            LOG_ERROR("Cannot open %s motion device", device_backend->name);
+            goto failed_motion;
+        }
+    }
+    wm->pointer.fd = -1;
+    if (device_features & WII_FEAT_IR) {
+        wm->pointer.fd = device_backend->open_pointer(fd);
+        if (wm->pointer.fd < 0) {
+            LOG_ERROR("Cannot open %s pointer device", device_backend->name);
+            goto failed_pointer;
+        }
+    }
+    if (msg_queue_init(&wm->msg_queue, device_queue_depth) < 0) {
+        LOG_ERROR("Cannot allocate command queue");
+        goto failed_queue;
+    }
+    strncpy(wm->dev_path, name, sizeof(wm->dev_path) - 1);
+    wm->slot = slot;
+    wm->hidraw_fd = fd;
+    wm->active = 1;
+    LOG_INFO("  Wiimote connected (fd %d)! Total connected: %zu",
+            fd, wiimotes->in_use);
+    if (bdaddr != NULL) {
+        strncpy(wm->bdaddr, bdaddr, sizeof(wm->bdaddr) - 1);
+    }
+    start_wiimote_session(wm);
+    return wm;
+
+failed_queue:
+    if (wm->pointer.fd >= 0) {
+        device_backend->close_output(wm->pointer.fd);
+    }
+failed_pointer:
+    if (wm->motion.fd >= 0) {
+        device_backend->close_output(wm->motion.fd);
+    }
+failed_motion:
+    device_backend->close_output(wm->uinput.fd);
+failed_output:
+    close(wm->rumble_timer_fd);
+failed_rumble_timer:
+    close(wm->cmd_timer_fd);
+failed_timer:
+    pthread_mutex_lock(&pool_lock);
+    pool_free(wiimotes, slot);
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+int watch_wiimote(wiimote_context_t *wm, int epoll_fd) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = wm;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wm->hidraw_fd, &ev) < 0) {
+        perror("epoll_ctl: wiimote device");
+        return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = (void *)((uintptr_t)wm | WIIMOTE_TIMER_TAG);
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wm->cmd_timer_fd, &ev) < 0) {
+        perror("epoll_ctl: wiimote command timer");
+        goto failed_cmd_timer;
+    }
+    ev.data.ptr = (void *)((uintptr_t)wm | WIIMOTE_FF_TAG);
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wm->rumble_timer_fd, &ev) < 0) {
+        perror("epoll_ctl: wiimote rumble timer");
+        goto failed_rumble_timer;
+    }
+    if (wm->ff_polled
+        && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wm->uinput.fd, &ev) < 0) {
+        perror("epoll_ctl: wiimote uinput device");
+        goto failed_uinput;
+    }
+    LOG_INFO("  Wiimote device added to epoll.");
+    return 0;
+
+failed_uinput:
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, wm->rumble_timer_fd, NULL);
+failed_rumble_timer:
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, wm->cmd_timer_fd, NULL);
+failed_cmd_timer:
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, wm->hidraw_fd, NULL);
+    return -1;
+}
+
+static void cleanup_wiimote_context(wiimote_context_t *ctx) {
+    if (ctx->hidraw_fd >= 0) {
+        device_backend->close(ctx->hidraw_fd);
+        ctx->hidraw_fd = -1;
+    }
+    if (ctx->uinput.fd >= 0) {
+        device_backend->close_output(ctx->uinput.fd);
+        ctx->uinput.fd = -1;
+    }
+    if (ctx->motion.fd >= 0) {
+        device_backend->close_output(ctx->motion.fd);
+        ctx->motion.fd = -1;
+    }
+    if (ctx->pointer.fd >= 0) {
+        device_backend->close_output(ctx->pointer.fd);
+        ctx->pointer.fd = -1;
+    }
+    if (ctx->cmd_timer_fd >= 0) {
+        close(ctx->cmd_timer_fd);
+        ctx->cmd_timer_fd = -1;
+    }
+    if (ctx->rumble_timer_fd >= 0) {
+        close(ctx->rumble_timer_fd);
+        ctx->rumble_timer_fd = -1;
+    }
+    msg_queue_free(&ctx->msg_queue);
+    ctx->active = 0;
+    ctx->hid_writable = 0;
+    memset(&ctx->state, 0, sizeof(wiimote_state_t));
+    memset(ctx->motion.last, 0, sizeof(ctx->motion.last));
+    memset(&ctx->pointer.track, 0, sizeof(ctx->pointer.track));
+    memset(&ctx->pointer.fx, 0, sizeof(ctx->pointer.fx));
+    memset(&ctx->pointer.fy, 0, sizeof(ctx->pointer.fy));
+    ctx->pointer.x = 0;
+    ctx->pointer.y = 0;
+    ctx->pointer.keys = 0;
+    ctx->pointer.seq = 0;
+    memset(ctx->dev_path, 0, sizeof(ctx->dev_path));
+    memset(ctx->bdaddr, 0, sizeof(ctx->bdaddr));
+    ctx->cached_ext = EXT_NONE;
+    ctx->cached_format = 0;
+    ctx->cached_calib_gen = 0;
+    ctx->rumble_sent_ns = 0;
+}
+
+void release_wiimote_context(pool_t *wiimotes, wiimote_context_t *wm) {
+    cleanup_wiimote_context(wm);
+    pthread_mutex_lock(&pool_lock);
+    pool_free(wiimotes, wm->slot);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// one shot in timeout_ns, 0 disarms
+static void arm_timer(int timer_fd, uint64_t timeout_ns) {
+    struct itimerspec its = {
+        .it_value = {
+            .tv_sec = (time_t)(timeout_ns / 1000000000ULL),
+            .tv_nsec = (long)(timeout_ns % 1000000000ULL),
+        },
+    };
+    if (timerfd_settime(timer_fd, 0, &its, NULL) < 0) {
+        LOG_ERROR("Cannot arm timer fd %d (errno=%d)", timer_fd, errno);
+    }
+}
+
+void flush_msg_queue(wiimote_context_t *wm) {
+    const msg_t *msg;
+    uint8_t scratch[CMD_MAX_LEN];
+    while (wm->hid_writable
+           && (msg = next_msg(&wm->msg_queue)) != NULL) {
+        size_t len;
+        const uint8_t *buf = encode_msg(&wm->msg_queue, msg, scratch, &len);
+        ssize_t w_bytes = device_backend->write(wm->hidraw_fd, buf, len);
+        if (w_bytes < 0) {
+            if (errno != EAGAIN) {
+                LOG_ERROR("Failed to write wiimote event %d", errno);
+                break;
+            } else if (errno == EAGAIN) {
+                LOG_DEBUG_ASYNC(
+                        "Wiimote fd %lld not ready for writing.",
+                        (long long)wm->hidraw_fd);
+                wm->hid_writable = 0;
+            }
+        } else {
+            LOG_DEBUG_HEX(buf, (size_t)w_bytes,
+                    "Wrote %lld bytes to wiimote fd %lld:",
+                    (long long)w_bytes, (long long)wm->hidraw_fd);
+            uint64_t now = lat_now_ns();
+            capture_record((uint32_t)wm->slot,
+                    CAPTURE_OUT, now,
+                    buf, (size_t)w_bytes);
+            uint64_t timeout = msg_sent(&wm->msg_queue, now);
+            if (timeout > 0) {
+                arm_timer(wm->cmd_timer_fd, timeout);
+            }
+        }
+    }
+}
+
+// longer gaps mean the Wiimote only reports on change: no cadence
+#define CADENCE_MAX_INTERVAL_NS 100000000ULL
+
+static void track_cadence(wiimote_context_t *wm, uint64_t t_read) {
+    uint64_t interval = t_read - wm->last_report_ns;
+    if (wm->last_report_ns == 0 || interval > CADENCE_MAX_INTERVAL_NS) {
+        wm->report_interval_ns = 0;
+    } else if (wm->report_interval_ns == 0) {
+        wm->report_interval_ns = interval;
+    } else {
+        // EWMA with 1/8 gain, same as RFC 3550 jitter
+        int64_t delta = (int64_t)interval - (int64_t)wm->report_interval_ns;
+        wm->report_interval_ns = (uint64_t)(
+                (int64_t)wm->report_interval_ns + delta / 8);
+    }
+    wm->last_report_ns = t_read;
+    wm->busy_missed = 0;
+}
+
+static void note_report(wiimote_context_t *wm,
+        uint8_t *buf,
+        size_t len,
+        uint64_t t_read) {
+    capture_record((uint32_t)wm->slot,
+            CAPTURE_IN, t_read,
+            buf, len);
+    track_cadence(wm, t_read);
+    LOG_DEBUG_HEX(buf, len,
+            "Read %lld bytes from wiimote fd %lld:",
+            (long long)len, (long long)wm->hidraw_fd);
+}
+
+int decode_wiimote_report(wiimote_context_t *wm,
+        uint8_t *buf,
+        size_t len,
+        uint64_t t_read) {
+    note_report(wm, buf, len, t_read);
+    if (handle_wiimote_event(
+            &wm->msg_queue,
+            &wm->state,
+            buf) < 0) {
+        LOG_ERROR("Failed to handle wiimote event.");
+        return -1;
+    }
+    update_ext_cache(wm);
+    return 0;
+}
+
+// queues the frames of the current state, writing earlier ones if full
+static void queue_frame(wiimote_context_t *wm) {
+    if (wm->uinput.batch.count + UINPUT_FRAME_MAX > UINPUT_BATCH_MAX) {
+        flush_uinput_batch(&wm->uinput.batch, wm->uinput.fd);
+    }
+    build_uinput_batch(&wm->state, &wm->uinput);
+    if (wm->motion.batch.count + UMOT_COUNT + 1 > UINPUT_BATCH_MAX) {
+        flush_uinput_batch(&wm->motion.batch, wm->motion.fd);
+    }
+    build_motion_batch(&wm->state, &wm->motion);
+    // two axes, twice after a failed write, two buttons and SYN
+    if (wm->pointer.batch.count + 7 > UINPUT_BATCH_MAX) {
+        flush_uinput_batch(&wm->pointer.batch, wm->pointer.fd);
+    }
+    build_pointer_batch(&wm->state, &wm->pointer);
+}
+
+/*
+ * Translates the reports read in one go. Runs of same type data reports
+ * are decoded together, the rest one by one; every report still produces
+ * its own frame, but all of them are written to uinput at once.
+ */
+static void translate_reports(wiimote_context_t *wm, report_batch_t *rx) {
+    batch_samples_t samples;
+    uint64_t t_parsed[REPORT_BATCH_MAX];
+    size_t i = 0;
+    while (i < rx->count) {
+        size_t run = batch_run_length(rx, i, &wm->state);
+        if (run == 0) {
+            // status, acks and memory reads change more than inputs
+            t_parsed[i] = 0;
+            if (decode_wiimote_report(wm,
+                    rx->reports[i], rx->len[i], rx->t_read[i]) == 0) {
+                t_parsed[i] = lat_now_ns();
+                queue_frame(wm);
+            }
+            i++;
+            continue;
+        }
+        batch_decode(rx, i, run, &wm->state, &samples);
+        for (size_t k = 0; k < run; k++, i++) {
+            note_report(wm, rx->reports[i], rx->len[i], rx->t_read[i]);
+            batch_apply(&samples, k, rx->reports[i][0], &wm->state);
+            t_parsed[i] = lat_now_ns();
+            queue_frame(wm);
+        }
+    }
+    flush_uinput_batch(&wm->uinput.batch, wm->uinput.fd);
+    flush_uinput_batch(&wm->motion.batch, wm->motion.fd);
+    flush_uinput_batch(&wm->pointer.batch, wm->pointer.fd);
+    uint64_t t_written = lat_now_ns();
+    for (i = 0; i < rx->count; i++) {
+        if (t_parsed[i] != 0) {
+            lat_record(&wm->latency, rx->reports[i][0],
+                    rx->t_read[i], t_parsed[i], t_written);
+        }
+    }
+}
+
+/*
+ * Serves one epoll wakeup for a Wiimote: flushes pending output, drains
+ * and translates every pending report. Returns 1 if the device went away;
+ * the caller then releases the context.
+ */
+int handle_wiimote_fd(wiimote_context_t *wm, uint32_t events, int epoll_fd) {
+    report_batch_t rx;
+
+    if (events & EPOLLOUT) {
+        LOG_DEBUG_ASYNC("Wiimote fd %lld ready for writing.",
+                (long long)wm->hidraw_fd);
+        wm->hid_writable = 1;
+    }
+    flush_msg_queue(wm);
+
+    ssize_t r_bytes = 1;
+    rt_hot_begin();
+    if (events & EPOLLIN)
+        LOG_DEBUG_ASYNC("Wiimote fd %lld ready for reading.",
+                (long long)wm->hidraw_fd);
+    while (r_bytes > 0 && (events & EPOLLIN)) {
+        // read the whole backlog first, up to a batch
+        rx.count = 0;
+        while (rx.count < REPORT_BATCH_MAX) {
+            r_bytes = device_backend->read(
+                    wm->hidraw_fd,
+                    rx.reports[rx.count], REPORT_BATCH_STRIDE);
+            if (r_bytes <= 0) {
+                // drained (or failed)
+                break;
+            }
+            rx.len[rx.count] = (size_t)r_bytes;
+            rx.t_read[rx.count++] = lat_now_ns();
+        }
+        translate_reports(wm, &rx);
+    }
+    rt_hot_end();
+    if (r_bytes < 0) {
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            LOG_ERROR(
+                    "epoll wiimote error detected, disconnecting.");
+            LOG_INFO(
+                    "Wiimote disconnected (read %zd bytes).",
+                    r_bytes);
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, wm->hidraw_fd, NULL);
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, wm->cmd_timer_fd, NULL);
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, wm->rumble_timer_fd, NULL);
+            if (wm->ff_polled) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, wm->uinput.fd, NULL);
+            }
+            lat_dump(&wm->latency, wm->dev_path);
+            return 1;
+        } else if (errno == ENODEV || errno == EIO) {
+            // epoll reports the hangup next, busy polling stops reading
+            wm->read_failed = 1;
+            LOG_ERROR("Failed to read wiimote event %d", errno);
+        } else if (errno != EAGAIN) {
+            LOG_ERROR("Failed to read wiimote event %d", errno);
+        } else if (errno == EAGAIN) {
+            // LOG_DEBUG(
+            //         "No more data to read from wiimote fd %d",
+            //         wm->hidraw_fd);
+        }
+    } else if (r_bytes == 0) {
+        LOG_ERROR("unhandled: read 0 bytes from wiimote fd %d",
+                wm->hidraw_fd);
+    }
+
+    // replies to what we just read (handshake steps) go out
+    // now instead of waiting for the next report
+    flush_msg_queue(wm);
+    return 0;
+}
+
+// the reply to a tracked command is overdue: retry it or give up
+void handle_wiimote_timer(wiimote_context_t *wm) {
+    uint64_t expirations;
+    uint8_t given_up[MSG_PIPELINE];
+    if (!wm->active) {
+        // released earlier in the same batch of events
+        return;
+    }
+    if (read(wm->cmd_timer_fd, &expirations, sizeof(expirations)) < 0
+        && errno != EAGAIN) {
+        LOG_ERROR("Cannot read command timer (errno=%d)", errno);
+    }
+    uint64_t now = lat_now_ns();
+    size_t n = msg_timeout(&wm->msg_queue, now, given_up);
+    for (size_t i = 0; i < n; i++) {
+        handle_command_failure(&wm->msg_queue, &wm->state, given_up[i]);
+    }
+    flush_msg_queue(wm);
+    // commands still in flight that were not due yet
+    uint64_t deadline = msg_deadline(&wm->msg_queue);
+    if (deadline > 0) {
+        arm_timer(wm->cmd_timer_fd, deadline > now ? deadline - now : 1);
+    }
+}
+
+/*
+ * Brings the motor in line with the playing effects. The rumble bit rides
+ * along every output report, so only a change needs a report of its own;
+ * changes closer together than RUMBLE_MIN_INTERVAL_MS are merged, or a
+ * game restarting its effects every frame would flood the link and hold
+ * up everything else queued for the Wiimote.
+ */
+static void update_rumble(wiimote_context_t *wm) {
+    uint64_t now = lat_now_ns(), next;
+    uint8_t on = rumble_motor(&wm->rumble, now, &next);
+    if (on != wm->msg_queue.rumble) {
+        uint64_t allowed = wm->rumble_sent_ns
+            + RUMBLE_MIN_INTERVAL_MS * 1000000ULL;
+        if (wm->rumble_sent_ns != 0 && now < allowed) {
+            if (next == 0 || allowed < next) {
+                next = allowed;
+            }
+        } else {
+            wm->msg_queue.rumble = on;
+            wm->rumble_sent_ns = now;
+            enqueue_msg(&wm->msg_queue, CMD_RUMBLE, &on);
+            flush_msg_queue(wm);
+        }
+    }
+    arm_timer(wm->rumble_timer_fd, next == 0 ? 0 : next > now ? next - now : 1);
+}
+
+// force feedback requests arrived or the rumble timer fired
+void handle_wiimote_ff(wiimote_context_t *wm) {
+    uint64_t expirations;
+    if (!wm->active) {
+        return;
+    }
+    if (read(wm->rumble_timer_fd, &expirations, sizeof(expirations)) < 0
+        && errno != EAGAIN) {
+        LOG_ERROR("Cannot read rumble timer (errno=%d)", errno);
+    }
+    rumble_read(&wm->rumble, wm->uinput.fd, lat_now_ns());
+    update_rumble(wm);
+}
+
+/*
+ * Serves an event registered by watch_wiimote. Returns the context if its
+ * device went away; the caller then releases it.
+ */
+wiimote_context_t *serve_wiimote_event(
+        void *data,
+        uint32_t events,
+        int epoll_fd) {
+    wiimote_context_t *wm =
+        (wiimote_context_t *)((uintptr_t)data & ~WIIMOTE_TAG_MASK);
+    switch ((uintptr_t)data & WIIMOTE_TAG_MASK) {
+        case WIIMOTE_TIMER_TAG:
+            handle_wiimote_timer(wm);
+            return NULL;
+        case WIIMOTE_FF_TAG:
+            handle_wiimote_ff(wm);
+            return NULL;
+        default:
+            return handle_wiimote_fd(wm, events, epoll_fd) ? wm : NULL;
+    }
+}
+
+void dump_wiimote_latencies(const pool_t *wiimotes) {
+    for (size_t i = 0; i < pool_capacity(wiimotes); i++) {
+        const wiimote_context_t *wm = pool_at(wiimotes, i);
+        if (wm->active) {
+            lat_dump(&wm->latency, wm->dev_path);
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef _GDEVICE_H_
+#define _GDEVICE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "backend.h"
+#include "extcache.h"
+#include "latency.h"
+#include "pool.h"
+#include "queue.h"
+#include "rumble.h"
+#include "spoofer.h"
+#include "wiimote.h"
+
+typedef struct {
+    size_t slot;
+    int hidraw_fd;
+    int cmd_timer_fd; // fires when a tracked command got no reply
+    int rumble_timer_fd; // fires when the motor may have to change
+    uinput_device_t uinput;
+    motion_device_t motion;
+    pointer_device_t pointer;
+    uint8_t hid_writable;
+    char dev_path[256];
+    char bdaddr[EXT_CACHE_KEY_SIZE]; // extension cache key, may be empty
+    int8_t active;
+    wiimote_state_t state;
+    msg_queue_t msg_queue;
+    lat_stats_t latency;
+    // report cadence, used to predict the next arrival when busy polling
+    uint64_t last_report_ns;
+    uint64_t report_interval_ns;
+    uint8_t busy_missed;
+    uint8_t read_failed; // gone without a hangup yet, left to epoll
+    // extension last written to the cache
+    enum extension_status cached_ext;
+    uint8_t cached_format;
+    uint8_t cached_calib_gen;
+    rumble_t rumble;
+    uint8_t ff_polled;       // the uinput fd is polled for force feedback
+    uint8_t uring_polls;     // io_uring polls posted and not completed
+    uint64_t rumble_sent_ns; // last motor change sent
+    // the io_uring engine tags completions with the low four bits
+} __attribute__((aligned(16))) wiimote_context_t;
+
+// epoll data of a command timer: its context pointer with this bit set
+#define WIIMOTE_TIMER_TAG ((uintptr_t)1)
+// same for the force feedback side, the uinput fd and the rumble timer
+#define WIIMOTE_FF_TAG ((uintptr_t)2)
+#define WIIMOTE_TAG_MASK ((uintptr_t)3)
+
+// I/O used for every device, set once before the first one is created
+extern const io_backend_t *device_backend;
+// initial command queue depth of every device
+extern size_t device_queue_depth;
+// WII_FEAT_* enabled on every device
+extern uint8_t device_features;
+
+wiimote_context_t *create_wiimote_context(
+        pool_t *wiimotes,
+        int fd,
+        const char *name,
+        const char *bdaddr);
+void start_wiimote_session(wiimote_context_t *wm);
+int watch_wiimote(wiimote_context_t *wm, int epoll_fd);
+void release_wiimote_context(pool_t *wiimotes, wiimote_context_t *wm);
+int decode_wiimote_report(wiimote_context_t *wm,
+        uint8_t *buf,
+        size_t len,
+        uint64_t t_read);
+int handle_wiimote_fd(wiimote_context_t *wm, uint32_t events, int epoll_fd);
+void handle_wiimote_timer(wiimote_context_t *wm);
+void handle_wiimote_ff(wiimote_context_t *wm);
+wiimote_context_t *serve_wiimote_event(
+        void *data,
+        uint32_t events,
+        int epoll_fd);
+void flush_msg_queue(wiimote_context_t *wm);
+void dump_wiimote_latencies(const pool_t *wiimotes);
+
+#endif // _GDEVICE_H_
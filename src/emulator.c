@@ -0,0 +1,402 @@
+#include <string.h>
+
+#include "emulator.h"
+#include "ir.h"
+
+#define EXT_ID_OFFSET 0xfa
+#define EXT_CALIB_OFFSET 0x20
+
+static const uint8_t nunchuck_id[6] = {0x00, 0x00, 0xa4, 0x20, 0x00, 0x00};
+static const uint8_t classic_id[6] = {0x00, 0x00, 0xa4, 0x20, 0x01, 0x01};
+// inactive; active it reads a4 20 with its mode in place of 00
+static const uint8_t motionplus_id[6] = {0x00, 0x00, 0xa6, 0x20, 0x00, 0x05};
+
+// gyro reading at rest, a little off the nominal 0x2000 as on real units
+#define MP_REST 0x1f7f
+
+// a sensor bar straight ahead, 200 pixels wide
+static const ir_point_t bar[2] = {{412, 384, 2}, {612, 384, 2}};
+
+// sticks pushed fully right so the first decoded sample is recognisable
+static const uint8_t nunchuck_data[6] = {0xff, 0x80, 0x80, 0x80, 0x80, 0x03};
+static const uint8_t classic_data[6] = {0xbf, 0x20, 0x10, 0x00, 0xff, 0xff};
+
+// the last two bytes are checksums, filled in by set_calibration()
+static const uint8_t nunchuck_calib[16] = {
+    0x80, 0x80, 0x80, 0x00, 0xb3, 0xb3, 0xb3, 0x00,
+    0xe0, 0x20, 0x80, 0xe0, 0x20, 0x80, 0x00, 0x00,
+};
+static const uint8_t classic_calib[16] = {
+    0xfc, 0x04, 0x7e, 0xfc, 0x04, 0x7e, 0xf8, 0x08,
+    0x80, 0xf8, 0x08, 0x80, 0x10, 0x10, 0x00, 0x00,
+};
+
+void emu_init(wiimote_emu_t *emu) {
+    memset(emu, 0, sizeof(*emu));
+    emu->report_mode = 0x30;
+    memset(emu->ext_regs, 0xff, sizeof(emu->ext_regs));
+    emu->motionplus = 1;
+    memset(emu->mp_regs, 0xff, sizeof(emu->mp_regs));
+    memcpy(emu->mp_regs + EXT_ID_OFFSET, motionplus_id, 6);
+    // accelerometer zero and 1g points at 0x0016, checksummed
+    uint8_t acc_calib[] = {0x80, 0x80, 0x80, 0x00,
+                           0x9a, 0x9a, 0x9a, 0x00, 0x40, 0x55};
+    for (size_t i = 0; i < sizeof(acc_calib) - 1; i++) {
+        acc_calib[sizeof(acc_calib) - 1] =
+            (uint8_t)(acc_calib[sizeof(acc_calib) - 1] + acc_calib[i]);
+    }
+    memcpy(emu->eeprom + 0x16, acc_calib, sizeof(acc_calib));
+    memcpy(emu->eeprom + 0x20, acc_calib, sizeof(acc_calib));
+}
+
+static void put_buttons(const wiimote_emu_t *emu, uint8_t *out) {
+    out[0] = (uint8_t)(emu->buttons >> 8);
+    out[1] = (uint8_t)emu->buttons;
+}
+
+static void send_status(wiimote_emu_t *emu, emu_reply_fn reply, void *ctx) {
+    uint8_t buf[7] = {0x20};
+    put_buttons(emu, buf + 1);
+    buf[3] = (uint8_t)(emu->leds << 4
+            | (emu->ir_enabled ? 0x08 : 0)
+            | (emu->mp_mode || emu->extension != EMU_EXT_NONE ? 0x02 : 0));
+    buf[6] = 0xc8; // battery
+    reply(ctx, buf, sizeof(buf));
+}
+
+static void send_ack(wiimote_emu_t *emu, uint8_t report, uint8_t err,
+        emu_reply_fn reply, void *ctx) {
+    uint8_t buf[5] = {0x22};
+    put_buttons(emu, buf + 1);
+    buf[3] = report;
+    buf[4] = err;
+    reply(ctx, buf, sizeof(buf));
+}
+
+// the real remote encrypts extension data until 0x55/0x00 are written
+static inline int ext_encrypted(const wiimote_emu_t *emu) {
+    return emu->ext_regs[0xf0] != 0x55 || emu->ext_regs[0xfb] != 0x00;
+}
+
+// the MotionPlus answers at 0xa60000, or in place of the extension
+static inline int mp_addr(const wiimote_emu_t *emu, uint32_t addr) {
+    return emu->motionplus
+        && (addr & 0xffff00) == (emu->mp_mode ? 0xa40000u : 0xa60000u);
+}
+
+/*
+ * A mode written to 0xa600fe activates the MotionPlus, 0x55 to 0xa400f0
+ * sends it back; the remote reports either as an extension change.
+ */
+static int switch_motionplus(wiimote_emu_t *emu, uint32_t addr,
+        uint8_t value) {
+    if (emu->mp_mode == 0 && addr == 0xa600fe) {
+        emu->mp_mode = value;
+        emu->mp_regs[0xfc] = 0xa4;
+        emu->mp_regs[0xfe] = value;
+    } else if (emu->mp_mode != 0 && addr == 0xa400f0 && value == 0x55) {
+        emu->mp_mode = 0;
+        emu->mp_regs[0xfc] = 0xa6;
+        emu->mp_regs[0xfe] = 0x00;
+    } else {
+        return 0;
+    }
+    emu->mp_turn = 0;
+    emu->reporting_suspended = 1;
+    return 1;
+}
+
+static void handle_write(wiimote_emu_t *emu, const uint8_t *buf,
+        emu_reply_fn reply, void *ctx) {
+    uint8_t space = buf[1] & 0x04;
+    uint32_t addr = (uint32_t)buf[2] << 16 | (uint32_t)buf[3] << 8 | buf[4];
+    uint8_t size = buf[5] > 16 ? 16 : buf[5];
+    uint8_t err = 0;
+    if (space && mp_addr(emu, addr) && switch_motionplus(emu, addr, buf[6])) {
+        send_ack(emu, 0x16, 0, reply, ctx);
+        send_status(emu, reply, ctx);
+        return;
+    }
+    if (space) {
+        uint8_t *regs = NULL;
+        if ((addr & 0xffff00) == 0xb00000) {
+            regs = emu->ir_regs;
+        } else if (mp_addr(emu, addr)) {
+            regs = emu->mp_regs;
+        } else if ((addr & 0xffff00) == 0xa40000
+            && emu->extension != EMU_EXT_NONE) {
+            regs = emu->ext_regs;
+        }
+        if (regs == NULL) {
+            err = 0x03;
+        } else {
+            for (uint8_t i = 0; i < size && (addr & 0xff) + i < 0x100; i++) {
+                regs[(addr & 0xff) + i] = buf[6 + i];
+            }
+        }
+    } else if (addr + size <= EMU_EEPROM_SIZE) {
+        memcpy(emu->eeprom + addr, buf + 6, size);
+    } else {
+        err = 0x03;
+    }
+    send_ack(emu, 0x16, err, reply, ctx);
+}
+
+static void handle_read(wiimote_emu_t *emu, const uint8_t *buf,
+        emu_reply_fn reply, void *ctx) {
+    uint8_t space = buf[1] & 0x04;
+    uint32_t addr = (uint32_t)buf[2] << 16 | (uint32_t)buf[3] << 8 | buf[4];
+    uint16_t size = (uint16_t)(buf[5] << 8 | buf[6]);
+    uint8_t out[EMU_REPORT_SIZE];
+    do {
+        uint8_t chunk = size > 16 ? 16 : (uint8_t)size;
+        uint8_t err = 0;
+        memset(out, 0, sizeof(out));
+        out[0] = 0x21;
+        put_buttons(emu, out + 1);
+        out[4] = (uint8_t)(addr >> 8);
+        out[5] = (uint8_t)addr;
+        if (space && mp_addr(emu, addr)) {
+            for (uint8_t i = 0; i < chunk; i++) {
+                out[6 + i] = emu->mp_regs[(addr + i) & 0xff];
+            }
+        } else if (space) {
+            if (emu->extension == EMU_EXT_NONE) {
+                err = 7;
+            } else if ((addr & 0xffff00) != 0xa40000) {
+                err = 8;
+            } else {
+                for (uint8_t i = 0; i < chunk; i++) {
+                    uint8_t v = emu->ext_regs[(addr + i) & 0xff];
+                    out[6 + i] = ext_encrypted(emu) ? v ^ 0x17 : v;
+                }
+            }
+        } else if (addr + chunk <= EMU_EEPROM_SIZE) {
+            memcpy(out + 6, emu->eeprom + addr, chunk);
+        } else {
+            err = 8;
+        }
+        out[3] = (uint8_t)(((chunk ? chunk - 1 : 0) << 4) | err);
+        reply(ctx, out, sizeof(out));
+        if (err) {
+            break;
+        }
+        addr += chunk;
+        size = (uint16_t)(size - chunk);
+    } while (size > 0);
+}
+
+void emu_handle_output(
+        wiimote_emu_t *emu,
+        const uint8_t *buf,
+        size_t len,
+        emu_reply_fn reply,
+        void *ctx) {
+    if (len < 2) {
+        return;
+    }
+    // bit 0 of the first payload byte is rumble in every output report
+    emu->rumble = buf[1] & 0x01;
+    uint8_t ack = buf[1] & 0x02;
+    switch (buf[0]) {
+        case 0x10:
+            break;
+        case 0x11:
+            emu->leds = buf[1] >> 4;
+            break;
+        case 0x12:
+            if (len >= 3) {
+                emu->continuous = (buf[1] & 0x04) != 0;
+                emu->report_mode = buf[2];
+                emu->second_half = 0;
+                emu->reporting_suspended = 0;
+            }
+            break;
+        case 0x13:
+        case 0x1a:
+            emu->ir_enabled = (buf[1] & 0x04) != 0;
+            break;
+        case 0x15:
+            send_status(emu, reply, ctx);
+            return;
+        case 0x16:
+            if (len >= 22) {
+                handle_write(emu, buf, reply, ctx);
+            }
+            return;
+        case 0x17:
+            if (len >= 7) {
+                handle_read(emu, buf, reply, ctx);
+            }
+            return;
+        default:
+            break;
+    }
+    if (ack) {
+        send_ack(emu, buf[0], 0, reply, ctx);
+    }
+}
+
+static void set_calibration(wiimote_emu_t *emu, const uint8_t calib[16]) {
+    uint8_t *regs = emu->ext_regs + EXT_CALIB_OFFSET;
+    uint8_t sum = 0;
+    memcpy(regs, calib, 14);
+    for (size_t i = 0; i < 14; i++) {
+        sum = (uint8_t)(sum + calib[i]);
+    }
+    regs[14] = (uint8_t)(sum + 0x55);
+    regs[15] = (uint8_t)(sum + 0xaa);
+}
+
+void emu_set_extension(
+        wiimote_emu_t *emu,
+        enum emu_extension ext,
+        emu_reply_fn reply,
+        void *ctx) {
+    if (ext == emu->extension) {
+        return;
+    }
+    emu->extension = ext;
+    memset(emu->ext_regs, 0xff, sizeof(emu->ext_regs));
+    memset(emu->ext_data, 0, sizeof(emu->ext_data));
+    switch (ext) {
+        case EMU_EXT_NUNCHUCK:
+            memcpy(emu->ext_regs + EXT_ID_OFFSET, nunchuck_id, 6);
+            set_calibration(emu, nunchuck_calib);
+            memcpy(emu->ext_data, nunchuck_data, 6);
+            break;
+        case EMU_EXT_CLASSIC:
+            memcpy(emu->ext_regs + EXT_ID_OFFSET, classic_id, 6);
+            set_calibration(emu, classic_calib);
+            memcpy(emu->ext_data, classic_data, 6);
+            break;
+        case EMU_EXT_NONE:
+        default:
+            break;
+    }
+    // behind an active MotionPlus the change only shows in its data
+    if (reply != NULL && emu->mp_mode == 0) {
+        emu->reporting_suspended = 1;
+        send_status(emu, reply, ctx);
+    }
+}
+
+/*
+ * Active MotionPlus bytes: a resting gyro sample in the slow range or, in
+ * the passthrough modes, every other report the extension bytes squeezed
+ * into the layout of the mode. Byte 4 bit 0 is set while an extension is
+ * plugged in.
+ */
+static void put_motionplus(wiimote_emu_t *emu, uint8_t *out) {
+    const uint8_t *d = emu->ext_data;
+    uint8_t ext = emu->extension != EMU_EXT_NONE;
+    int passthrough = ext && emu->mp_mode != 0x04 && emu->mp_turn;
+    emu->mp_turn = !emu->mp_turn;
+    if (!passthrough) {
+        out[0] = out[1] = out[2] = (uint8_t)MP_REST;
+        out[3] = (uint8_t)((MP_REST >> 8) << 2 | 0x03);
+        out[4] = (uint8_t)((MP_REST >> 8) << 2 | 0x02 | ext);
+        out[5] = (uint8_t)((MP_REST >> 8) << 2 | 0x02);
+        return;
+    }
+    memcpy(out, d, 4);
+    out[4] = (uint8_t)(d[4] | 0x01);
+    if (emu->mp_mode == 0x05) {
+        out[5] = (uint8_t)((d[4] & 0x01) << 7 | (d[5] & 0x80) >> 1
+                | (d[5] & 0x20) | (d[5] & 0x08) << 1 | (d[5] & 0x03) << 2);
+    } else {
+        out[0] = (uint8_t)((d[0] & 0xfe) | (d[5] & 0x01));
+        out[1] = (uint8_t)((d[1] & 0xfe) | (d[5] >> 1 & 0x01));
+        out[5] = d[5] & 0xfc;
+    }
+}
+
+/*
+ * Camera bytes in the format written to 0xb00033, the bar in the first two
+ * slots. All ones, no points, until the camera was set up. Full data is
+ * split in two, both bar points are in the first half.
+ */
+static void put_ir(const wiimote_emu_t *emu, uint8_t *out, size_t len,
+        int second_half) {
+    memset(out, 0xff, len);
+    if (!emu->ir_enabled || emu->ir_regs[0x30] != 0x08) {
+        return;
+    }
+    uint8_t mode = emu->ir_regs[0x33];
+    if ((mode == IR_MODE_EXTENDED && len >= 12)
+        || (mode == IR_MODE_FULL && len >= 18 && !second_half)) {
+        size_t stride = mode == IR_MODE_FULL ? 9 : 3;
+        for (int i = 0; i < 2; i++) {
+            uint8_t *p = out + stride * (size_t)i;
+            p[0] = (uint8_t)bar[i].x;
+            p[1] = (uint8_t)bar[i].y;
+            p[2] = (uint8_t)((bar[i].y >> 8) << 6
+                    | (bar[i].x >> 8) << 4 | bar[i].size);
+            if (mode == IR_MODE_FULL) {
+                // bounding box and intensity
+                memset(p + 3, 0, 6);
+            }
+        }
+    } else if (emu->ir_regs[0x33] == IR_MODE_BASIC && len >= 10) {
+        out[0] = (uint8_t)bar[0].x;
+        out[1] = (uint8_t)bar[0].y;
+        out[2] = (uint8_t)((bar[0].y >> 8) << 6 | (bar[0].x >> 8) << 4
+                | (bar[1].y >> 8) << 2 | bar[1].x >> 8);
+        out[3] = (uint8_t)bar[1].x;
+        out[4] = (uint8_t)bar[1].y;
+    }
+}
+
+size_t emu_data_report(wiimote_emu_t *emu, uint8_t *out) {
+    size_t acc = 0, ir = 0, ext = 0, btns = 2;
+    int second_half = 0;
+    switch (emu->report_mode) {
+        case 0x30: break;
+        case 0x31: acc = 3; break;
+        case 0x32: ext = 8; break;
+        case 0x33: acc = 3; ir = 12; break;
+        case 0x34: ext = 19; break;
+        case 0x35: acc = 3; ext = 16; break;
+        case 0x36: ir = 10; ext = 9; break;
+        case 0x37: acc = 3; ir = 10; ext = 6; break;
+        case 0x3d: btns = 0; ext = 21; break;
+        case 0x3e:
+            // alternates 0x3e and 0x3f, one accelerometer axis each
+            second_half = emu->second_half;
+            emu->second_half = !second_half;
+            acc = 1;
+            ir = 18;
+            break;
+        default: return 0;
+    }
+    size_t off = 1;
+    out[0] = (uint8_t)(emu->report_mode + second_half);
+    if (btns) {
+        put_buttons(emu, out + off);
+        off += btns;
+    }
+    // lying flat: 1g on z only
+    static const uint8_t resting[3] = {0x80, 0x80, 0x9a};
+    if (emu->report_mode == 0x3e) {
+        // z bits 7:4, then 3:0, in the spare button bits
+        uint8_t z = (uint8_t)(second_half ? resting[2] : resting[2] >> 4);
+        out[1] = (uint8_t)(out[1] | (z & 0x3) << 5);
+        out[2] = (uint8_t)(out[2] | (z >> 2 & 0x3) << 5);
+        out[off] = resting[second_half];
+    } else {
+        memcpy(out + off, resting, acc);
+    }
+    off += acc;
+    put_ir(emu, out + off, ir, second_half);
+    off += ir;
+    if (ext > 0) {
+        memset(out + off, 0x00, ext);
+        if (emu->mp_mode != 0) {
+            put_motionplus(emu, out + off);
+        } else if (emu->extension != EMU_EXT_NONE) {
+            memcpy(out + off, emu->ext_data, 6);
+        }
+        off += ext;
+    }
+    return off;
+}
@@ -0,0 +1,60 @@
+#ifndef _GEMULATOR_H_
+#define _GEMULATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Userspace model of a Wiimote's output report protocol, used by the load
+ * generator. It keeps LEDs, reporting mode, extension and MotionPlus
+ * registers and EEPROM, and produces the 0x20/0x21/0x22 replies and data
+ * reports a real remote would send.
+ */
+enum emu_extension {
+    EMU_EXT_NONE,
+    EMU_EXT_NUNCHUCK,
+    EMU_EXT_CLASSIC,
+};
+
+#define EMU_REPORT_SIZE 22
+#define EMU_EEPROM_SIZE 0x1700
+typedef void (*emu_reply_fn)(void *ctx, const uint8_t *buf, size_t len);
+
+typedef struct {
+    uint8_t leds;
+    uint8_t rumble;
+    uint8_t ir_enabled;
+    uint8_t report_mode;
+    uint8_t second_half; // next interleaved report is 0x3f
+    uint8_t continuous;
+    // an unsolicited status report stops data reports until 0x12
+    uint8_t reporting_suspended;
+    uint16_t buttons;
+    enum emu_extension extension;
+    // built in, as in a Wii Remote Plus; mode 0 while inactive
+    uint8_t motionplus;
+    uint8_t mp_mode;
+    uint8_t mp_turn; // next passthrough mode report is extension data
+    uint8_t mp_regs[256]; // 0xa60000-0xa600ff, 0xa40000 while active
+    uint8_t ext_regs[256]; // 0xa40000-0xa400ff
+    uint8_t ir_regs[256];  // 0xb00000-0xb000ff
+    uint8_t ext_data[6];   // current extension controller bytes
+    uint8_t eeprom[EMU_EEPROM_SIZE];
+} wiimote_emu_t;
+
+void emu_init(wiimote_emu_t *emu);
+void emu_handle_output(
+        wiimote_emu_t *emu,
+        const uint8_t *buf,
+        size_t len,
+        emu_reply_fn reply,
+        void *ctx);
+// reply == NULL plugs the extension silently, as if before connecting
+void emu_set_extension(
+        wiimote_emu_t *emu,
+        enum emu_extension ext,
+        emu_reply_fn reply,
+        void *ctx);
+size_t emu_data_report(wiimote_emu_t *emu, uint8_t *out);
+
+#endif // _GEMULATOR_H_
@@ -0,0 +1,52 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "extcache.h"
+
+static ext_cache_entry_t entries[EXT_CACHE_SIZE];
+static size_t n_entries = 0;
+static size_t next_victim = 0;
+// stored from whichever thread serves the device
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static ext_cache_entry_t *find_entry(const char *key) {
+    for (size_t i = 0; i < n_entries; i++) {
+        if (strcmp(entries[i].key, key) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+// returns 1 and fills out if key is cached, 0 otherwise
+int ext_cache_lookup(const char *key, ext_cache_entry_t *out) {
+    int ret = 0;
+    pthread_mutex_lock(&cache_lock);
+    const ext_cache_entry_t *entry = find_entry(key);
+    if (entry != NULL) {
+        *out = *entry;
+        ret = 1;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return ret;
+}
+
+void ext_cache_store(const char *key, const wiimote_state_t *state) {
+    pthread_mutex_lock(&cache_lock);
+    ext_cache_entry_t *entry = find_entry(key);
+    if (entry == NULL) {
+        if (n_entries < EXT_CACHE_SIZE) {
+            entry = &entries[n_entries++];
+        } else {
+            entry = &entries[next_victim];
+            next_victim = (next_victim + 1) % EXT_CACHE_SIZE;
+        }
+        strncpy(entry->key, key, sizeof(entry->key) - 1);
+        entry->key[sizeof(entry->key) - 1] = '\0';
+    }
+    entry->ext_status = state->ext_status;
+    entry->data_format = state->classic_controller.data_format;
+    entry->calib_valid = state->ext_calib_valid;
+    memcpy(entry->calib, state->ext_calib, sizeof(entry->calib));
+    pthread_mutex_unlock(&cache_lock);
+}
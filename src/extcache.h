@@ -0,0 +1,27 @@
+#ifndef _GEXTCACHE_H_
+#define _GEXTCACHE_H_
+
+#include <stdint.h>
+
+#include "wiimote.h"
+
+/*
+ * Last extension identified on each controller, keyed by its Bluetooth
+ * address. A Wiimote reconnecting with the same extension is translated
+ * with it right away while the handshake verifies it in the background.
+ * The oldest entry is replaced once the table is full.
+ */
+#define EXT_CACHE_SIZE 32
+#define EXT_CACHE_KEY_SIZE 32
+typedef struct {
+    char key[EXT_CACHE_KEY_SIZE];
+    enum extension_status ext_status;
+    uint8_t data_format;
+    uint8_t calib_valid;
+    uint8_t calib[EXT_CALIB_SIZE];
+} ext_cache_entry_t;
+
+int ext_cache_lookup(const char *key, ext_cache_entry_t *out);
+void ext_cache_store(const char *key, const wiimote_state_t *state);
+
+#endif // _GEXTCACHE_H_
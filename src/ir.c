@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+
+ir_filter_t ir_filter = {1000, 7000};
+
+// Decoding
+
+/*
+ * Basic: two 5-byte groups, each x1 y1 low bytes, the four high bit pairs,
+ * then x2 y2. Extended: 3 bytes per point, x y low bytes then y and x
+ * high bits and the size. Full: the extended bytes followed by a bounding
+ * box and intensity we have no use for, 9 bytes per point. An absent
+ * point reads as all ones.
+ */
+void parse_ir(const uint8_t *ir_buf, ir_state_t *ir) {
+    ir->visible = 0;
+    ir->seq++;
+    for (int i = 0; i < IR_POINTS; i++) {
+        ir_point_t *p = &ir->points[i];
+        if (ir->mode == IR_MODE_EXTENDED || ir->mode == IR_MODE_FULL) {
+            const uint8_t *b = ir_buf + (ir->mode == IR_MODE_FULL ? 9 : 3) * i;
+            p->x = (uint16_t)(b[0] | (b[2] & 0x30) << 4);
+            p->y = (uint16_t)(b[1] | (b[2] & 0xc0) << 2);
+            p->size = b[2] & 0x0f;
+        } else if (ir->mode == IR_MODE_BASIC) {
+            const uint8_t *b = ir_buf + 5 * (i / 2);
+            if (i % 2 == 0) {
+                p->x = (uint16_t)(b[0] | (b[2] & 0x30) << 4);
+                p->y = (uint16_t)(b[1] | (b[2] & 0xc0) << 2);
+            } else {
+                p->x = (uint16_t)(b[3] | (b[2] & 0x03) << 8);
+                p->y = (uint16_t)(b[4] | (b[2] & 0x0c) << 6);
+            }
+            p->size = 0;
+        } else {
+            return;
+        }
+        if (p->y < IR_HEIGHT && p->x < IR_WIDTH) {
+            ir->visible |= (uint8_t)(1u << i);
+        }
+    }
+}
+
+// Tracking
+
+static int32_t isqrt(int64_t v) {
+    int64_t r = 0, bit = (int64_t)1 << 40;
+    while (bit > v) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (int32_t)r;
+}
+
+/*
+ * Lower is more bar-like: level, similar blobs and close to where the bar
+ * was. Pairs that are nearly vertical or overlapping are no bar at all.
+ */
+static int64_t pair_score(const ir_point_t *a, const ir_point_t *b,
+        const ir_track_t *track) {
+    int32_t dx = abs((int32_t)a->x - b->x);
+    int32_t dy = abs((int32_t)a->y - b->y);
+    if (dx < 16 || dy > dx) {
+        return -1;
+    }
+    int64_t score = 2 * dy + 8 * abs((int32_t)a->size - b->size);
+    if (track->valid) {
+        int32_t mx = a->x + b->x, my = a->y + b->y;
+        score += (abs(mx - (track->ax + track->bx))
+                + abs(my - (track->ay + track->by))) / 2;
+    }
+    return score;
+}
+
+static void keep_bar(ir_track_t *track, const ir_point_t *a,
+        const ir_point_t *b) {
+    if (a->x > b->x) {
+        const ir_point_t *t = a;
+        a = b;
+        b = t;
+    }
+    track->ax = a->x;
+    track->ay = a->y;
+    track->bx = b->x;
+    track->by = b->y;
+    track->valid = 1;
+}
+
+// one point left: it is whichever end of the last bar it is closest to
+static void extrapolate_bar(ir_track_t *track, const ir_point_t *p) {
+    int32_t da = abs(p->x - track->ax) + abs(p->y - track->ay);
+    int32_t db = abs(p->x - track->bx) + abs(p->y - track->by);
+    int32_t ox = p->x - (da <= db ? track->ax : track->bx);
+    int32_t oy = p->y - (da <= db ? track->ay : track->by);
+    track->ax += ox;
+    track->ay += oy;
+    track->bx += ox;
+    track->by += oy;
+}
+
+/*
+ * Returns 1 with the pointer in x, y, 0 when the bar is out of sight.
+ * The camera sees the scene mirrored and upside down, and the bar tilts
+ * with the remote, so the midpoint is rotated back by the bar's angle
+ * around the image center before flipping it. No trigonometry needed:
+ * the bar vector itself gives the cosine and sine.
+ */
+int ir_pointer(const ir_state_t *ir, ir_track_t *track,
+        int32_t *x, int32_t *y) {
+    const ir_point_t *best_a = NULL, *best_b = NULL;
+    int64_t best = -1;
+    for (int i = 0; i < IR_POINTS; i++) {
+        for (int j = i + 1; j < IR_POINTS; j++) {
+            if (!(ir->visible >> i & 1) || !(ir->visible >> j & 1)) {
+                continue;
+            }
+            int64_t score = pair_score(&ir->points[i], &ir->points[j], track);
+            if (score >= 0 && (best < 0 || score < best)) {
+                best = score;
+                best_a = &ir->points[i];
+                best_b = &ir->points[j];
+            }
+        }
+    }
+    if (best_a != NULL) {
+        keep_bar(track, best_a, best_b);
+    } else if (track->valid && ir->visible != 0) {
+        extrapolate_bar(track,
+                &ir->points[__builtin_ctz(ir->visible)]);
+    } else {
+        track->valid = 0;
+        return 0;
+    }
+    int32_t dx = track->bx - track->ax, dy = track->by - track->ay;
+    int32_t len = isqrt((int64_t)dx * dx + (int64_t)dy * dy);
+    if (len == 0) {
+        return 0;
+    }
+    // midpoint relative to the center, in half pixels
+    int32_t mx = track->ax + track->bx - IR_WIDTH;
+    int32_t my = track->ay + track->by - IR_HEIGHT;
+    int32_t rx = (int32_t)(((int64_t)mx * dx + (int64_t)my * dy) / len);
+    int32_t ry = (int32_t)(((int64_t)my * dx - (int64_t)mx * dy) / len);
+    *x = (IR_WIDTH - rx) / 2;
+    *y = (IR_HEIGHT - ry) / 2;
+    *x = *x < 0 ? 0 : *x >= IR_WIDTH ? IR_WIDTH - 1 : *x;
+    *y = *y < 0 ? 0 : *y >= IR_HEIGHT ? IR_HEIGHT - 1 : *y;
+    return 1;
+}
+
+// Filtering
+
+// derivative cutoff, fixed as in the original paper
+#define EURO_DCUTOFF_MHZ 1000
+
+/*
+ * Smoothing factor of a first order low pass at cutoff fc sampled every
+ * IR_SAMPLE_US, alpha = w / (w + 1) with w = 2 pi fc T, in Q16.
+ */
+static uint32_t euro_alpha(uint64_t fc_mhz) {
+    // 2 pi in Q16 is 411775
+    uint64_t w = fc_mhz * IR_SAMPLE_US * 411775 / 1000000000ULL;
+    return (uint32_t)((w << 16) / (w + 65536));
+}
+
+static int32_t lowpass(int32_t prev, int32_t x, uint32_t alpha) {
+    return prev + (int32_t)(((int64_t)(x - prev) * alpha) >> 16);
+}
+
+// x in pixels, returns the filtered position in pixels
+int32_t euro_filter(euro_axis_t *f, int32_t x) {
+    int32_t xq = x * 16;
+    if (ir_filter.min_cutoff_mhz == 0) {
+        return x;
+    }
+    if (!f->primed) {
+        f->primed = 1;
+        f->x = xq;
+        f->dx = 0;
+        return x;
+    }
+    f->dx = lowpass(f->dx, xq - f->x, euro_alpha(EURO_DCUTOFF_MHZ));
+    // px/s = |dx| / 16 * 1e6 / T, times beta (1e-6 Hz per px/s) in mHz
+    uint64_t speed_term = (uint64_t)abs(f->dx) * ir_filter.beta_u * 1000
+        / (16ULL * IR_SAMPLE_US);
+    f->x = lowpass(f->x, xq,
+            euro_alpha(ir_filter.min_cutoff_mhz + speed_term));
+    return (f->x + 8) >> 4;
+}
+
+// "MINCUTOFF,BETA" in Hz and Hz per px/s, or "off"
+int ir_filter_parse(const char *spec) {
+    char *end;
+    if (strcmp(spec, "off") == 0) {
+        ir_filter.min_cutoff_mhz = 0;
+        return 0;
+    }
+    double min_cutoff = strtod(spec, &end);
+    if (end == spec || *end != ',' || min_cutoff <= 0) {
+        return -1;
+    }
+    double beta = strtod(end + 1, &end);
+    if (*end != '\0' || beta < 0) {
+        return -1;
+    }
+    ir_filter.min_cutoff_mhz = (uint32_t)(min_cutoff * 1000 + 0.5);
+    ir_filter.beta_u = (uint32_t)(beta * 1000000 + 0.5);
+    return ir_filter.min_cutoff_mhz > 0 ? 0 : -1;
+}
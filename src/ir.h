@@ -0,0 +1,78 @@
+#ifndef _GIR_H_
+#define _GIR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * IR camera. The camera tracks up to four light sources at 1024x768 and
+ * reports them in the format it was configured for: basic (10 bytes, two
+ * packed pairs of points) in the extension reporting modes, extended (12
+ * bytes, with a blob size) otherwise, and full (36 bytes, extended plus
+ * bounding box and intensity) split over the interleaved reports.
+ */
+#define IR_POINTS 4
+#define IR_WIDTH 1024
+#define IR_HEIGHT 768
+
+// camera data formats, as written to register 0xb00033
+#define IR_MODE_OFF      0x00
+#define IR_MODE_BASIC    0x01
+#define IR_MODE_EXTENDED 0x03
+#define IR_MODE_FULL     0x05
+
+#define IR_FULL_SIZE 36
+
+typedef struct {
+    uint16_t x, y;
+    uint8_t size; // 0 in basic mode
+} ir_point_t;
+
+typedef struct {
+    uint8_t mode;    // format the camera was set up for
+    uint8_t visible; // bit i set if points[i] is valid
+    uint8_t seq;     // bumped by every parse, tells new samples apart
+    ir_point_t points[IR_POINTS];
+} ir_state_t;
+
+void parse_ir(const uint8_t *ir_buf, ir_state_t *ir);
+
+/*
+ * Pointer tracking: the pair of points most likely to be the sensor bar
+ * is picked, favouring the one closest to the last pair, and its midpoint
+ * is turned into a pointer position with the roll the bar shows undone.
+ * With a single point left the last bar width is assumed.
+ */
+typedef struct {
+    uint8_t valid;
+    int32_t ax, ay, bx, by; // last bar ends, left one first
+} ir_track_t;
+
+// pointer position in camera pixels, origin top left as seen by the user
+int ir_pointer(const ir_state_t *ir, ir_track_t *track,
+        int32_t *x, int32_t *y);
+
+/*
+ * One-Euro filter in fixed point: a low pass whose cutoff rises with the
+ * speed of the pointer, smooth when still and without lag when moving.
+ * Reports are taken as IR_SAMPLE_US apart, the rate of the continuous
+ * reporting modes.
+ */
+#define IR_SAMPLE_US 10000
+typedef struct {
+    uint32_t min_cutoff_mhz; // cutoff at rest, mHz; 0 disables filtering
+    uint32_t beta_u;         // cutoff increase per px/s, millionths of Hz
+} ir_filter_t;
+
+extern ir_filter_t ir_filter;
+
+typedef struct {
+    uint8_t primed;
+    int32_t x;  // Q4 pixels
+    int32_t dx; // Q4 pixels per sample
+} euro_axis_t;
+
+int ir_filter_parse(const char *spec);
+int32_t euro_filter(euro_axis_t *f, int32_t x);
+
+#endif // _GIR_H_
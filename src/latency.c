@@ -0,0 +1,116 @@
+#include <time.h>
+
+#include "latency.h"
+#include "logger.h"
+
+uint64_t lat_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline unsigned int hist_index(uint64_t v) {
+    unsigned int msb = 63u - (unsigned int)__builtin_clzll(v | 1);
+    unsigned int shift = msb > LAT_SUB_BITS ? msb - LAT_SUB_BITS : 0;
+    unsigned int idx = (shift << LAT_SUB_BITS) + (unsigned int)(v >> shift);
+    return idx < LAT_HIST_BUCKETS ? idx : LAT_HIST_BUCKETS - 1;
+}
+
+// lowest value falling in bucket idx
+static inline uint64_t hist_value(unsigned int idx) {
+    if (idx < (2u << LAT_SUB_BITS)) {
+        return idx;
+    }
+    unsigned int shift = (idx >> LAT_SUB_BITS) - 1;
+    return (uint64_t)(idx - (shift << LAT_SUB_BITS)) << shift;
+}
+
+void lat_hist_add(lat_hist_t *h, uint64_t v) {
+    h->buckets[hist_index(v)]++;
+    h->count++;
+    h->sum_ns += v;
+    if (v > h->max_ns) {
+        h->max_ns = v;
+    }
+}
+
+static uint64_t hist_percentile(const lat_hist_t *h, unsigned int permille) {
+    uint64_t target = (h->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < LAT_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target) {
+            return hist_value(i);
+        }
+    }
+    return h->max_ns;
+}
+
+void lat_record(
+        lat_stats_t *stats,
+        uint8_t report_type,
+        uint64_t t_read,
+        uint64_t t_parsed,
+        uint64_t t_emitted) {
+    lat_hist_add(&stats->read_to_parse, t_parsed - t_read);
+    lat_hist_add(&stats->parse_to_emit, t_emitted - t_parsed);
+    lat_hist_add(&stats->read_to_emit, t_emitted - t_read);
+
+    if (report_type < LAT_REPORT_FIRST
+        || report_type >= LAT_REPORT_FIRST + LAT_REPORT_TYPES) {
+        return;
+    }
+    lat_arrival_t *a = &stats->arrivals[report_type - LAT_REPORT_FIRST];
+    if (a->count > 0) {
+        uint64_t interval = t_read - a->last_ns;
+        if (a->count > 1) {
+            uint64_t d = interval > a->last_interval_ns
+                ? interval - a->last_interval_ns
+                : a->last_interval_ns - interval;
+            // J += (|D| - J) / 16
+            a->jitter_ns = a->jitter_ns - a->jitter_ns / 16 + d / 16;
+        }
+        if (interval > a->max_interval_ns) {
+            a->max_interval_ns = interval;
+        }
+        a->last_interval_ns = interval;
+    }
+    a->last_ns = t_read;
+    a->count++;
+}
+
+void lat_hist_dump(const lat_hist_t *h, const char *stage) {
+    if (h->count == 0) {
+        return;
+    }
+    LOG_INFO("  %-13s n=%llu mean=%lluns p50=%lluns p90=%lluns "
+            "p99=%lluns p99.9=%lluns max=%lluns",
+            stage,
+            (unsigned long long)h->count,
+            (unsigned long long)(h->sum_ns / h->count),
+            (unsigned long long)hist_percentile(h, 500),
+            (unsigned long long)hist_percentile(h, 900),
+            (unsigned long long)hist_percentile(h, 990),
+            (unsigned long long)hist_percentile(h, 999),
+            (unsigned long long)h->max_ns);
+}
+
+void lat_dump(const lat_stats_t *stats, const char *name) {
+    LOG_INFO("Latency stats for %s:", name);
+    lat_hist_dump(&stats->read_to_parse, "read->parse");
+    lat_hist_dump(&stats->parse_to_emit, "parse->emit");
+    lat_hist_dump(&stats->read_to_emit, "read->emit");
+    for (unsigned int i = 0; i < LAT_REPORT_TYPES; i++) {
+        const lat_arrival_t *a = &stats->arrivals[i];
+        if (a->count < 2) {
+            continue;
+        }
+        LOG_INFO("  report %02x: n=%llu last_interval=%lluus "
+                "max_interval=%lluus jitter=%lluus",
+                i + LAT_REPORT_FIRST,
+                (unsigned long long)a->count,
+                (unsigned long long)(a->last_interval_ns / 1000),
+                (unsigned long long)(a->max_interval_ns / 1000),
+                (unsigned long long)(a->jitter_ns / 1000));
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef _GLATENCY_H_
+#define _GLATENCY_H_
+
+#include <stdint.h>
+
+/*
+ * Log-bucketed histogram (HDR style): values below 16ns get their own
+ * bucket, above that every power of two is split in 8 linear sub-buckets,
+ * so the relative error stays under 12.5% up to ~2^40ns.
+ */
+#define LAT_SUB_BITS 3
+#define LAT_HIST_BUCKETS 320
+typedef struct {
+    uint32_t buckets[LAT_HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+} lat_hist_t;
+
+// inter-arrival tracking for one report type, jitter as in RFC 3550
+typedef struct {
+    uint64_t count;
+    uint64_t last_ns;
+    uint64_t last_interval_ns;
+    uint64_t max_interval_ns;
+    uint64_t jitter_ns;
+} lat_arrival_t;
+
+// report types 0x20-0x3f are the only ones a wiimote sends
+#define LAT_REPORT_FIRST 0x20
+#define LAT_REPORT_TYPES 0x20
+typedef struct {
+    lat_hist_t read_to_parse;
+    lat_hist_t parse_to_emit;
+    lat_hist_t read_to_emit;
+    lat_arrival_t arrivals[LAT_REPORT_TYPES];
+} lat_stats_t;
+
+uint64_t lat_now_ns(void);
+void lat_hist_add(lat_hist_t *h, uint64_t v);
+void lat_hist_dump(const lat_hist_t *h, const char *stage);
+void lat_record(
+        lat_stats_t *stats,
+        uint8_t report_type,
+        uint64_t t_read,
+        uint64_t t_parsed,
+        uint64_t t_emitted);
+void lat_dump(const lat_stats_t *stats, const char *name);
+
+#endif // _GLATENCY_H_
@@ -0,0 +1,337 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "latency.h"
+#include "loadgen.h"
+#include "logger.h"
+#include "spoofer.h"
+
+#define STATS_PERIOD_NS 5000000000ull
+#define REPLY_QUEUE_SIZE 16
+
+typedef struct {
+    uint64_t due_ns;
+    size_t len;
+    uint8_t buf[EMU_REPORT_SIZE];
+} delayed_reply_t;
+
+typedef struct {
+    int input_fd;   // daemon side of the "hidraw" pair
+    int input_peer; // controller side
+    int output_fd;  // daemon side of the "uinput" pair
+    int output_peer;
+    wiimote_emu_t emu;
+    delayed_reply_t replies[REPLY_QUEUE_SIZE];
+    size_t reply_head, reply_count;
+    uint8_t first_input_seen;
+    uint8_t pending;
+    uint64_t sent_ns;
+    uint64_t plugged_ns; // 0 once extension input has been seen
+} sim_controller_t;
+
+typedef struct {
+    uint64_t sent;
+    uint64_t send_failed;
+    uint64_t suspended; // ticks skipped waiting for a 0x12 request
+    uint64_t received;
+    uint64_t late; // previous report not translated yet at the next tick
+    uint64_t timer_overruns;
+    uint64_t replies_dropped;
+    uint64_t replies_lost;
+    lat_hist_t latency;
+    lat_hist_t first_input;
+    lat_hist_t hotswap;
+} loadgen_stats_t;
+
+static sim_controller_t *sims = NULL;
+static size_t n_sims = 0;
+static loadgen_config_t config;
+static uint64_t start_ns;
+static loadgen_stats_t stats;
+static pthread_t loadgen_thread;
+static atomic_int loadgen_running = 0;
+static uint32_t loss_rng = 0x9e3779b9;
+
+int loadgen_init(const loadgen_config_t *cfg) {
+    int pair[2];
+    config = *cfg;
+    if (config.rate_hz == 0) {
+        config.rate_hz = 100;
+    }
+    sims = calloc(config.controllers, sizeof(*sims));
+    if (sims == NULL) {
+        LOG_ERROR("Cannot allocate %zu simulated Wiimotes",
+                config.controllers);
+        return -1;
+    }
+    for (n_sims = 0; n_sims < config.controllers; n_sims++) {
+        sim_controller_t *sim = &sims[n_sims];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, pair) < 0) {
+            LOG_ERROR("socketpair failed (errno=%d)", errno);
+            return -1;
+        }
+        sim->input_fd = pair[0];
+        sim->input_peer = pair[1];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, pair) < 0) {
+            LOG_ERROR("socketpair failed (errno=%d)", errno);
+            return -1;
+        }
+        sim->output_fd = pair[0];
+        sim->output_peer = pair[1];
+        emu_init(&sim->emu);
+        emu_set_extension(&sim->emu, config.extension, NULL, NULL);
+    }
+    LOG_INFO("Simulating %zu Wiimotes at %u reports/s each, "
+            "reply delay %uus, %u%% replies lost, hotswap every %ums",
+            n_sims, config.rate_hz, config.reply_delay_us,
+            config.reply_loss_pct, config.hotswap_ms);
+    return 0;
+}
+
+int loadgen_input_fd(size_t index) {
+    return index < n_sims ? sims[index].input_fd : -1;
+}
+
+int loadgen_output_fd(int input_fd) {
+    for (size_t i = 0; i < n_sims; i++) {
+        if (sims[i].input_fd == input_fd) {
+            return sims[i].output_fd;
+        }
+    }
+    return -1;
+}
+
+static void send_now(sim_controller_t *sim, const uint8_t *buf, size_t len) {
+    if (write(sim->input_peer, buf, len) < 0) {
+        stats.send_failed++;
+    }
+}
+
+// emu_reply_fn: replies leave after the configured delay, in order
+static void queue_reply(void *ctx, const uint8_t *buf, size_t len) {
+    sim_controller_t *sim = ctx;
+    if (config.reply_loss_pct > 0) {
+        loss_rng ^= loss_rng << 13;
+        loss_rng ^= loss_rng >> 17;
+        loss_rng ^= loss_rng << 5;
+        if (loss_rng % 100 < config.reply_loss_pct) {
+            stats.replies_lost++;
+            return;
+        }
+    }
+    if (config.reply_delay_us == 0) {
+        send_now(sim, buf, len);
+        return;
+    }
+    if (sim->reply_count == REPLY_QUEUE_SIZE) {
+        stats.replies_dropped++;
+        return;
+    }
+    delayed_reply_t *r = &sim->replies[
+        (sim->reply_head + sim->reply_count) % REPLY_QUEUE_SIZE];
+    r->due_ns = lat_now_ns() + config.reply_delay_us * 1000ull;
+    r->len = len < EMU_REPORT_SIZE ? len : EMU_REPORT_SIZE;
+    memcpy(r->buf, buf, r->len);
+    sim->reply_count++;
+}
+
+// returns 1 if replies are still waiting
+static int flush_replies(sim_controller_t *sim, uint64_t now) {
+    while (sim->reply_count > 0) {
+        delayed_reply_t *r = &sim->replies[sim->reply_head];
+        if (r->due_ns > now) {
+            return 1;
+        }
+        send_now(sim, r->buf, r->len);
+        sim->reply_head = (sim->reply_head + 1) % REPLY_QUEUE_SIZE;
+        sim->reply_count--;
+    }
+    return 0;
+}
+
+static void handle_command(sim_controller_t *sim) {
+    uint8_t buf[32];
+    ssize_t len;
+    while ((len = read(sim->input_peer, buf, sizeof(buf))) > 0) {
+        emu_handle_output(&sim->emu, buf, (size_t)len, queue_reply, sim);
+    }
+}
+
+static void handle_output(sim_controller_t *sim, uint64_t now) {
+    struct input_event events[UINPUT_BATCH_MAX];
+    ssize_t len;
+    while ((len = read(sim->output_peer, events, sizeof(events))) > 0) {
+        stats.received++;
+        if (!sim->first_input_seen) {
+            lat_hist_add(&stats.first_input, now - start_ns);
+            sim->first_input_seen = 1;
+        }
+        if (sim->pending) {
+            lat_hist_add(&stats.latency, now - sim->sent_ns);
+            sim->pending = 0;
+        }
+        size_t n = (size_t)len / sizeof(events[0]);
+        for (size_t i = 0; i < n && sim->plugged_ns; i++) {
+            // emulated sticks rest fully right, see emulator.c
+            if (events[i].type == EV_ABS && events[i].code == ABS_X
+                && events[i].value == 511) {
+                lat_hist_add(&stats.hotswap, now - sim->plugged_ns);
+                sim->plugged_ns = 0;
+            }
+        }
+    }
+}
+
+static void send_reports(uint64_t now) {
+    uint8_t report[EMU_REPORT_SIZE];
+    for (size_t i = 0; i < n_sims; i++) {
+        sim_controller_t *sim = &sims[i];
+        if (sim->emu.reporting_suspended) {
+            stats.suspended++;
+            continue;
+        }
+        if (sim->pending) {
+            stats.late++;
+        }
+        // toggle A so every report has to be translated
+        sim->emu.buttons ^= 0x0008;
+        size_t len = emu_data_report(&sim->emu, report);
+        if (len == 0 || write(sim->input_peer, report, len) < 0) {
+            stats.send_failed++;
+            continue;
+        }
+        stats.sent++;
+        sim->sent_ns = now;
+        sim->pending = 1;
+    }
+}
+
+static void hotswap(uint64_t now) {
+    for (size_t i = 0; i < n_sims; i++) {
+        sim_controller_t *sim = &sims[i];
+        // alternate unplug/plug, a remote reports each as a status change
+        enum emu_extension next = EMU_EXT_NONE;
+        if (sim->emu.extension == EMU_EXT_NONE) {
+            next = config.extension != EMU_EXT_NONE
+                ? config.extension : EMU_EXT_NUNCHUCK;
+        }
+        emu_set_extension(&sim->emu, next, queue_reply, sim);
+        sim->plugged_ns = next != EMU_EXT_NONE ? now : 0;
+    }
+}
+
+static void log_stats(void) {
+    LOG_INFO("Load generator: sent=%llu failed=%llu suspended=%llu "
+            "received=%llu late=%llu timer_overruns=%llu "
+            "replies_dropped=%llu replies_lost=%llu",
+            (unsigned long long)stats.sent,
+            (unsigned long long)stats.send_failed,
+            (unsigned long long)stats.suspended,
+            (unsigned long long)stats.received,
+            (unsigned long long)stats.late,
+            (unsigned long long)stats.timer_overruns,
+            (unsigned long long)stats.replies_dropped,
+            (unsigned long long)stats.replies_lost);
+    lat_hist_dump(&stats.latency, "report->event");
+    lat_hist_dump(&stats.first_input, "connect->input");
+    lat_hist_dump(&stats.hotswap, "plug->ext input");
+}
+
+static void *loadgen_main(void *arg) {
+    (void)arg;
+    struct epoll_event ev, events[64];
+    int epoll_fd = epoll_create1(0);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    long period_ns = 1000000000L / config.rate_hz;
+    struct itimerspec its = {
+        .it_interval = {period_ns / 1000000000L, period_ns % 1000000000L},
+        .it_value = {period_ns / 1000000000L, period_ns % 1000000000L},
+    };
+    timerfd_settime(timer_fd, 0, &its, NULL);
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+    for (size_t i = 0; i < n_sims; i++) {
+        ev.data.ptr = &sims[i];
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sims[i].input_peer, &ev);
+        // output events are told apart by the low pointer bit
+        ev.data.ptr = (uint8_t *)&sims[i] + 1;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sims[i].output_peer, &ev);
+    }
+
+    for (size_t i = 0; i < n_sims; i++) {
+        sims[i].plugged_ns = config.extension != EMU_EXT_NONE
+            ? start_ns : 0;
+    }
+
+    uint64_t next_stats = start_ns + STATS_PERIOD_NS;
+    uint64_t next_hotswap = start_ns + config.hotswap_ms * 1000000ull;
+    int replies_waiting = 0;
+    while (atomic_load(&loadgen_running)) {
+        int n = epoll_wait(epoll_fd, events, 64, replies_waiting ? 1 : 100);
+        uint64_t now = lat_now_ns();
+        for (int i = 0; i < n; i++) {
+            uintptr_t tag = (uintptr_t)events[i].data.ptr;
+            if (tag == 0) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) > 0) {
+                    stats.timer_overruns += expirations - 1;
+                    send_reports(now);
+                }
+            } else if (tag & 1) {
+                handle_output((sim_controller_t *)(tag - 1), now);
+            } else {
+                handle_command((sim_controller_t *)tag);
+            }
+        }
+        replies_waiting = 0;
+        for (size_t i = 0; i < n_sims; i++) {
+            replies_waiting |= flush_replies(&sims[i], now);
+        }
+        if (config.hotswap_ms > 0 && now >= next_hotswap) {
+            hotswap(now);
+            next_hotswap = now + config.hotswap_ms * 1000000ull;
+        }
+        if (now >= next_stats) {
+            log_stats();
+            next_stats = now + STATS_PERIOD_NS;
+        }
+    }
+    close(timer_fd);
+    close(epoll_fd);
+    return NULL;
+}
+
+int loadgen_start(void) {
+    start_ns = lat_now_ns();
+    atomic_store(&loadgen_running, 1);
+    if (pthread_create(&loadgen_thread, NULL, loadgen_main, NULL) != 0) {
+        atomic_store(&loadgen_running, 0);
+        LOG_ERROR("Cannot start load generator thread");
+        return -1;
+    }
+    return 0;
+}
+
+void loadgen_stop(void) {
+    if (atomic_load(&loadgen_running)) {
+        atomic_store(&loadgen_running, 0);
+        pthread_join(loadgen_thread, NULL);
+        log_stats();
+    }
+    for (size_t i = 0; i < n_sims; i++) {
+        close(sims[i].input_peer);
+        close(sims[i].output_peer);
+    }
+    free(sims);
+    sims = NULL;
+    n_sims = 0;
+}
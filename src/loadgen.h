@@ -0,0 +1,31 @@
+#ifndef _GLOADGEN_H_
+#define _GLOADGEN_H_
+
+#include <stddef.h>
+
+#include "emulator.h"
+
+/*
+ * Simulated Wiimotes for load testing. Every controller is a pair of
+ * SOCK_SEQPACKET socketpairs standing in for its hidraw node and its
+ * uinput device. A background thread runs a protocol emulator per
+ * controller, streams data reports at the requested rate and measures
+ * how long the translated events take to come back.
+ */
+typedef struct {
+    size_t controllers;
+    unsigned int rate_hz;
+    unsigned int reply_delay_us; // added to every 0x20/0x21/0x22 reply
+    unsigned int reply_loss_pct; // replies lost on the way, like on a
+                                 // congested Bluetooth link
+    unsigned int hotswap_ms;     // cycle the extension this often, 0 = off
+    enum emu_extension extension; // plugged in at connect
+} loadgen_config_t;
+
+int loadgen_init(const loadgen_config_t *config);
+int loadgen_input_fd(size_t index);
+int loadgen_output_fd(int input_fd);
+int loadgen_start(void);
+void loadgen_stop(void);
+
+#endif // _GLOADGEN_H_
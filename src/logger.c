@@ -1,65 +1,215 @@
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "logger.h"
+#include "realtime.h"
 
-#define MAX_MODULES 10
-#define MODULE_NAME_LEN 20
-static char enabled_modules[MAX_MODULES][MODULE_NAME_LEN];
+unsigned int log_enabled_modules = 0;
 
-static int is_module_enabled(const char* module) {
-    for (int i = 0; i < MAX_MODULES; i++) {
-        if (strcmp(enabled_modules[i], module) == 0) {
-            return 1;
-        }
+static const char *const level_names[] = {
+    [LOG_LVL_DEBUG] = "DEBUG",
+    [LOG_LVL_INFO] = "INFO",
+    [LOG_LVL_WARN] = "WARN",
+    [LOG_LVL_ERROR] = "ERROR",
+};
+
+void enable_module(unsigned int module) {
+    log_enabled_modules |= module;
+}
+
+void disable_module(unsigned int module) {
+    log_enabled_modules &= ~module;
+}
+
+static const char *level_name(unsigned int module) {
+    return level_names[__builtin_ctz(module | LOG_LEVEL_ERROR)];
+}
+
+// localtime_r() only runs when the second changes
+static const char *format_time(time_t now) {
+    static _Thread_local time_t cached_sec = -1;
+    static _Thread_local char time_str[20];
+    if (now != cached_sec) {
+        struct tm t;
+        localtime_r(&now, &t);
+        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &t);
+        cached_sec = now;
     }
-    return 0;
+    return time_str;
 }
 
-void enable_module(const char* module) {
-    // prevent duplicates
-    if (is_module_enabled(module)) {
-        return;
+// one fputs per line so concurrent writers don't interleave
+static void write_line(unsigned int module, time_t when, const char *msg) {
+    rt_check(RT_VIOLATION_STDIO);
+    char line[512];
+    if (module == LOG_LEVEL_ERROR) {
+        snprintf(line, sizeof(line), "\033[1;31m[%s] [%s] %s\n\033[0m",
+                format_time(when), level_name(module), msg);
+        fputs(line, stderr);
+    } else {
+        snprintf(line, sizeof(line), "[%s] [%s] %s\n",
+                format_time(when), level_name(module), msg);
+        fputs(line, stdout);
+    }
+}
+
+void log_message(unsigned int module, const char* format, ...) {
+    char msg[384];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(msg, sizeof(msg), format, args);
+    va_end(args);
+    write_line(module, time(NULL), msg);
+}
+
+// Asynchronous binary log
+
+typedef struct {
+    _Atomic size_t seq;
+    unsigned int module;
+    time_t when;
+    const char *format;
+    long long args[LOG_ASYNC_ARGS];
+    size_t len;
+    uint8_t data[LOG_ASYNC_DATA];
+} log_record_t;
+
+// bounded MPSC ring with per-slot sequence numbers
+#define LOG_RING_SIZE 256
+static log_record_t log_ring[LOG_RING_SIZE];
+static _Atomic size_t log_ring_head;
+static size_t log_ring_tail;
+static _Atomic size_t log_dropped;
+
+static pthread_t flusher_thread;
+static atomic_int flusher_running = 0;
+
+static void format_record(const log_record_t *rec) {
+    char msg[384];
+    size_t off;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+    int n = snprintf(msg, sizeof(msg), rec->format,
+            rec->args[0], rec->args[1], rec->args[2], rec->args[3]);
+#pragma GCC diagnostic pop
+    off = n < 0 ? 0 : (size_t)n;
+    for (size_t i = 0; i < rec->len && off + 4 < sizeof(msg); i++) {
+        off += (size_t)snprintf(msg + off, sizeof(msg) - off,
+                " %02x", rec->data[i]);
     }
-    for (int i = 0; i < MAX_MODULES; i++) {
-        if (enabled_modules[i][0] == '\0') {
-            strncpy(enabled_modules[i], module, MODULE_NAME_LEN - 1);
-            enabled_modules[i][MODULE_NAME_LEN - 1] = '\0';
+    write_line(rec->module, rec->when, msg);
+}
+
+static int drain_ring(void) {
+    int drained = 0;
+    for (;;) {
+        log_record_t *rec = &log_ring[log_ring_tail % LOG_RING_SIZE];
+        size_t seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+        if (seq != log_ring_tail + 1) {
             break;
         }
+        format_record(rec);
+        atomic_store_explicit(&rec->seq, log_ring_tail + LOG_RING_SIZE,
+                memory_order_release);
+        log_ring_tail++;
+        drained++;
     }
+    size_t dropped = atomic_exchange(&log_dropped, 0);
+    if (dropped > 0) {
+        log_message(LOG_LEVEL_WARN, "Log ring full, dropped %zu records",
+                dropped);
+    }
+    return drained;
 }
 
-void disable_module(const char* module) {
-    for (int i = 0; i < MAX_MODULES; i++) {
-        if (strcmp(enabled_modules[i], module) == 0) {
-            enabled_modules[i][0] = '\0';
-            break;
+static void *flusher_main(void *arg) {
+    (void)arg;
+    while (atomic_load(&flusher_running)) {
+        if (drain_ring() > 0) {
+            fflush(stdout);
+        } else {
+            usleep(5000);
         }
     }
+    drain_ring();
+    fflush(stdout);
+    return NULL;
 }
 
-void log_message(const char* module, const char* format, ...) {
-    if (!is_module_enabled(module)) {
+void log_binary(
+        unsigned int module,
+        const uint8_t *data,
+        size_t len,
+        const char *format,
+        const long long args[LOG_ASYNC_ARGS]) {
+    if (len > LOG_ASYNC_DATA) {
+        len = LOG_ASYNC_DATA;
+    }
+    if (!atomic_load_explicit(&flusher_running, memory_order_relaxed)) {
+        log_record_t rec = {
+            .module = module, .when = time(NULL),
+            .format = format, .len = len,
+        };
+        memcpy(rec.args, args, sizeof(rec.args));
+        if (len > 0) {
+            memcpy(rec.data, data, len);
+        }
+        format_record(&rec);
         return;
     }
-    va_list args;
-    va_start(args, format);
-    time_t now = time(NULL);
-    struct tm* t = localtime(&now);
-    char time_str[20];
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", t);
-    if (strcmp(module, LOG_LEVEL_ERROR) == 0) {
-        fprintf(stderr, "\033[1;31m"); // Red color for errors
-        fprintf(stderr, "[%s] [%s] ", time_str, module);
-        vfprintf(stderr, format, args);
-        fprintf(stderr, "\n\033[0m"); // Reset color
-    } else {
-        printf("[%s] [%s] ", time_str, module);
-        vprintf(format, args);
-        printf("\n");
+    size_t pos = atomic_load_explicit(&log_ring_head, memory_order_relaxed);
+    log_record_t *rec;
+    for (;;) {
+        rec = &log_ring[pos % LOG_RING_SIZE];
+        size_t seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &log_ring_head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (seq < pos) {
+            atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&log_ring_head, memory_order_relaxed);
+        }
     }
-    va_end(args);
+    rec->module = module;
+    rec->when = time(NULL);
+    rec->format = format;
+    memcpy(rec->args, args, sizeof(rec->args));
+    rec->len = len;
+    if (len > 0) {
+        memcpy(rec->data, data, len);
+    }
+    atomic_store_explicit(&rec->seq, pos + 1, memory_order_release);
+}
+
+int log_start_flusher(void) {
+    for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+        atomic_init(&log_ring[i].seq, i);
+    }
+    atomic_store(&log_ring_head, 0);
+    log_ring_tail = 0;
+    atomic_store(&flusher_running, 1);
+    if (pthread_create(&flusher_thread, NULL, flusher_main, NULL) != 0) {
+        atomic_store(&flusher_running, 0);
+        LOG_ERROR("Cannot start log flusher thread, logging synchronously");
+        return -1;
+    }
+    return 0;
+}
+
+void log_stop_flusher(void) {
+    if (!atomic_load(&flusher_running)) {
+        return;
+    }
+    atomic_store(&flusher_running, 0);
+    pthread_join(flusher_thread, NULL);
 }
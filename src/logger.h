@@ -1,21 +1,73 @@
 #ifndef _GLOGGER_H_
 #define _GLOGGER_H_
 
-#define LOG_LEVEL_DEBUG "DEBUG"
-#define LOG_LEVEL_INFO "INFO"
-#define LOG_LEVEL_WARN "WARN"
-#define LOG_LEVEL_ERROR "ERROR"
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOG_LVL_DEBUG 0
+#define LOG_LVL_INFO 1
+#define LOG_LVL_WARN 2
+#define LOG_LVL_ERROR 3
+
+// bits for enable_module()/disable_module()
+#define LOG_LEVEL_DEBUG (1u << LOG_LVL_DEBUG)
+#define LOG_LEVEL_INFO (1u << LOG_LVL_INFO)
+#define LOG_LEVEL_WARN (1u << LOG_LVL_WARN)
+#define LOG_LEVEL_ERROR (1u << LOG_LVL_ERROR)
+
+// levels below this are compiled out entirely (make LOG_LEVEL=1)
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LVL_DEBUG
+#endif
+
+extern unsigned int log_enabled_modules;
+
+#define LOG_IF(lvl, call) do { \
+    if ((lvl) >= LOG_COMPILE_LEVEL \
+        && (log_enabled_modules & (1u << (lvl)))) { \
+        call; \
+    } \
+} while (0)
 
 #define LOG_DEBUG(format, ...) \
-    log_message(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+    LOG_IF(LOG_LVL_DEBUG, \
+        log_message(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__))
 #define LOG_INFO(format, ...) \
-    log_message(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+    LOG_IF(LOG_LVL_INFO, \
+        log_message(LOG_LEVEL_INFO, format, ##__VA_ARGS__))
 #define LOG_WARN(format, ...) \
-    log_message(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+    LOG_IF(LOG_LVL_WARN, \
+        log_message(LOG_LEVEL_WARN, format, ##__VA_ARGS__))
 #define LOG_ERROR(format, ...) \
-    log_message(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+    LOG_IF(LOG_LVL_ERROR, \
+        log_message(LOG_LEVEL_ERROR, format, ##__VA_ARGS__))
+
+/*
+ * Hot path logging: only the format pointer, up to LOG_ASYNC_ARGS integer
+ * arguments and up to LOG_ASYNC_DATA raw bytes are copied into a lock-free
+ * ring; the flusher thread formats them later. The format must be a string
+ * literal using only long long conversions (%lld, %llx, ...), the bytes
+ * are appended as a hex dump.
+ */
+#define LOG_ASYNC_ARGS 4
+#define LOG_ASYNC_DATA 64
+#define LOG_DEBUG_HEX(data, len, format, ...) \
+    LOG_IF(LOG_LVL_DEBUG, \
+        log_binary(LOG_LEVEL_DEBUG, data, len, format, \
+            (const long long[LOG_ASYNC_ARGS]){__VA_ARGS__}))
+#define LOG_DEBUG_ASYNC(format, ...) \
+    LOG_DEBUG_HEX(NULL, 0, format, ##__VA_ARGS__)
 
-void enable_module(const char *module);
-void disable_module(const char *module);
-void log_message(const char *module, const char *format, ...);
+void enable_module(unsigned int module);
+void disable_module(unsigned int module);
+void log_message(unsigned int module, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+void log_binary(
+        unsigned int module,
+        const uint8_t *data,
+        size_t len,
+        const char *format,
+        const long long args[LOG_ASYNC_ARGS]);
+int log_start_flusher(void);
+void log_stop_flusher(void);
 #endif
@@ -1,11 +1,24 @@
 #include "spoofer.h"
 #include "wiimote.h"
 #include "logger.h"
+#include "latency.h"
+#include "capture.h"
+#include "backend.h"
+#include "loadgen.h"
+#include "pool.h"
+#include "device.h"
+#include "worker.h"
+#include "uring.h"
+#include "realtime.h"
+#include "busypoll.h"
+#include "calib.h"
+#include "ir.h"
 
 #include <argp.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
@@ -15,7 +28,10 @@
 #include <libudev.h>
 #include <sys/epoll.h>
 
-#define MAX_WIIMOTES 4
+#define MAX_EVENTS 64
+#define POOL_SLAB_SIZE 4
+// one Bluetooth adapter serves at most 7 devices
+#define RT_RESERVED_WIIMOTES 8
 
 #define UNUSED(x) (void)(x)
 static volatile int keep_running = 1;
@@ -24,14 +40,132 @@ void sigint_handler(int _) {
     keep_running = 0;
 }
 
+static volatile sig_atomic_t dump_latency = 0;
+void sigusr1_handler(int _) {
+    UNUSED(_);
+    dump_latency = 1;
+}
+
+static const char *record_path = NULL;
+static const char *replay_path = NULL;
+static int replay_paced = 0;
+static loadgen_config_t sim_config = {.rate_hz = 100};
+static size_t n_workers = 0;
+static int use_uring = 0;
+static uring_engine_t ring = {.fd = -1};
+static int realtime = 0;
+static unsigned long busy_window_us = 0;
+#define NO_DEADZONE ((unsigned long)-1)
+static unsigned long deadzone = NO_DEADZONE;
+static busypoll_t busypoll;
+static rt_config_t rt_config = {.priority = RT_DEFAULT_PRIORITY, .cpu = -1};
+
 static int parse_opt(int key, char *arg, struct argp_state *state) {
-    UNUSED(arg);
-    UNUSED(state);
     switch (key) {
         case 'v':
             enable_module(LOG_LEVEL_DEBUG);
             break;
+        case 'r':
+            record_path = arg;
+            break;
+        case 'p':
+            replay_path = arg;
+            break;
+        case 'P':
+            replay_paced = 1;
+            break;
+        case 's':
+            sim_config.controllers = strtoul(arg, NULL, 10);
+            break;
+        case 'R':
+            sim_config.rate_hz = (unsigned int)strtoul(arg, NULL, 10);
+            break;
+        case 'D':
+            sim_config.reply_delay_us = (unsigned int)strtoul(arg, NULL, 10);
+            break;
+        case 'L':
+            sim_config.reply_loss_pct = (unsigned int)strtoul(arg, NULL, 10);
+            break;
+        case 'H':
+            sim_config.hotswap_ms = (unsigned int)strtoul(arg, NULL, 10);
+            break;
+        case 'w':
+            n_workers = strtoul(arg, NULL, 10);
+            break;
+        case 'E':
+            if (strcmp(arg, "nunchuck") == 0) {
+                sim_config.extension = EMU_EXT_NUNCHUCK;
+            } else if (strcmp(arg, "classic") == 0) {
+                sim_config.extension = EMU_EXT_CLASSIC;
+            } else if (strcmp(arg, "none") == 0) {
+                sim_config.extension = EMU_EXT_NONE;
+            } else {
+                argp_error(state, "unknown extension '%s'", arg);
+            }
+            break;
+        case 'u':
+            use_uring = 1;
+            break;
+        case 'T':
+            realtime = 1;
+            if (arg != NULL) {
+                rt_config.priority = (int)strtol(arg, NULL, 10);
+            }
+            break;
+        case 'b':
+            busy_window_us = strtoul(arg, NULL, 10);
+            break;
+        case 'c':
+            rt_config.cpu = (int)strtol(arg, NULL, 10);
+            break;
+        case 'q':
+            device_queue_depth = strtoul(arg, NULL, 10);
+            break;
+        case 'f':
+            if (calib_select_profile(arg) < 0) {
+                argp_error(state, "unknown profile '%s'", arg);
+            }
+            break;
+        case 'a':
+            device_features |= WII_FEAT_ACCEL;
+            if (arg != NULL) {
+                motion_threshold = (int32_t)strtol(arg, NULL, 10);
+                if (motion_threshold < 1) {
+                    argp_error(state, "accelerometer threshold must be "
+                            "at least 1");
+                }
+            }
+            break;
+        case 'i':
+            device_features |= WII_FEAT_IR;
+            break;
+        case 'F':
+            device_features |= WII_FEAT_IR | WII_FEAT_IR_FULL;
+            break;
+        case 'm':
+            device_features |= WII_FEAT_ACCEL | WII_FEAT_MOTIONPLUS;
+            motion_orientation = 1;
+            break;
+        case 'I':
+            if (ir_filter_parse(arg) < 0) {
+                argp_error(state, "IR filter must be MINCUTOFF,BETA or off");
+            }
+            break;
+        case 'z':
+            deadzone = strtoul(arg, NULL, 10);
+            if (deadzone > 90) {
+                argp_error(state, "deadzone must be at most 90%%");
+            }
+            break;
         case ARGP_KEY_END:
+            if (use_uring + (n_workers > 0) + (busy_window_us > 0) > 1) {
+                argp_error(state,
+                        "--io-uring, --workers and --busy-poll are exclusive");
+            }
+            // applies on top of --profile whatever the order
+            if (deadzone != NO_DEADZONE) {
+                input_profile.deadzone = (uint8_t)deadzone;
+            }
             break;
         default:
             return ARGP_ERR_UNKNOWN;
@@ -40,6 +174,35 @@ static int parse_opt(int key, char *arg, struct argp_state *state) {
 }
 const struct argp_option options[] = {
     {0, 'v', 0, 0, "Enable verbose output"},
+    {"record", 'r', "FILE", 0, "Record raw hidraw traffic to FILE"},
+    {"replay", 'p', "FILE", 0, "Replay a recording instead of using devices"},
+    {"paced", 'P', 0, 0, "Replay at the original pace"},
+    {"simulate", 's', "N", 0, "Drive N simulated Wiimotes instead of hidraw"},
+    {"rate", 'R', "HZ", 0, "Reports per second per simulated Wiimote"},
+    {"reply-delay", 'D', "US", 0, "Delay simulated replies by US microseconds"},
+    {"reply-loss", 'L', "PCT", 0, "Lose PCT% of simulated replies"},
+    {"hotswap", 'H', "MS", 0, "Cycle simulated extensions every MS ms"},
+    {"extension", 'E', "EXT", 0, "Simulated extension: none, nunchuck, classic"},
+    {"workers", 'w', "N", 0, "Serve Wiimotes from N pinned worker threads"},
+    {"io-uring", 'u', 0, 0, "Use io_uring instead of epoll when available"},
+    {"queue-depth", 'q', "N", 0, "Initial output command queue depth"},
+    {"profile", 'f', "NAME", 0, "Analog profile: default, precise, raw"},
+    {"deadzone", 'z', "PCT", 0, "Stick deadzone, overrides the profile's"},
+    {"accel", 'a', "STEP", OPTION_ARG_OPTIONAL,
+        "Report accelerometers on a motion device, in steps of STEP/256 g"},
+    {"ir", 'i', 0, 0, "Report the IR camera pointer on a pointer device"},
+    {"ir-full", 'F', 0, 0,
+        "Like --ir, with full IR data over interleaved reports when no "
+        "extension is attached"},
+    {"ir-filter", 'I', "MINCUTOFF,BETA", 0,
+        "IR pointer One-Euro filter in Hz and Hz per px/s, or off"},
+    {"motionplus", 'm', 0, 0,
+        "Like --accel, with the MotionPlus orientation on the motion device"},
+    {"realtime", 'T', "PRIO", OPTION_ARG_OPTIONAL,
+        "Run the event loop as SCHED_FIFO PRIO (default 50), locked in memory"},
+    {"cpu", 'c', "CPU", 0, "Pin the real-time event loop to CPU"},
+    {"busy-poll", 'b', "US", 0,
+        "Spin for up to US microseconds around each expected report"},
     {0}
 };
 const char *argp_program_version =
@@ -50,25 +213,19 @@ static inline int is_wiimote(struct hidraw_devinfo *info) {
                 info->product == 0x0306 || info->product == 0x0330));
 }
 
-typedef struct {
-    int hidraw_fd;
-    int uinput_fd;
-    uint8_t hid_writable;
-    char dev_path[256];
-    int8_t active;
-    wiimote_state_t state;
-    msg_queue_t msg_queue;
-} wiimote_context_t;
-
-void cleanup_wiimote_context(wiimote_context_t *ctx);
+int attach_wiimote(int fd,
+        const char *name,
+        const char *bdaddr,
+        int epoll_fd,
+        pool_t *wiimotes);
 int register_wiimote_device(struct udev_device *dev,
         int epoll_fd,
-        wiimote_context_t *wiimotes);
+        pool_t *wiimotes);
 int setup_udev_monitor(struct udev **udev_out,
         struct udev_monitor **mon_out);
 int init_connected_wiimotes(struct udev *udev,
         int epoll_fd,
-        wiimote_context_t *wiimote_contexts);
+        pool_t *wiimotes);
 
 int main(int argc, char *argv[]) {
     const struct argp arguments = {
@@ -81,12 +238,28 @@ int main(int argc, char *argv[]) {
     enable_module(LOG_LEVEL_INFO);
     enable_module(LOG_LEVEL_WARN);
     enable_module(LOG_LEVEL_ERROR);
+    log_start_flusher();
+
+    int ret = 0, mon_fd = -1, epoll_fd;
+    struct udev *udev = NULL;
+    struct udev_monitor *mon = NULL;
+    struct epoll_event ev, events[MAX_EVENTS];
+    pool_t wiimotes;
+    pool_init(&wiimotes, sizeof(wiimote_context_t), POOL_SLAB_SIZE);
+
+    if (replay_path != NULL) {
+        ret = replay_capture(replay_path, replay_paced) < 0;
+        goto failed;
+    }
 
-    int ret = 0, mon_fd, epoll_fd;
-    struct udev *udev;
-    struct udev_monitor *mon;
-    struct epoll_event ev, events[10];
-    wiimote_context_t wiimote_contexts[MAX_WIIMOTES] = {0};
+    if (sim_config.controllers > 0) {
+        device_backend = &sim_backend;
+        if (loadgen_init(&sim_config) < 0) {
+            ret = 1;
+            goto failed;
+        }
+        goto setup_epoll;
+    }
 
     if (access("/dev/uinput", F_OK) < 0) {
         LOG_ERROR("/dev/uinput not found. Is uinput module loaded?");
@@ -107,42 +280,111 @@ int main(int argc, char *argv[]) {
     mon_fd = udev_monitor_get_fd(mon);
     if (mon_fd < 0) {
         LOG_ERROR("Cannot get udev monitor file descriptor.");
-        udev_monitor_unref(mon);
-        udev_unref(udev);
         ret = 1;
         goto failed_udev_monitor;
     }
 
+setup_epoll:
     epoll_fd = epoll_create1(0);
     if (epoll_fd < 0) {
         perror("epoll_create1");
-        udev_monitor_unref(mon);
-        udev_unref(udev);
         ret = 1;
         goto failed_udev_monitor;
     }
     LOG_INFO("Epoll instance created.");
 
-    ev.events = EPOLLIN;
-    ev.data.fd = mon_fd;
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mon_fd, &ev) < 0) {
-        perror("epoll_ctl: udev monitor");
+    if (mon_fd >= 0) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL; // everything else carries its context
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mon_fd, &ev) < 0) {
+            perror("epoll_ctl: udev monitor");
+            ret = 1;
+            goto failed_epoll;
+        }
+        LOG_INFO("Udev monitor added to epoll.");
+    }
+
+    if (record_path != NULL && capture_open(record_path) < 0) {
         ret = 1;
         goto failed_epoll;
     }
-    LOG_INFO("Udev monitor added to epoll.");
 
-    init_connected_wiimotes(udev, epoll_fd, wiimote_contexts);
+    if (use_uring) {
+        if (uring_init(&ring) < 0 || uring_poll_fd(&ring, epoll_fd) < 0) {
+            LOG_WARN("Falling back to epoll.");
+            uring_destroy(&ring);
+            use_uring = 0;
+        }
+    }
+
+    if (realtime) {
+        size_t reserved = sim_config.controllers > 0
+            ? sim_config.controllers : RT_RESERVED_WIIMOTES;
+        if (pool_reserve(&wiimotes, reserved) < 0) {
+            LOG_WARN("Cannot reserve %zu Wiimote contexts", reserved);
+        }
+        // workers and the load generator inherit the policy
+        rt_enter(&rt_config);
+    }
+
+    if (n_workers > 0 && workers_start(n_workers, &wiimotes) < 0) {
+        workers_stop();
+        ret = 1;
+        goto failed_engine;
+    }
+
+    if (sim_config.controllers > 0) {
+        for (size_t k = 0; k < sim_config.controllers; k++) {
+            char name[32];
+            int fd = loadgen_input_fd(k);
+            snprintf(name, sizeof(name), "sim%zu", k);
+            if (attach_wiimote(fd, name, name, epoll_fd, &wiimotes) < 0) {
+                LOG_WARN("Simulated Wiimote %zu not attached", k);
+            }
+        }
+        loadgen_start();
+    } else {
+        init_connected_wiimotes(udev, epoll_fd, &wiimotes);
+    }
 
+    busypoll_init(&busypoll, busy_window_us * 1000);
     signal(SIGINT, sigint_handler);
+    signal(SIGUSR1, sigusr1_handler);
     int n_events, i;
-    uint8_t event_buffer[64];
     while (keep_running) {
-        n_events = epoll_wait(epoll_fd, events, 10, 30000);
+        if (use_uring) {
+            n_events = uring_run(&ring, &wiimotes);
+            if (n_events > 0) {
+                // the udev monitor is ready, collect it through epoll
+                uring_poll_fd(&ring, epoll_fd);
+                n_events = epoll_wait(epoll_fd, events, MAX_EVENTS, 0);
+            }
+        } else if (busy_window_us > 0) {
+            n_events = busypoll_wait(&busypoll, &wiimotes,
+                    epoll_fd, events, MAX_EVENTS);
+        } else {
+            n_events = epoll_wait(epoll_fd, events, MAX_EVENTS, 30000);
+        }
         // LOG_DEBUG("Epoll wait returned %d events.", n_events);
-        if (n_events < 0) {
-            LOG_ERROR("epoll_wait failed. (errno=%d)", errno);
-            perror("epoll_wait");
+        if (dump_latency) {
+            dump_latency = 0;
+            if (n_workers > 0) {
+                workers_dump_latencies();
+            } else {
+                dump_wiimote_latencies(&wiimotes);
+            }
+            if (realtime) {
+                rt_report();
+            }
+            if (busy_window_us > 0) {
+                busypoll_dump(&busypoll);
+            }
+        }
+        if (n_events < 0 && errno == EINTR) {
+            continue;
+        } else if (n_events < 0) {
+            LOG_ERROR("%s failed. (errno=%d)",
+                    use_uring ? "io_uring_enter" : "epoll_wait", errno);
             ret = 1;
             break;
         } else if (n_events == 0) {
@@ -150,137 +392,90 @@ int main(int argc, char *argv[]) {
         }
 
         for (i=0; i<n_events; i++) {
-            if (events[i].data.fd == mon_fd) { // udev monitor loop
+            if (events[i].data.ptr == NULL) { // udev monitor loop
                 LOG_DEBUG("Udev monitor event detected.");
                 register_wiimote_device(
                     udev_monitor_receive_device(mon),
                     epoll_fd,
-                    wiimote_contexts);
+                    &wiimotes);
             } else { // wiimote loop
-                int ev_fd = events[i].data.fd;
-                wiimote_context_t *wm = NULL;
-                for (int j=0; j<MAX_WIIMOTES; j++) {
-                    if (wiimote_contexts[j].active
-                        && wiimote_contexts[j].hidraw_fd == ev_fd) {
-                        wm = wiimote_contexts+j;
-                        break;
-                    }
-                }
-                if (wm == NULL) {
-                    LOG_ERROR("Unknown wiimote fd %d", ev_fd);
-                    continue;
-                }
-
-                if (events[i].events & EPOLLOUT) {
-                    LOG_DEBUG("Wiimote fd %d ready for writing.", wm->hidraw_fd);
-                    wm->hid_writable = 1;
-                }
-                while (wm->hid_writable
-                       && wm->msg_queue.count > 0) {
-                    const msg_t *msg = &wm->msg_queue.msgs[wm->msg_queue.head];
-                    ssize_t w_bytes = write(
-                            wm->hidraw_fd,
-                            msg->buf, msg->len);
-                    if (w_bytes < 0) {
-                        if (errno != EAGAIN) {
-                            LOG_ERROR("Failed to write wiimote event %d", errno);
-                        } else if (errno == EAGAIN) {
-                            LOG_DEBUG(
-                                    "Wiimote fd %d not ready for writing.",
-                                    wm->hidraw_fd);
-                            wm->hid_writable = 0;
-                        }
-                    } else {
-                        LOG_DEBUG("Wrote %zd bytes to wiimote fd %d",
-                                w_bytes, wm->hidraw_fd);
-                        pop_msg(&wm->msg_queue, NULL);
-                    }
-                }
-
-                ssize_t r_bytes = 1;
-                if (events[i].events & EPOLLIN)
-                    LOG_DEBUG("Wiimote fd %d ready for reading.", wm->hidraw_fd);
-                while (r_bytes > 0 && (events[i].events & EPOLLIN)) {
-                    r_bytes = read(
-                            wm->hidraw_fd,
-                            event_buffer, sizeof(event_buffer));
-                    char buf_hex[3*64] = {0};
-                    for (ssize_t k=0; k<r_bytes; k++) {
-                        sprintf(&buf_hex[k*3], "%02x ", event_buffer[k]);
-                    }
-                    LOG_DEBUG("Read %zd bytes from wiimote fd %d: %s",
-                            r_bytes, wm->hidraw_fd, buf_hex);
-                    if (handle_wiimote_event(
-                            &wm->msg_queue,
-                            &wm->state,
-                            event_buffer) < 0) {
-                        LOG_ERROR("Failed to handle wiimote event.");
-                        continue;
-                    }
-                    wiimote_to_uinput(&wm->state, wm->uinput_fd);
-                }
-                if (r_bytes < 0) {
-                    if (events[i].events & (EPOLLERR | EPOLLHUP)) {
-                        LOG_ERROR(
-                                "epoll wiimote error detected, disconnecting.");
-                        LOG_INFO(
-                                "Wiimote disconnected (read %d bytes).",
-                                r_bytes);
-                        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, wm->hidraw_fd, NULL);
-                        cleanup_wiimote_context(wm);
-                    } else if (errno != EAGAIN) {
-                        LOG_ERROR("Failed to read wiimote event %d", errno);
-                    } else if (errno == EAGAIN) {
-                        // LOG_DEBUG(
-                        //         "No more data to read from wiimote fd %d",
-                        //         wm->hidraw_fd);
-                    }
-                } else if (r_bytes == 0) {
-                    LOG_ERROR("unhandled: read 0 bytes from wiimote fd %d",
-                            wm->hidraw_fd);
-                }
-
-                struct input_event ff_ev;
-                while (read(wm->uinput_fd, &ff_ev, sizeof(ff_ev)) > 0) {
-                    LOG_DEBUG("Read event from uinput fd %d: "
-                            "type=%hu code=%hu value=%d",
-                            wm->uinput_fd,
-                            ff_ev.type, ff_ev.code, ff_ev.value);
+                wiimote_context_t *gone = serve_wiimote_event(
+                        events[i].data.ptr, events[i].events, epoll_fd);
+                if (gone != NULL) {
+                    release_wiimote_context(&wiimotes, gone);
                 }
             }
         }
     }
 
+    if (n_workers > 0) {
+        workers_stop();
+    } else {
+        dump_wiimote_latencies(&wiimotes);
+    }
+    if (realtime) {
+        rt_report();
+    }
+    if (busy_window_us > 0) {
+        busypoll_dump(&busypoll);
+    }
+failed_engine:
+    uring_destroy(&ring);
+    capture_close();
 failed_epoll:
     close(epoll_fd);
 failed_udev_monitor:
-    udev_monitor_unref(mon);
+    if (mon != NULL) {
+        udev_monitor_unref(mon);
+    }
 // failed_udev:
-    udev_unref(udev);
+    if (udev != NULL) {
+        udev_unref(udev);
+    }
 failed:
+    pool_destroy(&wiimotes);
+    if (sim_config.controllers > 0) {
+        loadgen_stop();
+    }
+    log_stop_flusher();
     return ret;
 }
 
-void cleanup_wiimote_context(wiimote_context_t *ctx) {
-    if (ctx->hidraw_fd >= 0) {
-        close(ctx->hidraw_fd);
-        ctx->hidraw_fd = -1;
+/*
+ * Takes ownership of fd: it is closed if the Wiimote cannot be attached.
+ */
+int attach_wiimote(int fd,
+        const char *name,
+        const char *bdaddr,
+        int epoll_fd,
+        pool_t *wiimotes) {
+    wiimote_context_t *wm = create_wiimote_context(
+            wiimotes, fd, name, bdaddr);
+    if (wm == NULL) {
+        device_backend->close(fd);
+        return -1;
     }
-    if (ctx->uinput_fd >= 0) {
-        destroy_uinput_device(ctx->uinput_fd);
-        ctx->uinput_fd = -1;
+    if (workers_count() > 0) {
+        if (workers_assign(wm) < 0) {
+            release_wiimote_context(wiimotes, wm);
+            return -1;
+        }
+    } else if (use_uring) {
+        if (uring_watch(&ring, wm) < 0) {
+            release_wiimote_context(wiimotes, wm);
+            return -1;
+        }
+    } else if (watch_wiimote(wm, epoll_fd) < 0) {
+        release_wiimote_context(wiimotes, wm);
+        return -1;
     }
-    ctx->active = 0;
-    ctx->hid_writable = 0;
-    memset(&ctx->state, 0, sizeof(wiimote_state_t));
-    memset(ctx->dev_path, 0, sizeof(ctx->dev_path));
+    return 0;
 }
 
 int register_wiimote_device(struct udev_device *dev,
         int epoll_fd,
-        wiimote_context_t *wiimotes) {
+        pool_t *wiimotes) {
     int ret = 0;
-    struct epoll_event ev;
     struct hidraw_devinfo info;
     const char *action = udev_device_get_action(dev);
     const char *devnode = udev_device_get_devnode(dev);
@@ -311,50 +506,15 @@ int register_wiimote_device(struct udev_device *dev,
         ret = -1;
         goto reg_wiimote_failed_wiimote;
     }
-    wiimote_context_t *wm = NULL;
-    size_t index;
-    for (index=0; index<MAX_WIIMOTES; index++) {
-        if (wiimotes[index].active == 0) {
-            wm = &wiimotes[index];
-            break;
-        }
-    }
-    if (wm == NULL) {
-        LOG_INFO("  Maximum number of connected Wiimotes reached (%d).", MAX_WIIMOTES);
-        // todo: should implement a routine to
-        // disconnect the connecting wiimote...
+    // the HID parent knows the Bluetooth address
+    struct udev_device *hid =
+        udev_device_get_parent_with_subsystem_devtype(dev, "hid", NULL);
+    const char *bdaddr = hid != NULL
+        ? udev_device_get_property_value(hid, "HID_UNIQ") : NULL;
+    if (attach_wiimote(fd, devnode, bdaddr, epoll_fd, wiimotes) < 0) {
         ret = -1;
-        goto reg_wiimote_failed_wiimote;
-    }
-    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
-    ev.data.fd = fd;
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
-        perror("epoll_ctl: wiimote device");
-        ret = -1;
-        goto reg_wiimote_failed_wiimote;
-    }
-    LOG_INFO("  Wiimote device added to epoll.");
-    wm->uinput_fd =
-        create_uinput_device();
-    if (wm->uinput_fd < 0) {
-        perror("create_uinput_device");
-        ret = -1;
-        goto reg_wiimote_failed_wiimote;
+        goto reg_wiimote_failed_dev;
     }
-    wm->state =
-        (wiimote_state_t){0};
-    wm->msg_queue = (msg_queue_t){0};
-    wm->hidraw_fd = fd;
-    wm->active = 1;
-    LOG_INFO("  Wiimote connected (fd %d)! Total connected: %d", fd, (wm-wiimotes)+1);
-    enqueue_msg(
-            &wm->msg_queue,
-            (uint8_t[]){0x11, (uint8_t)(0x10 << index)},
-            2);
-    enqueue_msg(
-            &wm->msg_queue,
-            (uint8_t[]){0x15, 0x00},
-            2);
     goto reg_wiimote_success;
 
 reg_wiimote_failed_wiimote:
@@ -387,7 +547,7 @@ int setup_udev_monitor(struct udev **udev_out,
 
 int init_connected_wiimotes(struct udev *udev,
         int epoll_fd,
-        wiimote_context_t *wiimote_contexts) {
+        pool_t *wiimotes) {
     int ret = 0;
     struct udev_enumerate *enumerate = udev_enumerate_new(udev);
     if (enumerate == NULL) {
@@ -423,7 +583,7 @@ int init_connected_wiimotes(struct udev *udev,
         LOG_INFO("Found device: %s", path);
         register_wiimote_device(dev,
             epoll_fd,
-            wiimote_contexts
+            wiimotes
         );
     }
 init_connected_wiimotes_failed:
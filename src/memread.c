@@ -0,0 +1,215 @@
+#include <string.h>
+
+#include "logger.h"
+#include "memread.h"
+
+static inline uint8_t all_chunks(const mem_read_t *rd) {
+    size_t n = ((size_t)rd->size + MEMREAD_CHUNK - 1) / MEMREAD_CHUNK;
+    return (uint8_t)((1u << n) - 1);
+}
+
+// what the reply offset can tell apart
+static inline int overlaps(const mem_read_t *a, const mem_read_t *b) {
+    uint16_t sa = (uint16_t)a->addr, sb = (uint16_t)b->addr;
+    return sa < sb + b->size && sb < sa + a->size;
+}
+
+static int issue_read(mem_reads_t *reads, msg_queue_t *msgs, mem_read_t *rd) {
+    uint8_t patch[] = {
+        rd->space,
+        (uint8_t)(rd->addr >> 16), (uint8_t)(rd->addr >> 8),
+        (uint8_t)rd->addr,
+        (uint8_t)(rd->size >> 8), (uint8_t)rd->size,
+    };
+    for (size_t i = 0; i < MEMREAD_SLOTS; i++) {
+        const mem_read_t *other = &reads->slots[i];
+        if (other != rd && other->active && other->issued
+            && overlaps(other, rd)) {
+            return 0;
+        }
+    }
+    if (enqueue_msg(msgs, CMD_READ_MEM, patch) < 0) {
+        return -1;
+    }
+    rd->issued = 1;
+    rd->seq = reads->next_seq++;
+    return 0;
+}
+
+int memread_start(
+        mem_reads_t *reads,
+        msg_queue_t *msgs,
+        uint8_t space,
+        uint32_t addr,
+        uint16_t size,
+        memread_fn done) {
+    mem_read_t *rd = NULL;
+    if (size == 0 || size > MEMREAD_MAX_SIZE) {
+        LOG_ERROR("Cannot read %hu bytes at %06x", size, addr);
+        return -1;
+    }
+    for (size_t i = 0; i < MEMREAD_SLOTS; i++) {
+        mem_read_t *slot = &reads->slots[i];
+        if (!slot->active) {
+            rd = rd != NULL ? rd : slot;
+        } else if (slot->space == space && slot->addr == addr
+                   && slot->size == size && slot->done == done) {
+            // one answer serves both
+            return 0;
+        }
+    }
+    if (rd == NULL) {
+        LOG_ERROR("Too many memory reads in flight, dropping %06x", addr);
+        return -1;
+    }
+    rd->done = done;
+    rd->addr = addr;
+    rd->size = size;
+    rd->space = space;
+    rd->issued = 0;
+    rd->chunks = 0;
+    rd->error = 0;
+    if (issue_read(reads, msgs, rd) < 0) {
+        return -1;
+    }
+    rd->active = 1;
+    return 0;
+}
+
+static void finish_read(
+        mem_reads_t *reads,
+        mem_read_t *rd,
+        msg_queue_t *msgs,
+        struct wiimote_state *state,
+        uint8_t error);
+
+// sends the reads held back behind one that ended
+static void issue_held(
+        mem_reads_t *reads,
+        msg_queue_t *msgs,
+        struct wiimote_state *state) {
+    for (size_t i = 0; i < MEMREAD_SLOTS; i++) {
+        mem_read_t *rd = &reads->slots[i];
+        if (rd->active && !rd->issued
+            && issue_read(reads, msgs, rd) < 0) {
+            finish_read(reads, rd, msgs, state, MEMREAD_ERR_TIMEOUT);
+        }
+    }
+}
+
+static void finish_read(
+        mem_reads_t *reads,
+        mem_read_t *rd,
+        msg_queue_t *msgs,
+        struct wiimote_state *state,
+        uint8_t error) {
+    mem_read_t done = *rd;
+    rd->active = 0;
+    done.active = 0;
+    done.error = error;
+    // ahead of whatever the completion reads next
+    issue_held(reads, msgs, state);
+    switch (error) {
+        case 0:
+            break;
+        case MEMREAD_ERR_WRITE_ONLY:
+            // e.g. registers of a missing extension, innocuous
+            LOG_DEBUG_ASYNC("    Attempted reading write-only memory %06llx",
+                    (long long)done.addr);
+            break;
+        case MEMREAD_ERR_NO_MEMORY:
+            LOG_ERROR("    Attempted reading nonexistent memory %06x",
+                    done.addr);
+            break;
+        case MEMREAD_ERR_TIMEOUT:
+        default:
+            LOG_WARN("    Memory read at %06x failed (%hhx)", done.addr, error);
+            break;
+    }
+    if (done.done != NULL) {
+        done.done(msgs, state, &done);
+    }
+}
+
+/*
+ * The reply only carries the low 16 address bits; only one read sent
+ * covers any offset, reads held back behind it do not count.
+ */
+static mem_read_t *match_reply(mem_reads_t *reads, uint16_t offset) {
+    mem_read_t *match = NULL;
+    for (size_t i = 0; i < MEMREAD_SLOTS; i++) {
+        mem_read_t *rd = &reads->slots[i];
+        uint16_t start = (uint16_t)rd->addr;
+        if (!rd->active || !rd->issued
+            || offset < start || offset - start >= rd->size) {
+            continue;
+        }
+        if (match == NULL || (int32_t)(rd->seq - match->seq) < 0) {
+            match = rd;
+        }
+    }
+    return match;
+}
+
+void memread_reply(
+        mem_reads_t *reads,
+        msg_queue_t *msgs,
+        struct wiimote_state *state,
+        const uint8_t *buf) {
+    uint8_t error = buf[3] & 0x0f;
+    uint8_t size = (uint8_t)((buf[3] >> 4) + 1);
+    uint16_t offset = (uint16_t)(buf[4] << 8 | buf[5]);
+    LOG_DEBUG_ASYNC("    Read reply: size=%llx offset=%04llx errors=%llx",
+            (long long)size, (long long)offset, (long long)error);
+    mem_read_t *rd = match_reply(reads, offset);
+    if (rd == NULL) {
+        // a late duplicate of a retried read, it still answers one
+        LOG_DEBUG_ASYNC("Unexpected read reply at %04llx",
+                (long long)offset);
+        msg_replied(msgs, READ_MEMREG_REQUEST);
+        return;
+    }
+    if (error != 0) {
+        msg_replied(msgs, READ_MEMREG_REQUEST);
+        finish_read(reads, rd, msgs, state, error);
+        return;
+    }
+    size_t at = (size_t)(offset - (uint16_t)rd->addr);
+    uint8_t bit = (uint8_t)(1u << (at / MEMREAD_CHUNK));
+    if (at + size > rd->size) {
+        size = (uint8_t)(rd->size - at);
+    }
+    if (rd->chunks & bit) {
+        // answer to a resent read, only its last chunk completes anything
+        LOG_DEBUG_ASYNC("Duplicate read reply at %04llx",
+                (long long)offset);
+        if (at + size == rd->size) {
+            msg_replied(msgs, READ_MEMREG_REQUEST);
+        }
+        return;
+    }
+    memcpy(rd->data + at, buf + 6, size);
+    rd->chunks |= bit;
+    if (rd->chunks == all_chunks(rd)) {
+        msg_replied(msgs, READ_MEMREG_REQUEST);
+        finish_read(reads, rd, msgs, state, 0);
+    }
+}
+
+// the queue gave up on a read: it was the oldest one still running
+void memread_abort_oldest(
+        mem_reads_t *reads,
+        msg_queue_t *msgs,
+        struct wiimote_state *state) {
+    mem_read_t *oldest = NULL;
+    for (size_t i = 0; i < MEMREAD_SLOTS; i++) {
+        mem_read_t *rd = &reads->slots[i];
+        if (rd->active && rd->issued
+            && (oldest == NULL || (int32_t)(rd->seq - oldest->seq) < 0)) {
+            oldest = rd;
+        }
+    }
+    if (oldest != NULL) {
+        finish_read(reads, oldest, msgs, state, MEMREAD_ERR_TIMEOUT);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef _GMEMREAD_H_
+#define _GMEMREAD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "queue.h"
+
+/*
+ * Asynchronous reads of Wiimote memory. The Wiimote answers a read with
+ * one 0x21 report per 16 bytes, each carrying its offset; chunks are put
+ * in place by offset, so a retried read simply fills in what is missing.
+ * A read ends when all chunks arrived or on the first error nibble, and
+ * then calls its completion with the data or the error. Up to
+ * MEMREAD_SLOTS reads run at once. The reply only tells the low 16
+ * address bits, so a read overlapping one in flight there, say 0xa600fa
+ * and 0xa400fa, is held back until that one ended.
+ */
+#define MEMREAD_SLOTS 4
+#define MEMREAD_MAX_SIZE 64
+#define MEMREAD_CHUNK 16
+
+// address spaces
+#define MEMREAD_EEPROM   0x00
+#define MEMREAD_REGISTER 0x04
+
+// error nibbles of the reply, plus ours for a read nobody answered
+#define MEMREAD_ERR_WRITE_ONLY 0x07
+#define MEMREAD_ERR_NO_MEMORY  0x08
+#define MEMREAD_ERR_TIMEOUT    0xff
+
+struct wiimote_state;
+struct mem_read;
+typedef void (*memread_fn)(
+        msg_queue_t *msgs,
+        struct wiimote_state *state,
+        const struct mem_read *rd);
+
+typedef struct mem_read {
+    memread_fn done;
+    uint32_t addr;
+    uint16_t size;
+    uint8_t space;
+    uint8_t active;
+    uint8_t issued;   // 0 while held back behind an overlapping read
+    uint8_t chunks;   // bit n set once chunk n arrived
+    uint8_t error;
+    uint32_t seq;     // issue order, replies come back in it
+    uint8_t data[MEMREAD_MAX_SIZE];
+} mem_read_t;
+
+typedef struct {
+    mem_read_t slots[MEMREAD_SLOTS];
+    uint32_t next_seq;
+} mem_reads_t;
+
+int memread_start(
+        mem_reads_t *reads,
+        msg_queue_t *msgs,
+        uint8_t space,
+        uint32_t addr,
+        uint16_t size,
+        memread_fn done);
+void memread_reply(
+        mem_reads_t *reads,
+        msg_queue_t *msgs,
+        struct wiimote_state *state,
+        const uint8_t *buf);
+void memread_abort_oldest(
+        mem_reads_t *reads,
+        msg_queue_t *msgs,
+        struct wiimote_state *state);
+
+#endif // _GMEMREAD_H_
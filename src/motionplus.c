@@ -0,0 +1,261 @@
+#include <string.h>
+
+#include "motionplus.h"
+
+#define Q30 (1LL << 30)
+// feedback gains of the filter, 2 Kp and 2 Ki in Q16
+#define MAHONY_TWO_KP 65536
+#define MAHONY_TWO_KI 1311
+// 2 pi in Q16
+#define TWO_PI_Q16 411775
+
+void motionplus_reset(motionplus_t *mp) {
+    mp->skipped = 0;
+    mp->still_n = 0;
+    mp->zeroed = 0;
+    for (int i = 0; i < GYRO_AXES; i++) {
+        mp->zero[i] = GYRO_ZERO;
+        mp->orientation[i] = 0;
+    }
+    memset(&mp->filter, 0, sizeof(mp->filter));
+}
+
+// Decoding
+
+/*
+ * Nunchuck passthrough loses bit 0 of every accelerometer axis and bit 1
+ * of z moves into byte 4; the buttons shift up by two. Classic Controller
+ * passthrough loses bit 0 of the left stick, the up and left buttons take
+ * its place. Byte 4 bit 0 tells whether an extension is plugged in, in
+ * both gyro samples and passthrough data.
+ */
+int motionplus_passthrough(const uint8_t *buf, uint8_t mode, uint8_t out[6]) {
+    switch (mode) {
+        case MP_MODE_NUNCHUCK:
+            memcpy(out, buf, 4);
+            out[4] = (uint8_t)((buf[4] & 0xfe) | (buf[5] >> 7 & 0x01));
+            out[5] = (uint8_t)((buf[5] & 0x40) << 1 | (buf[5] & 0x20)
+                    | (buf[5] & 0x10) >> 1 | (buf[5] >> 2 & 0x03));
+            return 1;
+        case MP_MODE_CLASSIC:
+            memcpy(out, buf, 4);
+            out[0] &= 0xfe;
+            out[1] &= 0xfe;
+            out[4] = buf[4] | 0x01;
+            out[5] = (uint8_t)((buf[5] & 0xfc) | (buf[1] & 0x01) << 1
+                    | (buf[0] & 0x01));
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Calibration
+
+static void track_zero(motionplus_t *mp, const uint16_t raw[GYRO_AXES],
+        uint8_t fast) {
+    int moving = fast != 0;
+    for (int i = 0; i < GYRO_AXES && !moving; i++) {
+        if (mp->still_n == 0) {
+            mp->still_sum[i] = 0;
+            mp->still_min[i] = raw[i];
+            mp->still_max[i] = raw[i];
+        }
+        mp->still_sum[i] += raw[i];
+        if (raw[i] < mp->still_min[i]) {
+            mp->still_min[i] = raw[i];
+        }
+        if (raw[i] > mp->still_max[i]) {
+            mp->still_max[i] = raw[i];
+        }
+        moving = mp->still_max[i] - mp->still_min[i] > GYRO_STILL_SPREAD;
+    }
+    if (moving) {
+        mp->still_n = 0;
+        return;
+    }
+    if (++mp->still_n < GYRO_STILL_SAMPLES) {
+        return;
+    }
+    for (int i = 0; i < GYRO_AXES; i++) {
+        mp->zero[i] = (uint16_t)((mp->still_sum[i] + GYRO_STILL_SAMPLES / 2)
+                / GYRO_STILL_SAMPLES);
+    }
+    mp->still_n = 0;
+    mp->zeroed = 1;
+}
+
+/*
+ * Yaw, roll and pitch low bytes, then their high bits in bits 7:2 of
+ * bytes 3 to 5. The range bits, set for slow, are below: yaw and pitch in
+ * byte 3, roll in byte 4. Nothing is integrated before the first zero was
+ * measured, the filter then takes its attitude from gravity.
+ */
+void motionplus_gyro(motionplus_t *mp, const uint8_t *buf,
+        const int32_t accel[ACC_AXES]) {
+    uint16_t raw[GYRO_AXES];
+    int32_t rate[GYRO_AXES];
+    raw[GYRO_YAW] = (uint16_t)(buf[0] | (buf[3] & 0xfc) << 6);
+    raw[GYRO_ROLL] = (uint16_t)(buf[1] | (buf[4] & 0xfc) << 6);
+    raw[GYRO_PITCH] = (uint16_t)(buf[2] | (buf[5] & 0xfc) << 6);
+    uint8_t fast = (uint8_t)((buf[3] & 0x01 ? 0 : 1u << GYRO_PITCH)
+            | (buf[4] & 0x02 ? 0 : 1u << GYRO_ROLL)
+            | (buf[3] & 0x02 ? 0 : 1u << GYRO_YAW));
+    // the passthrough reports in between stretch the step
+    uint32_t dt_us = (uint32_t)(mp->skipped + 1) * MP_SAMPLE_US;
+    mp->inner_seen = buf[4] & 0x01;
+    mp->skipped = 0;
+    mp->seq++;
+    track_zero(mp, raw, fast);
+    if (!mp->zeroed) {
+        return;
+    }
+    // full scale is 8192 counts, in rad/s Q16
+    for (int i = 0; i < GYRO_AXES; i++) {
+        int64_t dps = fast >> i & 1 ? GYRO_FAST_DPS : GYRO_SLOW_DPS;
+        rate[i] = (int32_t)(((int64_t)raw[i] - mp->zero[i]) * dps
+                * TWO_PI_Q16 / (360 * 8192));
+    }
+    mahony_update(&mp->filter, rate, accel, dt_us);
+    mahony_euler(&mp->filter, mp->orientation);
+}
+
+// Fusion
+
+static uint64_t isqrt64(uint64_t v) {
+    uint64_t r = 0, bit = 1ULL << 62;
+    while (bit > v) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return r;
+}
+
+static void set_quaternion(mahony_t *f, const int64_t q[4]) {
+    uint64_t n = isqrt64((uint64_t)(q[0] * q[0] + q[1] * q[1])
+            + (uint64_t)(q[2] * q[2] + q[3] * q[3]));
+    if (n == 0) {
+        f->q[0] = (int32_t)Q30;
+        f->q[1] = f->q[2] = f->q[3] = 0;
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        f->q[i] = (int32_t)(q[i] * Q30 / (int64_t)n);
+    }
+}
+
+/*
+ * Rates in rad/s Q16. The first step only sets pitch and roll from the
+ * accelerometer, the shortest rotation that brings the measured gravity
+ * onto z. Accelerations far from 1g are the remote being swung, not
+ * gravity, and leave the correction out.
+ */
+void mahony_update(mahony_t *f, const int32_t rate[GYRO_AXES],
+        const int32_t accel[ACC_AXES], uint32_t dt_us) {
+    int64_t a[ACC_AXES], g[GYRO_AXES];
+    int64_t n = (int64_t)isqrt64((uint64_t)(
+            (int64_t)accel[ACC_X] * accel[ACC_X]
+            + (int64_t)accel[ACC_Y] * accel[ACC_Y]
+            + (int64_t)accel[ACC_Z] * accel[ACC_Z]));
+    int gravity = n > ACCEL_ONE_G / 2 && n < 3 * ACCEL_ONE_G / 2;
+    for (int i = 0; i < ACC_AXES && gravity; i++) {
+        a[i] = accel[i] * Q30 / n;
+    }
+    if (!f->primed) {
+        if (!gravity) {
+            return;
+        }
+        int64_t q[4] = {Q30 + a[ACC_Z], a[ACC_Y], -a[ACC_X], 0};
+        if (q[0] < Q30 / 64) {
+            // upside down
+            q[0] = q[2] = 0;
+            q[1] = Q30;
+        }
+        set_quaternion(f, q);
+        f->primed = 1;
+        return;
+    }
+    int64_t w = f->q[0], x = f->q[1], y = f->q[2], z = f->q[3];
+    for (int i = 0; i < GYRO_AXES; i++) {
+        g[i] = rate[i] + (f->bias[i] >> 8);
+    }
+    if (gravity) {
+        // gravity where the attitude expects it, and how far off it is
+        int64_t v[3] = {
+            (x * z - w * y) >> 29,
+            (w * x + y * z) >> 29,
+            (w * w - x * x - y * y + z * z) >> 30,
+        };
+        int64_t e[3] = {
+            (a[1] * v[2] - a[2] * v[1]) >> 30,
+            (a[2] * v[0] - a[0] * v[2]) >> 30,
+            (a[0] * v[1] - a[1] * v[0]) >> 30,
+        };
+        for (int i = 0; i < GYRO_AXES; i++) {
+            f->bias[i] += (int32_t)((e[i] * MAHONY_TWO_KI * dt_us
+                    / 1000000) >> 22);
+            g[i] += (e[i] * MAHONY_TWO_KP) >> 30;
+        }
+    }
+    // q += q * (0, g) / 2 * dt
+    int64_t d[4] = {
+        (-x * g[0] - y * g[1] - z * g[2]) >> 16,
+        (w * g[0] + y * g[2] - z * g[1]) >> 16,
+        (w * g[1] - x * g[2] + z * g[0]) >> 16,
+        (w * g[2] + x * g[1] - y * g[0]) >> 16,
+    };
+    int64_t q[4] = {w, x, y, z};
+    for (int i = 0; i < 4; i++) {
+        q[i] += d[i] * dt_us / 2000000;
+    }
+    set_quaternion(f, q);
+}
+
+/*
+ * atan2 in tenths of a degree, from atan(z) ~ pi/4 z + z (1 - z)
+ * (0.2447 + 0.0663 z) on the first octant, within 0.1 degree.
+ */
+static int32_t atan2_deci(int64_t y, int64_t x) {
+    int64_t ay = y < 0 ? -y : y, ax = x < 0 ? -x : x;
+    if (ax == 0 && ay == 0) {
+        return 0;
+    }
+    int64_t lo = ay < ax ? ay : ax, hi = ay < ax ? ax : ay;
+    int64_t zq = (lo << 15) / hi;
+    int64_t poly = 140200 + (37990 * zq >> 15);
+    int32_t a = (int32_t)((450000 * zq
+                + ((zq * ((1 << 15) - zq)) >> 15) * poly + (500 << 15))
+            / (1000 << 15));
+    if (ay > ax) {
+        a = 900 - a;
+    }
+    if (x < 0) {
+        a = 1800 - a;
+    }
+    return y < 0 ? -a : a;
+}
+
+/*
+ * Yaw around z, then pitch around x and roll around the remote's own y
+ * axis: pitch stays within 90 degrees either side, roll and yaw go all
+ * the way round. Tenths of a degree.
+ */
+void mahony_euler(const mahony_t *f, int32_t out[GYRO_AXES]) {
+    int64_t w = f->q[0], x = f->q[1], y = f->q[2], z = f->q[3];
+    int64_t sinp = (w * x + y * z) >> 29;
+    sinp = sinp > Q30 ? Q30 : sinp < -Q30 ? -Q30 : sinp;
+    out[GYRO_PITCH] = atan2_deci(sinp,
+            (int64_t)isqrt64((uint64_t)(Q30 * Q30 - sinp * sinp)));
+    out[GYRO_ROLL] = atan2_deci((w * y - x * z) >> 29,
+            Q30 - ((x * x + y * y) >> 29));
+    out[GYRO_YAW] = atan2_deci((w * z - x * y) >> 29,
+            Q30 - ((x * x + z * z) >> 29));
+}
@@ -0,0 +1,101 @@
+#ifndef _GMOTIONPLUS_H_
+#define _GMOTIONPLUS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "calib.h"
+
+/*
+ * MotionPlus: three gyroscopes in an extension that sits between the
+ * Wiimote and another one, or built into the Wii Remote Plus. After
+ * power-up it is inactive at 0xa60000 and the other extension shows
+ * through; writing a mode to 0xa600fe moves it to 0xa40000 in place of
+ * that extension. Its 6 bytes then carry gyro samples, alternating with
+ * the other extension's data squeezed into fewer bits in the passthrough
+ * modes.
+ */
+#define MP_ID_ADDR 0xa600fa
+#define MP_MODE_ALONE    0x04
+#define MP_MODE_NUNCHUCK 0x05
+#define MP_MODE_CLASSIC  0x07
+
+enum motionplus_status {
+    MP_UNKNOWN,      // not looked for
+    MP_ABSENT,
+    MP_PROBING,
+    MP_INACTIVE,     // found, waits for the extension behind it
+    MP_ACTIVATING,
+    MP_ACTIVE,
+    MP_DEACTIVATING, // lets the extension behind it be identified
+};
+
+// rotation around the accelerometer x, y and z axes
+enum gyro_axis {
+    GYRO_PITCH,
+    GYRO_ROLL,
+    GYRO_YAW,
+    GYRO_AXES,
+};
+
+/*
+ * 14-bit rates around 0x2000, spanning GYRO_SLOW_DPS or GYRO_FAST_DPS
+ * either side depending on the range bit of each axis. The zero differs
+ * from unit to unit, it is measured whenever the remote rests: a window of
+ * slow samples that stay within GYRO_STILL_SPREAD gives the new zero.
+ */
+#define GYRO_ZERO 0x2000
+#define GYRO_SLOW_DPS 440
+#define GYRO_FAST_DPS 2000
+#define GYRO_STILL_SAMPLES 64
+#define GYRO_STILL_SPREAD 24
+
+// reports come every MP_SAMPLE_US in the continuous reporting modes
+#define MP_SAMPLE_US 10000
+
+/*
+ * Mahony filter in fixed point: gyro rates are integrated into a
+ * quaternion every sample and the gravity the accelerometer sees pulls
+ * pitch and roll back, proportionally and through an integral term that
+ * soaks up what the zero tracking missed. Yaw has no reference and drifts.
+ */
+typedef struct {
+    uint8_t primed;
+    int32_t q[4];            // w x y z in Q30, body to earth
+    int32_t bias[GYRO_AXES]; // integral feedback, rad/s in Q24
+} mahony_t;
+
+typedef struct {
+    enum motionplus_status status;
+    uint8_t mode;       // written to 0xa600fe
+    uint8_t inner;      // an extension was behind it when activated
+    uint8_t inner_seen; // the same, as the last gyro sample tells
+    uint8_t skipped;    // passthrough reports since the last gyro sample
+    uint8_t seq;        // bumped by every gyro sample
+    uint16_t zero[GYRO_AXES];
+    uint32_t still_sum[GYRO_AXES];
+    uint16_t still_min[GYRO_AXES];
+    uint16_t still_max[GYRO_AXES];
+    uint8_t still_n;
+    uint8_t zeroed;     // a zero was measured, the filter runs
+    mahony_t filter;
+    // pitch, roll and yaw in tenths of a degree
+    int32_t orientation[GYRO_AXES];
+} motionplus_t;
+
+static inline int motionplus_is_gyro(const uint8_t *buf) {
+    return buf[5] & 0x02;
+}
+
+void motionplus_reset(motionplus_t *mp);
+// accel in ACCEL_ONE_G units, sampled with the gyro
+void motionplus_gyro(motionplus_t *mp, const uint8_t *buf,
+        const int32_t accel[ACC_AXES]);
+// rewrites passthrough data in the extension's own layout, 0 if none
+int motionplus_passthrough(const uint8_t *buf, uint8_t mode, uint8_t out[6]);
+
+void mahony_update(mahony_t *f, const int32_t rate[GYRO_AXES],
+        const int32_t accel[ACC_AXES], uint32_t dt_us);
+void mahony_euler(const mahony_t *f, int32_t out[GYRO_AXES]);
+
+#endif // _GMOTIONPLUS_H_
@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+#include "logger.h"
+
+void pool_init(pool_t *pool, size_t obj_size, size_t objs_per_slab) {
+    memset(pool, 0, sizeof(*pool));
+    pool->obj_size = obj_size;
+    pool->objs_per_slab = objs_per_slab;
+}
+
+static int pool_grow(pool_t *pool) {
+    char **slabs = realloc(pool->slabs,
+            (pool->n_slabs + 1) * sizeof(*slabs));
+    if (slabs == NULL) {
+        return -1;
+    }
+    pool->slabs = slabs;
+    size_t *free_slots = realloc(pool->free_slots,
+            (pool->n_slabs + 1) * pool->objs_per_slab * sizeof(size_t));
+    if (free_slots == NULL) {
+        return -1;
+    }
+    pool->free_slots = free_slots;
+    char *slab = calloc(pool->objs_per_slab, pool->obj_size);
+    if (slab == NULL) {
+        return -1;
+    }
+    // push in reverse so the lowest slot is handed out first
+    size_t first = pool_capacity(pool);
+    for (size_t i = pool->objs_per_slab; i > 0; i--) {
+        pool->free_slots[pool->n_free++] = first + i - 1;
+    }
+    pool->slabs[pool->n_slabs++] = slab;
+    LOG_DEBUG("Pool grown to %zu objects", pool_capacity(pool));
+    return 0;
+}
+
+// grows the pool up front so the next count allocations don't allocate
+int pool_reserve(pool_t *pool, size_t count) {
+    while (pool_capacity(pool) < pool->in_use + count) {
+        if (pool_grow(pool) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void *pool_alloc(pool_t *pool, size_t *slot_out) {
+    if (pool->n_free == 0 && pool_grow(pool) < 0) {
+        LOG_ERROR("Cannot grow pool past %zu objects", pool_capacity(pool));
+        return NULL;
+    }
+    size_t slot = pool->free_slots[--pool->n_free];
+    void *obj = pool_at(pool, slot);
+    memset(obj, 0, pool->obj_size);
+    pool->in_use++;
+    if (slot_out != NULL) {
+        *slot_out = slot;
+    }
+    return obj;
+}
+
+void pool_free(pool_t *pool, size_t slot) {
+    pool->free_slots[pool->n_free++] = slot;
+    pool->in_use--;
+}
+
+void pool_destroy(pool_t *pool) {
+    for (size_t i = 0; i < pool->n_slabs; i++) {
+        free(pool->slabs[i]);
+    }
+    free(pool->slabs);
+    free(pool->free_slots);
+    memset(pool, 0, sizeof(*pool));
+}
@@ -0,0 +1,36 @@
+#ifndef _GPOOL_H_
+#define _GPOOL_H_
+
+#include <stddef.h>
+
+/*
+ * Growable object pool. Objects live in fixed-size slabs that are never
+ * moved or freed while the pool exists, so their addresses stay valid and
+ * can be handed to epoll. Every object has a stable slot number.
+ */
+typedef struct {
+    size_t obj_size;
+    size_t objs_per_slab;
+    char **slabs;
+    size_t n_slabs;
+    size_t *free_slots; // stack of released slot numbers
+    size_t n_free;
+    size_t in_use;
+} pool_t;
+
+void pool_init(pool_t *pool, size_t obj_size, size_t objs_per_slab);
+int pool_reserve(pool_t *pool, size_t count);
+void *pool_alloc(pool_t *pool, size_t *slot_out);
+void pool_free(pool_t *pool, size_t slot);
+void pool_destroy(pool_t *pool);
+
+static inline size_t pool_capacity(const pool_t *pool) {
+    return pool->n_slabs * pool->objs_per_slab;
+}
+
+static inline void *pool_at(const pool_t *pool, size_t slot) {
+    return pool->slabs[slot / pool->objs_per_slab]
+        + (slot % pool->objs_per_slab) * pool->obj_size;
+}
+
+#endif // _GPOOL_H_
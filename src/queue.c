@@ -1,6 +1,7 @@
 #include "queue.h"
 #include "logger.h"
 #include <memory.h>
+#include <stdlib.h>
 
 #ifdef __clang__
 #define NULLABLE _Nullable
@@ -8,19 +9,115 @@
 #define NULLABLE
 #endif
 
-int enqueue_msg(msg_queue_t *msgs, const uint8_t *buf, size_t len) {
-    int ret = 0;
-    if (msgs->count + 1 > MSGQ_SIZE) {
-        LOG_ERROR("Message queue full, cannot enqueue message");
-        ret = -1;
-        goto enqueue_end;
+static inline int has_flag(uint8_t cmd, uint8_t flag) {
+    return (cmd_templates[cmd].flags & flag) != 0;
+}
+
+int msg_queue_init(msg_queue_t *msgs, size_t depth) {
+    memset(msgs, 0, sizeof(*msgs));
+    if (depth < MSGQ_DEFAULT_DEPTH) {
+        depth = MSGQ_DEFAULT_DEPTH;
+    }
+    msgs->msgs = calloc(depth, sizeof(msg_t));
+    if (msgs->msgs == NULL) {
+        return -1;
+    }
+    msgs->depth = depth;
+    return 0;
+}
+
+void msg_queue_free(msg_queue_t *msgs) {
+    free(msgs->msgs);
+    msgs->msgs = NULL;
+    msgs->depth = msgs->head = msgs->tail = msgs->count = 0;
+}
+
+// unwraps the ring into one twice as large
+static int grow_queue(msg_queue_t *msgs) {
+    size_t depth = msgs->depth ? msgs->depth * 2 : MSGQ_DEFAULT_DEPTH;
+    msg_t *grown = calloc(depth, sizeof(msg_t));
+    if (grown == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < msgs->count; i++) {
+        grown[i] = msgs->msgs[(msgs->head + i) % msgs->depth];
     }
-    memcpy(msgs->msgs[msgs->tail].buf, buf, len);
-    msgs->msgs[msgs->tail].len = len;
-    msgs->tail = (msgs->tail + 1) % MSGQ_SIZE;
+    free(msgs->msgs);
+    msgs->msgs = grown;
+    msgs->depth = depth;
+    msgs->head = 0;
+    msgs->tail = msgs->count;
+    LOG_DEBUG("Message queue grown to %zu entries", depth);
+    return 0;
+}
+
+int enqueue_msg(
+        msg_queue_t *msgs,
+        wiimote_cmd_t cmd,
+        const uint8_t * NULLABLE patch) {
+    size_t patch_len = cmd_templates[cmd].patch_len;
+    for (size_t i = 0; i < msgs->count; i++) {
+        msg_t *msg = &msgs->msgs[(msgs->head + i) % msgs->depth];
+        if (msg->cmd != cmd) {
+            continue;
+        }
+        if (has_flag(cmd, CMD_COALESCE)) {
+            memcpy(msg->patch, patch, patch_len);
+        } else if (patch_len > 0
+                   && memcmp(msg->patch, patch, patch_len) != 0) {
+            continue;
+        }
+        msgs->coalesced++;
+        return 0;
+    }
+    if (msgs->count == msgs->depth && grow_queue(msgs) < 0) {
+        LOG_ERROR("Cannot grow message queue, dropping command %hhx",
+                cmd_report(cmd));
+        return -1;
+    }
+    msg_t *msg = &msgs->msgs[msgs->tail];
+    msg->cmd = (uint8_t)cmd;
+    msg->retries = 0;
+    if (patch_len > 0) {
+        memcpy(msg->patch, patch, patch_len);
+    }
+    msgs->tail = (msgs->tail + 1) % msgs->depth;
     msgs->count++;
-enqueue_end:
-    return ret;
+    return 0;
+}
+
+// removes the i-th queued command, the ones behind it move up
+static void remove_queued(msg_queue_t *msgs, size_t i) {
+    for (; i + 1 < msgs->count; i++) {
+        msgs->msgs[(msgs->head + i) % msgs->depth] =
+            msgs->msgs[(msgs->head + i + 1) % msgs->depth];
+    }
+    msgs->tail = (msgs->tail + msgs->depth - 1) % msgs->depth;
+    msgs->count--;
+}
+
+/*
+ * A retried command goes in front of the queue, where it stands for a
+ * copy queued meanwhile: that one is dropped, or for CMD_COALESCE its
+ * newer patch is taken over.
+ */
+static void take_queued_copy(msg_queue_t *msgs, msg_t *retry) {
+    size_t patch_len = cmd_templates[retry->cmd].patch_len;
+    for (size_t i = 0; i < msgs->count; i++) {
+        const msg_t *msg = &msgs->msgs[(msgs->head + i) % msgs->depth];
+        if (msg->cmd != retry->cmd) {
+            continue;
+        }
+        if (has_flag(retry->cmd, CMD_COALESCE)) {
+            memcpy(retry->patch, msg->patch, patch_len);
+        } else if (patch_len > 0
+                   && memcmp(msg->patch, retry->patch, patch_len) != 0) {
+            continue;
+        }
+        msgs->coalesced++;
+        remove_queued(msgs, i);
+        return;
+    }
 }
 
 int pop_msg(msg_queue_t *msgs,  msg_t * NULLABLE out_msg) {
@@ -31,13 +128,128 @@ int pop_msg(msg_queue_t *msgs,  msg_t * NULLABLE out_msg) {
         goto pop_end;
     }
     if (out_msg != NULL) {
-        memcpy(out_msg->buf, msgs->msgs[msgs->head].buf,
-                msgs->msgs[msgs->head].len);
-        out_msg->len = msgs->msgs[msgs->head].len;
+        *out_msg = msgs->msgs[msgs->head];
     }
-    msgs->head = (msgs->head + 1) % MSGQ_SIZE;
+    msgs->head = (msgs->head + 1) % msgs->depth;
     msgs->count--;
 pop_end:
     return ret;
 }
 
+// the next command to write, NULL while it has to wait for a reply
+const msg_t *next_msg(const msg_queue_t *msgs) {
+    if (msgs->count == 0) {
+        return NULL;
+    }
+    const msg_t *msg = &msgs->msgs[msgs->head];
+    if (msgs->inflight_count == MSG_PIPELINE
+        && has_flag(msg->cmd, CMD_TRACKED)) {
+        return NULL;
+    }
+    return msg;
+}
+
+const uint8_t *encode_msg(
+        const msg_queue_t *msgs,
+        const msg_t *msg,
+        uint8_t scratch[CMD_MAX_LEN],
+        size_t *len) {
+    return cmd_encode(msg->cmd, msg->patch, msgs->rumble, scratch, len);
+}
+
+/*
+ * The command from next_msg() was written. Returns the reply timeout to
+ * arm if it is tracked, 0 otherwise.
+ */
+uint64_t msg_sent(msg_queue_t *msgs, uint64_t now_ns) {
+    msg_t msg;
+    if (pop_msg(msgs, &msg) < 0 || !has_flag(msg.cmd, CMD_TRACKED)) {
+        return 0;
+    }
+    inflight_msg_t *slot = &msgs->inflight[msgs->inflight_count++];
+    slot->msg = msg;
+    slot->deadline_ns = now_ns + (MSG_TIMEOUT_NS << msg.retries);
+    return msg_deadline(msgs) - now_ns;
+}
+
+// the earliest reply deadline, 0 if nothing is in flight
+uint64_t msg_deadline(const msg_queue_t *msgs) {
+    uint64_t deadline = 0;
+    for (size_t i = 0; i < msgs->inflight_count; i++) {
+        if (deadline == 0 || msgs->inflight[i].deadline_ns < deadline) {
+            deadline = msgs->inflight[i].deadline_ns;
+        }
+    }
+    return deadline;
+}
+
+static void drop_inflight(msg_queue_t *msgs, size_t i) {
+    msgs->inflight_count--;
+    memmove(&msgs->inflight[i], &msgs->inflight[i + 1],
+            (msgs->inflight_count - i) * sizeof(msgs->inflight[0]));
+}
+
+// a reply to output report id arrived; replies come in order, so it
+// completes the oldest such command. Returns that command, -1 if none.
+int msg_replied(msg_queue_t *msgs, uint8_t report) {
+    for (size_t i = 0; i < msgs->inflight_count; i++) {
+        uint8_t cmd = msgs->inflight[i].msg.cmd;
+        if (cmd_report(cmd) == report) {
+            drop_inflight(msgs, i);
+            return cmd;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Called when the reply timer fires. The oldest overdue command and every
+ * command sent after it are put back at the head of the queue in their
+ * original order, so a retried write still lands before the read that
+ * depends on it. Returns how many commands ran out of retries, their
+ * report ids are stored in given_up, oldest first.
+ */
+size_t msg_timeout(msg_queue_t *msgs, uint64_t now_ns,
+        uint8_t given_up[MSG_PIPELINE]) {
+    size_t n = 0;
+    size_t first = msgs->inflight_count;
+    for (size_t i = 0; i < msgs->inflight_count; i++) {
+        if (now_ns >= msgs->inflight[i].deadline_ns) {
+            first = i;
+            break;
+        }
+    }
+    // walk newest first, each one goes in front of the previous one
+    while (msgs->inflight_count > first) {
+        inflight_msg_t *slot = &msgs->inflight[--msgs->inflight_count];
+        msg_t msg = slot->msg;
+        uint8_t report = cmd_report(msg.cmd);
+        if (now_ns >= slot->deadline_ns) {
+            msgs->timeouts++;
+            if (msg.retries >= MSG_MAX_RETRIES) {
+                msgs->given_up++;
+                given_up[n++] = report;
+                continue;
+            }
+            msg.retries++;
+            LOG_WARN("No reply to command %hhx, retry %hhu",
+                    report, msg.retries);
+        }
+        take_queued_copy(msgs, &msg);
+        if (msgs->count == msgs->depth && grow_queue(msgs) < 0) {
+            msgs->given_up++;
+            given_up[n++] = report;
+            continue;
+        }
+        msgs->head = (msgs->head + msgs->depth - 1) % msgs->depth;
+        msgs->msgs[msgs->head] = msg;
+        msgs->count++;
+    }
+    // collected newest first
+    for (size_t i = 0; i < n / 2; i++) {
+        uint8_t t = given_up[i];
+        given_up[i] = given_up[n - 1 - i];
+        given_up[n - 1 - i] = t;
+    }
+    return n;
+}
@@ -4,26 +4,71 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define MSG_SIZE 32
+#include "commands.h"
+
+// a command template reference and the bytes patched into it
 typedef struct {
-    uint8_t buf[MSG_SIZE];
-    size_t len;
+    uint8_t cmd;
+    uint8_t retries;
+    uint8_t patch[CMD_PATCH_MAX];
 } msg_t;
 
-#define MSGQ_SIZE 16
+/*
+ * Output command scheduler. Commands leave in order; the ones the Wiimote
+ * answers (status requests, memory reads and writes) are tracked until
+ * their reply arrives. Up to MSG_PIPELINE of them are in flight at once,
+ * the Wiimote serves them in order; nothing queued behind is sent while
+ * the window is full. A command without reply is sent again after
+ * MSG_TIMEOUT_NS, doubling every retry, and dropped after MSG_MAX_RETRIES.
+ *
+ * An identical command already waiting is never queued twice, so with
+ * depth >= CMD_COUNT the ring cannot fill up; if it does anyway it grows.
+ */
+#define MSGQ_DEFAULT_DEPTH CMD_COUNT
+#define MSG_TIMEOUT_NS 100000000ULL
+#define MSG_MAX_RETRIES 3
+#define MSG_PIPELINE 4
+typedef struct {
+    msg_t msg;
+    uint64_t deadline_ns;
+} inflight_msg_t;
+
 typedef struct {
-    msg_t msgs[MSGQ_SIZE];
+    msg_t *msgs;
+    size_t depth;
     size_t head;
     size_t tail;
     size_t count;
+    // tracked commands waiting for their reply, oldest first
+    inflight_msg_t inflight[MSG_PIPELINE];
+    size_t inflight_count;
+    // set while the rumble motor runs, see cmd_encode()
+    uint8_t rumble;
+    // lifetime counters
+    uint32_t coalesced;
+    uint32_t timeouts;
+    uint32_t given_up;
 } msg_queue_t;
 
+int msg_queue_init(msg_queue_t *msgs, size_t depth);
+void msg_queue_free(msg_queue_t *msgs);
 int enqueue_msg(
         msg_queue_t *msgs,
-        const uint8_t *buf,
-        size_t len);
+        wiimote_cmd_t cmd,
+        const uint8_t *patch);
 int pop_msg(
         msg_queue_t *msgs,
         msg_t *out_msg);
+const msg_t *next_msg(const msg_queue_t *msgs);
+const uint8_t *encode_msg(
+        const msg_queue_t *msgs,
+        const msg_t *msg,
+        uint8_t scratch[CMD_MAX_LEN],
+        size_t *len);
+uint64_t msg_sent(msg_queue_t *msgs, uint64_t now_ns);
+int msg_replied(msg_queue_t *msgs, uint8_t report);
+uint64_t msg_deadline(const msg_queue_t *msgs);
+size_t msg_timeout(msg_queue_t *msgs, uint64_t now_ns,
+        uint8_t given_up[MSG_PIPELINE]);
 
 #endif // _GQUEUE_H_
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "realtime.h"
+
+#define RT_STACK_PREFAULT (256 * 1024)
+
+_Thread_local int rt_hot = 0;
+atomic_ulong rt_violations[RT_VIOLATION_COUNT];
+
+#ifdef RT_SELFCHECK
+/*
+ * glibc lets the executable interpose the allocator; forwarding to the
+ * __libc_* entry points keeps the real one while counting hot path use.
+ * Only built with RT_SELFCHECK, as it depends on glibc internals.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size) {
+    rt_check(RT_VIOLATION_ALLOC);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    rt_check(RT_VIOLATION_ALLOC);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    rt_check(RT_VIOLATION_ALLOC);
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t align, size_t size) {
+    rt_check(RT_VIOLATION_ALLOC);
+    return __libc_memalign(align, size);
+}
+
+void *aligned_alloc(size_t align, size_t size) {
+    rt_check(RT_VIOLATION_ALLOC);
+    return __libc_memalign(align, size);
+}
+
+int posix_memalign(void **ptr, size_t align, size_t size) {
+    rt_check(RT_VIOLATION_ALLOC);
+    if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0) {
+        return EINVAL;
+    }
+    void *mem = __libc_memalign(align, size);
+    if (mem == NULL) {
+        return ENOMEM;
+    }
+    *ptr = mem;
+    return 0;
+}
+
+void *valloc(size_t size) {
+    rt_check(RT_VIOLATION_ALLOC);
+    return __libc_valloc(size);
+}
+
+void *pvalloc(size_t size) {
+    rt_check(RT_VIOLATION_ALLOC);
+    return __libc_pvalloc(size);
+}
+
+void free(void *ptr) {
+    rt_check(RT_VIOLATION_ALLOC);
+    __libc_free(ptr);
+}
+#endif // RT_SELFCHECK
+
+// grow the stack now so the hot path never takes a fault on it
+static void prefault_stack(void) {
+    volatile char stack[RT_STACK_PREFAULT];
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t off = 0; off < sizeof(stack); off += (size_t)page) {
+        stack[off] = 0;
+    }
+}
+
+int rt_enter(const rt_config_t *cfg) {
+    int ret = 0;
+    struct sched_param param = {.sched_priority = cfg->priority};
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t cpu = (size_t)(cfg->cpu >= 0
+            ? cfg->cpu : (n_cpus > 0 ? n_cpus - 1 : 0));
+    cpu_set_t set;
+
+    // freed memory stays in the heap and nothing is served by fresh mmaps,
+    // so later allocations don't fault in new pages
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    // MCL_CURRENT faults in every mapped page (device pool, log ring,
+    // io_uring buffers), MCL_FUTURE does the same for later mappings
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        LOG_WARN("mlockall failed (errno=%d), memory may be paged", errno);
+        ret = -1;
+    }
+    prefault_stack();
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        LOG_WARN("Cannot pin the event loop to CPU %zu (errno=%d)",
+                cpu, errno);
+        ret = -1;
+    }
+    if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+        LOG_WARN("Cannot switch to SCHED_FIFO %d (errno=%d)",
+                cfg->priority, errno);
+        ret = -1;
+    }
+    LOG_INFO("Real-time mode: SCHED_FIFO %d on CPU %zu%s",
+            cfg->priority, cpu, ret < 0 ? " (partially applied)" : "");
+    return ret;
+}
+
+void rt_report(void) {
+    unsigned long allocs = atomic_load(&rt_violations[RT_VIOLATION_ALLOC]);
+    unsigned long stdio = atomic_load(&rt_violations[RT_VIOLATION_STDIO]);
+#ifdef RT_SELFCHECK
+    const char *scope = "";
+#else
+    const char *scope = " (allocations not checked)";
+#endif
+    if (allocs > 0 || stdio > 0) {
+        LOG_WARN("Real-time self-check: %lu allocations and %lu stdio "
+                "calls on the hot path%s", allocs, stdio, scope);
+    } else {
+        LOG_INFO("Real-time self-check: hot path clean%s", scope);
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef _GREALTIME_H_
+#define _GREALTIME_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+ * Real-time mode: SCHED_FIFO, a pinned event loop and locked, pre-faulted
+ * memory. The steady-state path (wakeup -> decode -> uinput write) is
+ * bracketed with rt_hot_begin/rt_hot_end; stdio seen inside it is counted
+ * as a self-check violation, and so are heap allocations when built with
+ * RT_SELFCHECK.
+ */
+#define RT_DEFAULT_PRIORITY 50
+
+typedef struct {
+    int priority;
+    int cpu; // -1 picks the last online CPU
+} rt_config_t;
+
+enum rt_violation {
+    RT_VIOLATION_ALLOC = 0,
+    RT_VIOLATION_STDIO,
+    RT_VIOLATION_COUNT,
+};
+
+extern _Thread_local int rt_hot;
+extern atomic_ulong rt_violations[RT_VIOLATION_COUNT];
+
+static inline void rt_hot_begin(void) {
+    rt_hot = 1;
+}
+
+static inline void rt_hot_end(void) {
+    rt_hot = 0;
+}
+
+static inline void rt_check(enum rt_violation v) {
+    if (rt_hot) {
+        atomic_fetch_add_explicit(&rt_violations[v], 1, memory_order_relaxed);
+    }
+}
+
+int rt_enter(const rt_config_t *cfg);
+void rt_report(void);
+
+#endif // _GREALTIME_H_
@@ -0,0 +1,136 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/uinput.h>
+
+#include "logger.h"
+#include "rumble.h"
+
+#define MS 1000000ULL
+
+void rumble_init(rumble_t *r) {
+    memset(r, 0, sizeof(*r));
+    r->gain = 0xffff;
+}
+
+// the id was given out by the kernel, below ff_effects_max
+int rumble_upload(rumble_t *r, const struct ff_effect *effect) {
+    if (effect->type != FF_RUMBLE
+        || effect->id < 0 || effect->id >= RUMBLE_EFFECTS) {
+        return -EINVAL;
+    }
+    rumble_effect_t *e = &r->effects[effect->id];
+    // an effect updated while playing keeps playing
+    e->uploaded = 1;
+    e->felt = effect->u.rumble.strong_magnitude > 0
+        || effect->u.rumble.weak_magnitude > 0;
+    e->delay_ms = effect->replay.delay;
+    e->length_ms = effect->replay.length;
+    return 0;
+}
+
+int rumble_erase(rumble_t *r, int id) {
+    if (id < 0 || id >= RUMBLE_EFFECTS) {
+        return -EINVAL;
+    }
+    memset(&r->effects[id], 0, sizeof(r->effects[id]));
+    return 0;
+}
+
+void rumble_play(rumble_t *r, int id, int32_t count, uint64_t now_ns) {
+    if (id < 0 || id >= RUMBLE_EFFECTS || !r->effects[id].uploaded) {
+        return;
+    }
+    r->effects[id].count = count > 0 ? count : 0;
+    r->effects[id].start_ns = now_ns;
+}
+
+/*
+ * A play repeats delay then length, count times over. Returns whether the
+ * effect rumbles at now and sets *next to when that changes, 0 if never.
+ */
+static uint8_t effect_state(rumble_effect_t *e, uint64_t now, uint64_t *next) {
+    uint64_t delay = e->delay_ms * MS, length = e->length_ms * MS;
+    uint64_t t = now - e->start_ns;
+    *next = 0;
+    if (length == 0) {
+        if (t < delay) {
+            *next = e->start_ns + delay;
+            return 0;
+        }
+        return 1;
+    }
+    uint64_t period = delay + length;
+    if (t >= period * (uint64_t)e->count) {
+        e->count = 0;
+        return 0;
+    }
+    uint64_t begin = e->start_ns + t / period * period;
+    if (t % period < delay) {
+        *next = begin + delay;
+        return 0;
+    }
+    *next = begin + period;
+    return 1;
+}
+
+/*
+ * Whether the motor should run at now_ns. *next_ns is set to the earliest
+ * moment that may change, 0 when only a new request can.
+ */
+uint8_t rumble_motor(rumble_t *r, uint64_t now_ns, uint64_t *next_ns) {
+    uint8_t on = 0;
+    *next_ns = 0;
+    for (int i = 0; i < RUMBLE_EFFECTS; i++) {
+        rumble_effect_t *e = &r->effects[i];
+        uint64_t next;
+        if (e->count == 0) {
+            continue;
+        }
+        if (effect_state(e, now_ns, &next) && e->felt && r->gain > 0) {
+            on = 1;
+        }
+        if (next != 0 && (*next_ns == 0 || next < *next_ns)) {
+            *next_ns = next;
+        }
+    }
+    return on;
+}
+
+/*
+ * Uploads and erasures are handed to us as EV_UINPUT requests that have
+ * to be fetched and answered with ioctls; the program that made them is
+ * blocked until then. Playback and gain come as plain EV_FF events.
+ */
+void rumble_read(rumble_t *r, int uinput_fd, uint64_t now_ns) {
+    struct input_event ev;
+    while (read(uinput_fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev)) {
+        if (ev.type == EV_UINPUT && ev.code == UI_FF_UPLOAD) {
+            struct uinput_ff_upload up;
+            memset(&up, 0, sizeof(up));
+            up.request_id = (uint32_t)ev.value;
+            if (ioctl(uinput_fd, UI_BEGIN_FF_UPLOAD, &up) < 0) {
+                LOG_ERROR("Cannot fetch effect upload (errno=%d)", errno);
+                continue;
+            }
+            up.retval = rumble_upload(r, &up.effect);
+            ioctl(uinput_fd, UI_END_FF_UPLOAD, &up);
+        } else if (ev.type == EV_UINPUT && ev.code == UI_FF_ERASE) {
+            struct uinput_ff_erase er;
+            memset(&er, 0, sizeof(er));
+            er.request_id = (uint32_t)ev.value;
+            if (ioctl(uinput_fd, UI_BEGIN_FF_ERASE, &er) < 0) {
+                LOG_ERROR("Cannot fetch effect erasure (errno=%d)", errno);
+                continue;
+            }
+            er.retval = rumble_erase(r, (int)er.effect_id);
+            ioctl(uinput_fd, UI_END_FF_ERASE, &er);
+        } else if (ev.type == EV_FF && ev.code == FF_GAIN) {
+            r->gain = (uint16_t)ev.value;
+        } else if (ev.type == EV_FF) {
+            rumble_play(r, ev.code, ev.value, now_ns);
+        }
+    }
+}
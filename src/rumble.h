@@ -0,0 +1,43 @@
+#ifndef _GRUMBLE_H_
+#define _GRUMBLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/input.h>
+
+/*
+ * Force feedback. Games upload FF_RUMBLE effects to the gamepad and play
+ * them for a number of repetitions; the Wiimote only has an on/off motor,
+ * so it runs whenever any playing effect is in the rumbling part of its
+ * replay. The motor state is a function of time: rumble_motor() gives it
+ * for now along with the next moment it can change, which the caller
+ * sleeps until on a timerfd.
+ */
+#define RUMBLE_EFFECTS 16
+// motor changes closer together are merged into one output report
+#define RUMBLE_MIN_INTERVAL_MS 30
+
+typedef struct {
+    uint8_t uploaded;
+    uint8_t felt;        // a magnitude above 0
+    int32_t count;       // plays left, from start_ns; 0 when stopped
+    uint32_t delay_ms;
+    uint32_t length_ms;  // 0 plays until stopped
+    uint64_t start_ns;
+} rumble_effect_t;
+
+typedef struct {
+    rumble_effect_t effects[RUMBLE_EFFECTS];
+    uint16_t gain;
+} rumble_t;
+
+void rumble_init(rumble_t *r);
+int rumble_upload(rumble_t *r, const struct ff_effect *effect);
+int rumble_erase(rumble_t *r, int id);
+void rumble_play(rumble_t *r, int id, int32_t count, uint64_t now_ns);
+uint8_t rumble_motor(rumble_t *r, uint64_t now_ns, uint64_t *next_ns);
+// serves the force feedback requests pending on a uinput fd
+void rumble_read(rumble_t *r, int uinput_fd, uint64_t now_ns);
+
+#endif // _GRUMBLE_H_
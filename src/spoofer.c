@@ -1,5 +1,7 @@
-#include "wiimote.h"
+#include "spoofer.h"
 #include "logger.h"
+#include "rumble.h"
+#include <errno.h>
 #include <linux/uinput.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -9,28 +11,53 @@
 #include <unistd.h>
 #include <stdio.h>
 
-ssize_t emit(
-        int fd, short unsigned int type, short unsigned int code, int val) {
-    struct input_event ie = {
-        .type = type,
-        .code = code,
-        .value = val,
-        .time = {
-            .tv_sec = 0,
-            .tv_usec = 0
-        }
-    };
-    ssize_t res = write(fd, &ie, sizeof(ie));
+static inline void emit(
+        uinput_batch_t *batch,
+        short unsigned int type, short unsigned int code, int val) {
+    if (batch->count >= UINPUT_BATCH_MAX) {
+        LOG_ERROR("uinput batch full, dropping event %hu:%hu", type, code);
+        return;
+    }
+    struct input_event *ie = &batch->events[batch->count++];
+    ie->type = type;
+    ie->code = code;
+    ie->value = val;
+    ie->time.tv_sec = 0;
+    ie->time.tv_usec = 0;
+}
+
+int flush_uinput_batch(uinput_batch_t *batch, int fd) {
+    int ret = 0;
+    size_t len = batch->count * sizeof(struct input_event);
+    if (batch->count == 0) {
+        goto flush_end;
+    }
+    ssize_t res = write(fd, batch->events, len);
     if (res < 0) {
-        perror("write fallita");
+        if (errno == EAGAIN) {
+            LOG_WARN("uinput fd %d busy, dropped %zu events", fd, batch->count);
+        } else {
+            LOG_ERROR("Failed to write to uinput fd %d (errno=%d)", fd, errno);
+        }
+        ret = -1;
+    } else if ((size_t)res != len) {
+        // uinput consumes whole input_events, so a short write means the
+        // trailing events (including SYN_REPORT) were lost
+        LOG_ERROR("Short write to uinput fd %d: %zd of %zu bytes",
+                fd, res, len);
+        ret = -1;
     }
-    return res;
+    batch->dropped = ret < 0;
+flush_end:
+    batch->count = 0;
+    return ret;
 }
 
 int create_uinput_device(void) {
     struct uinput_setup usetup;
     struct uinput_abs_setup abs_setup;
-    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    // read back for force feedback requests
+    int fd = open("/dev/uinput", O_RDWR | O_NONBLOCK);
     if (fd < 0) {
         perror("open /dev/uinput");
         return fd;
@@ -69,12 +96,14 @@ int create_uinput_device(void) {
     ioctl(fd, UI_SET_ABSBIT, ABS_Z);
 
     ioctl(fd, UI_SET_FFBIT, FF_RUMBLE);
+    // FF_GAIN events are only passed on when advertised
+    ioctl(fd, UI_SET_FFBIT, FF_GAIN);
 
     memset(&usetup, 0, sizeof(usetup));
     usetup.id.bustype = BUS_USB;
     usetup.id.vendor = 0x045e;
     usetup.id.product = 0x028e;
-    usetup.ff_effects_max = 16;
+    usetup.ff_effects_max = RUMBLE_EFFECTS;
     strcpy(usetup.name, "Xbox 360 Wireless Controller");
 
     memset(&abs_setup, 0, sizeof(abs_setup));
@@ -82,8 +111,8 @@ int create_uinput_device(void) {
     abs_setup.code = ABS_X;
     abs_setup.absinfo.minimum = -512;
     abs_setup.absinfo.maximum = 511;
-    abs_setup.absinfo.fuzz = 0;
-    abs_setup.absinfo.flat = 2;
+    abs_setup.absinfo.fuzz = input_profile.fuzz;
+    abs_setup.absinfo.flat = input_profile.flat;
     ioctl(fd, UI_ABS_SETUP, &abs_setup);
 
     abs_setup.code = ABS_Y;
@@ -98,7 +127,7 @@ int create_uinput_device(void) {
     abs_setup.code = ABS_Z;
     abs_setup.absinfo.minimum = 0;
     abs_setup.absinfo.maximum = 255;
-    abs_setup.absinfo.fuzz = 2;
+    abs_setup.absinfo.fuzz = input_profile.trigger_fuzz;
     abs_setup.absinfo.flat = 0;
     abs_setup.absinfo.resolution = 1;
     ioctl(fd, UI_ABS_SETUP, &abs_setup);
@@ -112,99 +141,389 @@ int create_uinput_device(void) {
     return fd;
 }
 
+int create_motion_device(void) {
+    struct uinput_setup usetup;
+    struct uinput_abs_setup abs_setup;
+    static const short unsigned int codes[UMOT_PITCH] = {
+        ABS_X, ABS_Y, ABS_Z, ABS_RX, ABS_RY, ABS_RZ,
+    };
+    static const short unsigned int orientation_codes[] = {
+        ABS_TILT_X, ABS_TILT_Y, ABS_MISC,
+    };
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (fd < 0) {
+        perror("open /dev/uinput");
+        return fd;
+    }
+
+    ioctl(fd, UI_SET_EVBIT, EV_ABS);
+    ioctl(fd, UI_SET_PROPBIT, INPUT_PROP_ACCELEROMETER);
+
+    memset(&abs_setup, 0, sizeof(abs_setup));
+    abs_setup.absinfo.minimum = -ACCEL_MAX;
+    abs_setup.absinfo.maximum = ACCEL_MAX;
+    abs_setup.absinfo.resolution = ACCEL_ONE_G;
+    for (int i = 0; i < UMOT_PITCH; i++) {
+        ioctl(fd, UI_SET_ABSBIT, codes[i]);
+        abs_setup.code = codes[i];
+        ioctl(fd, UI_ABS_SETUP, &abs_setup);
+    }
+    // tenths of a degree, only pitch stops at straight up and down
+    abs_setup.absinfo.resolution = 10;
+    for (int i = 0; motion_orientation && i < GYRO_AXES; i++) {
+        int32_t range = i == GYRO_PITCH ? 900 : 1800;
+        abs_setup.absinfo.minimum = -range;
+        abs_setup.absinfo.maximum = range;
+        ioctl(fd, UI_SET_ABSBIT, orientation_codes[i]);
+        abs_setup.code = orientation_codes[i];
+        ioctl(fd, UI_ABS_SETUP, &abs_setup);
+    }
+
+    // same ids as the gamepad so both are seen as one controller
+    memset(&usetup, 0, sizeof(usetup));
+    usetup.id.bustype = BUS_USB;
+    usetup.id.vendor = 0x045e;
+    usetup.id.product = 0x028e;
+    strcpy(usetup.name, "Xbox 360 Wireless Controller Motion Sensors");
+
+    ioctl(fd, UI_DEV_SETUP, &usetup);
+    ioctl(fd, UI_DEV_CREATE);
+
+    return fd;
+}
+
+int create_pointer_device(void) {
+    struct uinput_setup usetup;
+    struct uinput_abs_setup abs_setup;
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (fd < 0) {
+        perror("open /dev/uinput");
+        return fd;
+    }
+
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(fd, UI_SET_EVBIT, EV_ABS);
+    ioctl(fd, UI_SET_KEYBIT, BTN_LEFT);
+    ioctl(fd, UI_SET_KEYBIT, BTN_RIGHT);
+    ioctl(fd, UI_SET_ABSBIT, ABS_X);
+    ioctl(fd, UI_SET_ABSBIT, ABS_Y);
+
+    memset(&abs_setup, 0, sizeof(abs_setup));
+    abs_setup.code = ABS_X;
+    abs_setup.absinfo.maximum = IR_WIDTH - 1;
+    ioctl(fd, UI_ABS_SETUP, &abs_setup);
+
+    abs_setup.code = ABS_Y;
+    abs_setup.absinfo.maximum = IR_HEIGHT - 1;
+    ioctl(fd, UI_ABS_SETUP, &abs_setup);
+
+    memset(&usetup, 0, sizeof(usetup));
+    usetup.id.bustype = BUS_USB;
+    usetup.id.vendor = 0x045e;
+    usetup.id.product = 0x028e;
+    strcpy(usetup.name, "Xbox 360 Wireless Controller IR Pointer");
+
+    ioctl(fd, UI_DEV_SETUP, &usetup);
+    ioctl(fd, UI_DEV_CREATE);
+
+    return fd;
+}
+
 int destroy_uinput_device(int fd) {
     ioctl(fd, UI_DEV_DESTROY);
     close(fd);
     return 0;
 }
 
-void wiimote_to_uinput(const wiimote_state_t *wiimote, int uinput_fd) {
-    if (!wiimote->initialized) {
-        LOG_ERROR("Wiimote not initialized, cannot map to uinput.");
-        return;
-    }
-    if (wiimote->ext_status != EXT_CLASSIC_CONTROLLER) {
-        emit(uinput_fd, EV_KEY, BTN_SOUTH, wiimote->btn_a);
-        emit(uinput_fd, EV_KEY, BTN_EAST, wiimote->btn_b);
-        emit(uinput_fd, EV_KEY, BTN_WEST, wiimote->btn_1);
-        emit(uinput_fd, EV_KEY, BTN_NORTH, wiimote->btn_2);
-        emit(uinput_fd, EV_KEY, BTN_DPAD_UP, wiimote->btn_up);
-        emit(uinput_fd, EV_KEY, BTN_DPAD_DOWN, wiimote->btn_down);
-        emit(uinput_fd, EV_KEY, BTN_DPAD_LEFT, wiimote->btn_left);
-        emit(uinput_fd, EV_KEY, BTN_DPAD_RIGHT, wiimote->btn_right);
-        emit(uinput_fd, EV_KEY, BTN_START, wiimote->btn_plus);
-        emit(uinput_fd, EV_KEY, BTN_SELECT, wiimote->btn_minus);
-        emit(uinput_fd, EV_KEY, BTN_MODE, wiimote->btn_home);
+static const short unsigned int key_codes[UKEY_COUNT] = {
+    [UKEY_SOUTH] = BTN_SOUTH,
+    [UKEY_EAST] = BTN_EAST,
+    [UKEY_WEST] = BTN_WEST,
+    [UKEY_NORTH] = BTN_NORTH,
+    [UKEY_DPAD_UP] = BTN_DPAD_UP,
+    [UKEY_DPAD_DOWN] = BTN_DPAD_DOWN,
+    [UKEY_DPAD_LEFT] = BTN_DPAD_LEFT,
+    [UKEY_DPAD_RIGHT] = BTN_DPAD_RIGHT,
+    [UKEY_START] = BTN_START,
+    [UKEY_SELECT] = BTN_SELECT,
+    [UKEY_MODE] = BTN_MODE,
+    [UKEY_TL] = BTN_TL,
+    [UKEY_TR] = BTN_TR,
+    [UKEY_TL2] = BTN_TL2,
+    [UKEY_TR2] = BTN_TR2,
+};
+
+static const short unsigned int abs_codes[UABS_COUNT] = {
+    [UABS_X] = ABS_X,
+    [UABS_Y] = ABS_Y,
+    [UABS_RX] = ABS_RX,
+    [UABS_RY] = ABS_RY,
+    [UABS_Z] = ABS_Z,
+    [UABS_RZ] = ABS_RZ,
+};
+
+typedef struct {
+    uint16_t mask;
+    uint8_t key;
+} btn_map_t;
+
+static const btn_map_t wiimote_map[] = {
+    {WII_BTN_A, UKEY_SOUTH},
+    {WII_BTN_B, UKEY_EAST},
+    {WII_BTN_1, UKEY_WEST},
+    {WII_BTN_2, UKEY_NORTH},
+    {WII_BTN_UP, UKEY_DPAD_UP},
+    {WII_BTN_DOWN, UKEY_DPAD_DOWN},
+    {WII_BTN_LEFT, UKEY_DPAD_LEFT},
+    {WII_BTN_RIGHT, UKEY_DPAD_RIGHT},
+    {WII_BTN_PLUS, UKEY_START},
+    {WII_BTN_MINUS, UKEY_SELECT},
+    {WII_BTN_HOME, UKEY_MODE},
+};
+
+static const btn_map_t nunchuck_map[] = {
+    {NC_BTN_Z, UKEY_TL},
+    {NC_BTN_C, UKEY_TR},
+};
+
+static const btn_map_t cc_map[] = {
+    {CC_BTN_A, UKEY_EAST},
+    {CC_BTN_B, UKEY_SOUTH},
+    {CC_BTN_X, UKEY_NORTH},
+    {CC_BTN_Y, UKEY_WEST},
+    {CC_BTN_PLUS, UKEY_START},
+    {CC_BTN_MINUS, UKEY_SELECT},
+    {CC_BTN_HOME, UKEY_MODE},
+    {CC_BTN_DU, UKEY_DPAD_UP},
+    {CC_BTN_DD, UKEY_DPAD_DOWN},
+    {CC_BTN_DL, UKEY_DPAD_LEFT},
+    {CC_BTN_DR, UKEY_DPAD_RIGHT},
+    {CC_BTN_LZ, UKEY_TL},
+    {CC_BTN_RZ, UKEY_TR},
+};
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+static inline uint32_t map_buttons(
+        uint16_t buttons, const btn_map_t *map, size_t len) {
+    uint32_t keys = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (buttons & map[i].mask) {
+            keys |= 1u << map[i].key;
+        }
     }
+    return keys;
+}
+
+static void build_frame(const wiimote_state_t *wiimote, uinput_frame_t *f) {
+    const classic_controller_state_t *cc = &wiimote->classic_controller;
+    const axis_luts_t *luts = &wiimote->luts;
+    memset(f, 0, sizeof(*f));
     switch (wiimote->ext_status) {
         case EXT_NUNCHUCK:
-            emit(uinput_fd, EV_ABS, ABS_X, wiimote->nunchuck.sx - 512);
-            emit(uinput_fd, EV_ABS, ABS_Y, 512 - wiimote->nunchuck.sy);
-            emit(uinput_fd, EV_KEY, BTN_TL, wiimote->nunchuck.z);
-            emit(uinput_fd, EV_KEY, BTN_TR, wiimote->nunchuck.c);
+            f->keys = map_buttons(wiimote->buttons,
+                    wiimote_map, ARRAY_LEN(wiimote_map));
+            f->keys |= map_buttons(wiimote->nunchuck.buttons,
+                    nunchuck_map, ARRAY_LEN(nunchuck_map));
+            f->abs[UABS_X] = luts->lut[CAL_LX][wiimote->nunchuck.sx];
+            f->abs[UABS_Y] = luts->lut[CAL_LY][wiimote->nunchuck.sy];
             break;
         case EXT_CLASSIC_CONTROLLER:
-            emit(uinput_fd,
-                    EV_KEY, BTN_EAST, wiimote->classic_controller.a);
-            emit(uinput_fd,
-                    EV_KEY, BTN_SOUTH, wiimote->classic_controller.b);
-            emit(uinput_fd,
-                    EV_KEY, BTN_NORTH, wiimote->classic_controller.x);
-            emit(uinput_fd,
-                    EV_KEY, BTN_WEST, wiimote->classic_controller.y);
-            emit(uinput_fd,
-                    EV_KEY, BTN_START, wiimote->classic_controller.plus);
-            emit(uinput_fd,
-                    EV_KEY, BTN_SELECT, wiimote->classic_controller.minus);
-            emit(uinput_fd,
-                    EV_KEY, BTN_MODE, wiimote->classic_controller.home);
-            emit(uinput_fd,
-                    EV_KEY, BTN_DPAD_UP, wiimote->classic_controller.du);
-            emit(uinput_fd,
-                    EV_KEY, BTN_DPAD_DOWN, wiimote->classic_controller.dd);
-            emit(uinput_fd,
-                    EV_KEY, BTN_DPAD_LEFT, wiimote->classic_controller.dl);
-            emit(uinput_fd,
-                    EV_KEY, BTN_DPAD_RIGHT, wiimote->classic_controller.dr);
-            emit(uinput_fd,
-                    EV_KEY, BTN_TL, wiimote->classic_controller.lz);
-            emit(uinput_fd,
-                    EV_KEY, BTN_TR, wiimote->classic_controller.rz);
-            emit(uinput_fd,
-                    EV_ABS, ABS_Z, wiimote->classic_controller.lt);
-            emit(uinput_fd,
-                    EV_ABS, ABS_RZ, wiimote->classic_controller.rt);
-            emit(uinput_fd,
-                    EV_KEY, BTN_TL2, wiimote->classic_controller.lt > 128);
-            emit(uinput_fd,
-                    EV_KEY, BTN_TR2, wiimote->classic_controller.rt > 128);
-            emit(uinput_fd,
-                    EV_ABS, ABS_X, wiimote->classic_controller.lx - 512);
-            emit(uinput_fd,
-                    EV_ABS, ABS_Y, 512 - wiimote->classic_controller.ly);
-            emit(uinput_fd,
-                    EV_ABS, ABS_RX, wiimote->classic_controller.rx - 512);
-            emit(uinput_fd,
-                    EV_ABS, ABS_RY, 512 - wiimote->classic_controller.ry);
+            f->keys = map_buttons(cc->buttons, cc_map, ARRAY_LEN(cc_map));
+            f->abs[UABS_X] = luts->lut[CAL_LX][cc->lx];
+            f->abs[UABS_Y] = luts->lut[CAL_LY][cc->ly];
+            f->abs[UABS_RX] = luts->lut[CAL_RX][cc->rx];
+            f->abs[UABS_RY] = luts->lut[CAL_RY][cc->ry];
+            f->abs[UABS_Z] = luts->lut[CAL_LT][cc->lt];
+            f->abs[UABS_RZ] = luts->lut[CAL_RT][cc->rt];
+            if (f->abs[UABS_Z] > 128) {
+                f->keys |= 1u << UKEY_TL2;
+            }
+            if (f->abs[UABS_RZ] > 128) {
+                f->keys |= 1u << UKEY_TR2;
+            }
             break;
         case EXT_NONE:
         case EXT_UNKNOWN:
         case EXT_WAITING_DECRYPTION_0:
-        case EXT_WAITING_DECRYPTION_1 :
+        case EXT_WAITING_DECRYPTION_1:
         case EXT_DECRYPTED:
         default:
-            emit(uinput_fd, EV_ABS, ABS_X, 0);
-            emit(uinput_fd, EV_ABS, ABS_Y, 0);
-            emit(uinput_fd, EV_ABS, ABS_RX, 0);
-            emit(uinput_fd, EV_ABS, ABS_RY, 0);
-            emit(uinput_fd, EV_ABS, ABS_Z, 0);
-            emit(uinput_fd, EV_ABS, ABS_RZ, 0);
-            emit(uinput_fd, EV_KEY, BTN_TR, 0);
-            emit(uinput_fd, EV_KEY, BTN_TL, 0);
-            emit(uinput_fd, EV_KEY, BTN_TR2, 0);
-            emit(uinput_fd, EV_KEY, BTN_TL2, 0);
+            f->keys = map_buttons(wiimote->buttons,
+                    wiimote_map, ARRAY_LEN(wiimote_map));
             break;
     }
-    emit(uinput_fd, EV_SYN, SYN_REPORT, 0);
 }
 
+/*
+ * Queues the events that changed since the last frame in dev->batch
+ * without writing them, or the whole frame after a failed write.
+ * Returns the number of queued events.
+ */
+int build_uinput_batch(const wiimote_state_t *wiimote, uinput_device_t *dev) {
+    uinput_frame_t frame;
+    size_t queued = dev->batch.count;
+    if (!wiimote->initialized) {
+        LOG_ERROR("Wiimote not initialized, cannot map to uinput.");
+        return -1;
+    }
+    build_frame(wiimote, &frame);
+
+    uint8_t resend = dev->batch.dropped;
+    dev->batch.dropped = 0;
+    uint32_t changed = frame.keys ^ dev->last.keys;
+    if (resend) {
+        changed = (1u << UKEY_COUNT) - 1;
+    }
+    while (changed) {
+        int i = __builtin_ctz(changed);
+        changed &= changed - 1;
+        emit(&dev->batch, EV_KEY, key_codes[i], (frame.keys >> i) & 1);
+    }
+    for (int i = 0; i < UABS_COUNT; i++) {
+        if (resend || frame.abs[i] != dev->last.abs[i]) {
+            emit(&dev->batch, EV_ABS, abs_codes[i], frame.abs[i]);
+        }
+    }
+    if (dev->batch.count == queued) {
+        // nothing changed since the last report, don't wake up readers
+        return 0;
+    }
+    emit(&dev->batch, EV_SYN, SYN_REPORT, 0);
+    dev->last = frame;
+    return (int)(dev->batch.count - queued);
+}
+
+int32_t motion_threshold = MOTION_DEFAULT_THRESHOLD;
+uint8_t motion_orientation = 0;
+
+static const short unsigned int motion_codes[UMOT_COUNT] = {
+    [UMOT_X] = ABS_X,
+    [UMOT_Y] = ABS_Y,
+    [UMOT_Z] = ABS_Z,
+    [UMOT_RX] = ABS_RX,
+    [UMOT_RY] = ABS_RY,
+    [UMOT_RZ] = ABS_RZ,
+    [UMOT_PITCH] = ABS_TILT_X,
+    [UMOT_ROLL] = ABS_TILT_Y,
+    [UMOT_YAW] = ABS_MISC,
+};
+
+/*
+ * Queues the accelerometer axes that moved by at least motion_threshold
+ * since they were last written, so a resting controller sends nothing;
+ * orientation goes out on any change. Returns the number of queued events.
+ */
+int build_motion_batch(const wiimote_state_t *wiimote, motion_device_t *dev) {
+    int32_t v[UMOT_COUNT];
+    uint32_t axes = 1u << UMOT_X | 1u << UMOT_Y | 1u << UMOT_Z;
+    if (dev->fd < 0 || !wiimote->initialized) {
+        return 0;
+    }
+    for (int i = ACC_X; i < ACC_AXES; i++) {
+        v[UMOT_X + i] = calib_accel(&wiimote->accel_calib,
+                (enum accel_axis)i, wiimote->accel[i]);
+    }
+    if (wiimote->ext_status == EXT_NUNCHUCK) {
+        for (int i = ACC_X; i < ACC_AXES; i++) {
+            v[UMOT_RX + i] = calib_accel(&wiimote->nc_accel_calib,
+                    (enum accel_axis)i, wiimote->nunchuck.accel[i]);
+        }
+        axes |= 1u << UMOT_RX | 1u << UMOT_RY | 1u << UMOT_RZ;
+    }
+    if (motion_orientation && wiimote->mp.status == MP_ACTIVE) {
+        for (int i = 0; i < GYRO_AXES; i++) {
+            v[UMOT_PITCH + i] = wiimote->mp.orientation[i];
+        }
+        axes |= 1u << UMOT_PITCH | 1u << UMOT_ROLL | 1u << UMOT_YAW;
+    }
+    size_t queued = dev->batch.count;
+    uint8_t resend = dev->batch.dropped;
+    dev->batch.dropped = 0;
+    for (int i = 0; i < UMOT_COUNT; i++) {
+        if (!(axes >> i & 1)) {
+            continue;
+        }
+        int32_t delta = v[i] - dev->last[i];
+        int32_t step = i >= UMOT_PITCH ? 1 : motion_threshold;
+        if (resend || delta >= step || -delta >= step) {
+            emit(&dev->batch, EV_ABS, motion_codes[i], v[i]);
+            dev->last[i] = v[i];
+        }
+    }
+    if (dev->batch.count == queued) {
+        return 0;
+    }
+    emit(&dev->batch, EV_SYN, SYN_REPORT, 0);
+    return (int)(dev->batch.count - queued);
+}
+
+// tracks one new IR sample, queueing the position if it moved
+static void queue_pointer_position(const ir_state_t *ir,
+        pointer_device_t *dev) {
+    int32_t x, y;
+    if (!ir_pointer(ir, &dev->track, &x, &y)) {
+        // start over rather than glide from where the bar was lost
+        dev->fx.primed = 0;
+        dev->fy.primed = 0;
+        return;
+    }
+    x = euro_filter(&dev->fx, x);
+    y = euro_filter(&dev->fy, y);
+    if (x != dev->x) {
+        emit(&dev->batch, EV_ABS, ABS_X, x);
+        dev->x = x;
+    }
+    if (y != dev->y) {
+        emit(&dev->batch, EV_ABS, ABS_Y, y);
+        dev->y = y;
+    }
+}
+
+/*
+ * Queues the filtered pointer position and its buttons when they changed.
+ * The pointer stays where it was while the sensor bar is out of sight.
+ * Each IR sample is filtered once, reports without one (the first half
+ * of an interleaved pair) only update the buttons.
+ * Returns the number of queued events.
+ */
+int build_pointer_batch(const wiimote_state_t *wiimote, pointer_device_t *dev) {
+    if (dev->fd < 0 || !wiimote->initialized) {
+        return 0;
+    }
+    size_t queued = dev->batch.count;
+    if (dev->batch.dropped) {
+        dev->batch.dropped = 0;
+        emit(&dev->batch, EV_ABS, ABS_X, dev->x);
+        emit(&dev->batch, EV_ABS, ABS_Y, dev->y);
+        // both buttons go out again below
+        dev->keys = (uint16_t)~wiimote->buttons;
+    }
+    if (wiimote->ir.seq != dev->seq) {
+        dev->seq = wiimote->ir.seq;
+        queue_pointer_position(&wiimote->ir, dev);
+    }
+    uint16_t keys = wiimote->buttons & (WII_BTN_B | WII_BTN_A);
+    if (keys != dev->keys) {
+        if ((keys ^ dev->keys) & WII_BTN_B) {
+            emit(&dev->batch, EV_KEY, BTN_LEFT, !!(keys & WII_BTN_B));
+        }
+        if ((keys ^ dev->keys) & WII_BTN_A) {
+            emit(&dev->batch, EV_KEY, BTN_RIGHT, !!(keys & WII_BTN_A));
+        }
+        dev->keys = keys;
+    }
+    if (dev->batch.count == queued) {
+        return 0;
+    }
+    emit(&dev->batch, EV_SYN, SYN_REPORT, 0);
+    return (int)(dev->batch.count - queued);
+}
+
+int wiimote_to_uinput(const wiimote_state_t *wiimote, uinput_device_t *dev) {
+    if (build_uinput_batch(wiimote, dev) <= 0) {
+        // not initialized or nothing changed
+        return wiimote->initialized ? 0 : -1;
+    }
+    return flush_uinput_batch(&dev->batch, dev->fd);
+}
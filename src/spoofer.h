@@ -1,8 +1,115 @@
 #ifndef _GSPOOFER_H_
 #define _GSPOOFER_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/input.h>
 #include "wiimote.h"
 
-void wiimote_to_uinput(const wiimote_state_t *wiimote, int uinput_fd);
+// room for the frames of a few reports, a backlog is written at once
+#define UINPUT_BATCH_MAX 128
+typedef struct {
+    struct input_event events[UINPUT_BATCH_MAX];
+    size_t count;
+    // a write failed: the device lags its last values, resend them all
+    uint8_t dropped;
+} uinput_batch_t;
+
+// gamepad keys as bit indices of uinput_frame_t.keys
+enum uinput_key_index {
+    UKEY_SOUTH,
+    UKEY_EAST,
+    UKEY_WEST,
+    UKEY_NORTH,
+    UKEY_DPAD_UP,
+    UKEY_DPAD_DOWN,
+    UKEY_DPAD_LEFT,
+    UKEY_DPAD_RIGHT,
+    UKEY_START,
+    UKEY_SELECT,
+    UKEY_MODE,
+    UKEY_TL,
+    UKEY_TR,
+    UKEY_TL2,
+    UKEY_TR2,
+    UKEY_COUNT,
+};
+
+enum uinput_abs_index {
+    UABS_X,
+    UABS_Y,
+    UABS_RX,
+    UABS_RY,
+    UABS_Z,
+    UABS_RZ,
+    UABS_COUNT,
+};
+
+// one report never produces more events than there are mapped codes + SYN
+#define UINPUT_FRAME_MAX (UKEY_COUNT + UABS_COUNT + 1)
+
+// what the virtual gamepad reports at a given moment
+typedef struct {
+    uint32_t keys;
+    int32_t abs[UABS_COUNT];
+} uinput_frame_t;
+
+typedef struct {
+    int fd;
+    uinput_frame_t last; // last frame written to fd
+    uinput_batch_t batch;
+} uinput_device_t;
+
+/*
+ * Motion sensor device: remote accelerometer on X/Y/Z, nunchuck on
+ * RX/RY/RZ, and with motion_orientation the MotionPlus orientation in
+ * tenths of a degree: pitch on TILT_X, roll on TILT_Y, yaw on MISC.
+ */
+enum motion_abs_index {
+    UMOT_X,
+    UMOT_Y,
+    UMOT_Z,
+    UMOT_RX,
+    UMOT_RY,
+    UMOT_RZ,
+    UMOT_PITCH,
+    UMOT_ROLL,
+    UMOT_YAW,
+    UMOT_COUNT,
+};
+
+// smallest accelerometer change reported, in ACCEL_ONE_G units per g
+#define MOTION_DEFAULT_THRESHOLD 4
+extern int32_t motion_threshold;
+extern uint8_t motion_orientation;
+
+typedef struct {
+    int fd; // -1 without motion reporting
+    int32_t last[UMOT_COUNT]; // last values written to fd
+    uinput_batch_t batch;
+} motion_device_t;
+
+/*
+ * IR pointer device: where the remote points at, tracked from the sensor
+ * bar, as an absolute position in camera pixels. B and A are its left and
+ * right buttons so it is taken for a mouse.
+ */
+typedef struct {
+    int fd; // -1 without IR
+    ir_track_t track;
+    euro_axis_t fx, fy;
+    uint8_t seq; // last IR sample tracked
+    int32_t x, y; // last position written to fd
+    uint16_t keys; // last buttons written to fd
+    uinput_batch_t batch;
+} pointer_device_t;
+
+int wiimote_to_uinput(const wiimote_state_t *wiimote, uinput_device_t *dev);
+int build_uinput_batch(const wiimote_state_t *wiimote, uinput_device_t *dev);
+int flush_uinput_batch(uinput_batch_t *batch, int fd);
+int build_motion_batch(const wiimote_state_t *wiimote, motion_device_t *dev);
+int build_pointer_batch(const wiimote_state_t *wiimote, pointer_device_t *dev);
 int create_uinput_device(void);
+int create_motion_device(void);
+int create_pointer_device(void);
 int destroy_uinput_device(int fd);
 #endif
@@ -0,0 +1,487 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "realtime.h"
+#include "uring.h"
+
+// completions carry the context pointer with the operation in the low bits
+enum uring_op {
+    URING_OP_READ = 0,
+    URING_OP_WRITE = 1,
+    URING_OP_POLL_DEVICE = 2,
+    URING_OP_POLL_FD = 3,
+    URING_OP_TIMER = 4,
+    URING_OP_CANCEL = 5,
+    URING_OP_FF = 6,
+    URING_OP_RUMBLE = 7,
+    URING_OP_WRITE_MOTION = 8,
+    URING_OP_WRITE_POINTER = 9,
+};
+// contexts are 16 byte aligned
+#define URING_OP_MASK 15ULL
+
+static inline uint64_t tag(const void *ptr, enum uring_op op) {
+    return (uint64_t)(uintptr_t)ptr | (uint64_t)op;
+}
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned int to_submit,
+        unsigned int min_complete, unsigned int flags) {
+    return (int)syscall(__NR_io_uring_enter,
+            fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned int opcode,
+        const void *arg, unsigned int nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// everything the engine submits must be supported, or we stay on epoll
+static int uring_supported(int fd) {
+    static const uint8_t needed[] = {
+        IORING_OP_READ_FIXED, IORING_OP_WRITE,
+        IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE,
+    };
+    size_t size = sizeof(struct io_uring_probe)
+        + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    int ret = 0;
+    if (probe == NULL) {
+        return 0;
+    }
+    if (uring_register(fd, IORING_REGISTER_PROBE,
+            probe, IORING_OP_LAST) < 0) {
+        goto probe_end;
+    }
+    for (size_t i = 0; i < sizeof(needed); i++) {
+        if (needed[i] > probe->last_op
+            || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED)) {
+            goto probe_end;
+        }
+    }
+    ret = 1;
+probe_end:
+    free(probe);
+    return ret;
+}
+
+int uring_init(uring_engine_t *ur) {
+    struct io_uring_params p;
+    memset(ur, 0, sizeof(*ur));
+    memset(&p, 0, sizeof(p));
+    ur->fd = uring_setup(URING_ENTRIES, &p);
+    if (ur->fd < 0) {
+        LOG_WARN("io_uring unavailable (errno=%d)", errno);
+        return -1;
+    }
+    if (!uring_supported(ur->fd)) {
+        LOG_WARN("io_uring lacks fixed reads, writes or polls");
+        goto failed_ring;
+    }
+
+    ur->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ur->cq_map_size = p.cq_off.cqes
+        + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ur->cq_map_size > ur->sq_map_size) {
+            ur->sq_map_size = ur->cq_map_size;
+        }
+        ur->cq_map_size = ur->sq_map_size;
+    }
+    ur->sq_map = mmap(NULL, ur->sq_map_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+    if (ur->sq_map == MAP_FAILED) {
+        LOG_ERROR("Cannot map io_uring submission ring");
+        goto failed_ring;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ur->cq_map = ur->sq_map;
+    } else {
+        ur->cq_map = mmap(NULL, ur->cq_map_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING);
+        if (ur->cq_map == MAP_FAILED) {
+            LOG_ERROR("Cannot map io_uring completion ring");
+            goto failed_sq_map;
+        }
+    }
+    ur->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ur->sqes = mmap(NULL, ur->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+    if (ur->sqes == MAP_FAILED) {
+        LOG_ERROR("Cannot map io_uring submission entries");
+        goto failed_cq_map;
+    }
+
+    uint8_t *sq = ur->sq_map;
+    uint8_t *cq = ur->cq_map;
+    ur->sq_head = (unsigned int *)(sq + p.sq_off.head);
+    ur->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    ur->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    ur->sq_mask = *(unsigned int *)(sq + p.sq_off.ring_mask);
+    ur->sq_entries = p.sq_entries;
+    ur->sq_local_tail = *ur->sq_tail;
+    ur->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    ur->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    ur->cq_mask = *(unsigned int *)(cq + p.cq_off.ring_mask);
+    ur->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // pinned once so reads skip the per-request page lookup
+    struct iovec iov = {
+        .iov_len = URING_MAX_DEVICES * URING_RX_SIZE,
+    };
+    ur->rx = aligned_alloc(4096, iov.iov_len);
+    if (ur->rx == NULL) {
+        LOG_ERROR("Cannot allocate io_uring read buffers");
+        goto failed_sqes;
+    }
+    iov.iov_base = ur->rx;
+    if (uring_register(ur->fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0) {
+        LOG_WARN("Cannot register io_uring buffers (errno=%d)", errno);
+        goto failed_rx;
+    }
+    LOG_INFO("io_uring engine ready (%u entries)", p.sq_entries);
+    return 0;
+
+failed_rx:
+    free(ur->rx);
+failed_sqes:
+    munmap(ur->sqes, ur->sqes_size);
+failed_cq_map:
+    if (ur->cq_map != ur->sq_map) {
+        munmap(ur->cq_map, ur->cq_map_size);
+    }
+failed_sq_map:
+    munmap(ur->sq_map, ur->sq_map_size);
+failed_ring:
+    close(ur->fd);
+    ur->fd = -1;
+    return -1;
+}
+
+void uring_destroy(uring_engine_t *ur) {
+    if (ur->fd < 0) {
+        return;
+    }
+    munmap(ur->sqes, ur->sqes_size);
+    if (ur->cq_map != ur->sq_map) {
+        munmap(ur->cq_map, ur->cq_map_size);
+    }
+    munmap(ur->sq_map, ur->sq_map_size);
+    close(ur->fd);
+    free(ur->rx);
+    ur->fd = -1;
+}
+
+static unsigned int pending(const uring_engine_t *ur) {
+    return ur->sq_local_tail - *ur->sq_tail;
+}
+
+static int submit(uring_engine_t *ur, unsigned int min_complete) {
+    unsigned int to_submit = pending(ur);
+    __atomic_store_n(ur->sq_tail, ur->sq_local_tail, __ATOMIC_RELEASE);
+    int ret = uring_enter(ur->fd, to_submit, min_complete,
+            min_complete ? IORING_ENTER_GETEVENTS : 0);
+    return ret < 0 ? -1 : 0;
+}
+
+static struct io_uring_sqe *get_sqe(uring_engine_t *ur) {
+    unsigned int head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+    if (ur->sq_local_tail - head == ur->sq_entries) {
+        // ring full: hand what we have to the kernel first
+        if (submit(ur, 0) < 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+        if (ur->sq_local_tail - head == ur->sq_entries) {
+            return NULL;
+        }
+    }
+    unsigned int index = ur->sq_local_tail & ur->sq_mask;
+    struct io_uring_sqe *sqe = &ur->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ur->sq_array[index] = index;
+    ur->sq_local_tail++;
+    return sqe;
+}
+
+/*
+ * hidraw fds stay non-blocking for the synchronous report writes, so a
+ * bare read would complete with -EAGAIN: wait for POLLIN first.
+ */
+static int post_read(uring_engine_t *ur, wiimote_context_t *wm) {
+    struct io_uring_sqe *poll = get_sqe(ur);
+    struct io_uring_sqe *read = get_sqe(ur);
+    if (poll == NULL || read == NULL) {
+        LOG_ERROR("io_uring submission ring full");
+        return -1;
+    }
+    poll->opcode = IORING_OP_POLL_ADD;
+    poll->fd = wm->hidraw_fd;
+    poll->poll32_events = POLLIN;
+    poll->flags = IOSQE_IO_LINK;
+    poll->user_data = tag(wm, URING_OP_POLL_DEVICE);
+    read->opcode = IORING_OP_READ_FIXED;
+    read->fd = wm->hidraw_fd;
+    read->addr = (uint64_t)(uintptr_t)(ur->rx + wm->slot * URING_RX_SIZE);
+    read->len = URING_RX_SIZE;
+    read->buf_index = 0;
+    read->user_data = tag(wm, URING_OP_READ);
+    return 0;
+}
+
+static int post_write(uring_engine_t *ur, wiimote_context_t *wm,
+        int fd, const uinput_batch_t *batch, enum uring_op op) {
+    struct io_uring_sqe *write = get_sqe(ur);
+    if (write == NULL) {
+        LOG_ERROR("io_uring submission ring full");
+        return -1;
+    }
+    write->opcode = IORING_OP_WRITE;
+    write->fd = fd;
+    write->addr = (uint64_t)(uintptr_t)batch->events;
+    write->len = (uint32_t)(batch->count * sizeof(struct input_event));
+    write->flags = IOSQE_IO_LINK;
+    write->user_data = tag(wm, op);
+    return 0;
+}
+
+/*
+ * The next read only starts once uinput took the batches, so it is safe
+ * to reuse their buffers when that read completes. Empty ones are left
+ * out of the chain.
+ */
+static int post_writes_then_read(uring_engine_t *ur, wiimote_context_t *wm) {
+    if ((wm->uinput.batch.count > 0
+            && post_write(ur, wm, wm->uinput.fd, &wm->uinput.batch,
+                URING_OP_WRITE) < 0)
+        || (wm->motion.batch.count > 0
+            && post_write(ur, wm, wm->motion.fd, &wm->motion.batch,
+                URING_OP_WRITE_MOTION) < 0)
+        || (wm->pointer.batch.count > 0
+            && post_write(ur, wm, wm->pointer.fd, &wm->pointer.batch,
+                URING_OP_WRITE_POINTER) < 0)) {
+        return -1;
+    }
+    return post_read(ur, wm);
+}
+
+// one shot POLLIN on a timer or the uinput fd, op tells them apart
+static int post_poll(uring_engine_t *ur, wiimote_context_t *wm,
+        int fd, enum uring_op op) {
+    struct io_uring_sqe *sqe = get_sqe(ur);
+    if (sqe == NULL) {
+        LOG_ERROR("io_uring submission ring full");
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = tag(wm, op);
+    wm->uring_polls++;
+    return 0;
+}
+
+// polls outlive their fd otherwise, and with it the context
+static void cancel_poll(uring_engine_t *ur, wiimote_context_t *wm,
+        enum uring_op op) {
+    struct io_uring_sqe *sqe = get_sqe(ur);
+    if (sqe == NULL) {
+        LOG_ERROR("io_uring submission ring full");
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->addr = tag(wm, op);
+    sqe->user_data = tag(NULL, URING_OP_CANCEL);
+}
+
+int uring_watch(uring_engine_t *ur, wiimote_context_t *wm) {
+    if (wm->slot >= URING_MAX_DEVICES) {
+        LOG_ERROR("io_uring engine serves at most %d Wiimotes",
+                URING_MAX_DEVICES);
+        return -1;
+    }
+    if (post_read(ur, wm) < 0
+        || post_poll(ur, wm, wm->cmd_timer_fd, URING_OP_TIMER) < 0
+        || (wm->ff_polled
+            && post_poll(ur, wm, wm->uinput.fd, URING_OP_FF) < 0)
+        || post_poll(ur, wm, wm->rumble_timer_fd, URING_OP_RUMBLE) < 0) {
+        return -1;
+    }
+    // the first output reports go out right away, like on EPOLLOUT
+    wm->hid_writable = 1;
+    flush_msg_queue(wm);
+    LOG_INFO("  Wiimote device added to io_uring.");
+    return 0;
+}
+
+int uring_poll_fd(uring_engine_t *ur, int fd) {
+    struct io_uring_sqe *sqe = get_sqe(ur);
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = tag(NULL, URING_OP_POLL_FD);
+    return 0;
+}
+
+/*
+ * Completions are tagged with the context pointer. A context is only
+ * given back to the pool once none of its polls can complete any more;
+ * a Wiimote taking the slot over would get them otherwise.
+ */
+static void retire(pool_t *wiimotes, wiimote_context_t *wm) {
+    if (!wm->active && wm->uring_polls == 0) {
+        release_wiimote_context(wiimotes, wm);
+    }
+}
+
+// a poll completed, it is re-posted while the Wiimote is there
+static int poll_done(pool_t *wiimotes, wiimote_context_t *wm, int res) {
+    wm->uring_polls--;
+    if (res == -ECANCELED || !wm->active) {
+        retire(wiimotes, wm);
+        return 0;
+    }
+    return 1;
+}
+
+static void serve_read(uring_engine_t *ur, pool_t *wiimotes,
+        wiimote_context_t *wm, int res) {
+    if (res == -ECANCELED || res == -EAGAIN || res == -EINTR) {
+        // a failed link ahead of us or a spurious wakeup, try again
+        post_read(ur, wm);
+        return;
+    }
+    if (res <= 0) {
+        LOG_INFO("Wiimote disconnected (read %d).", res);
+        cancel_poll(ur, wm, URING_OP_TIMER);
+        if (wm->ff_polled) {
+            cancel_poll(ur, wm, URING_OP_FF);
+        }
+        cancel_poll(ur, wm, URING_OP_RUMBLE);
+        lat_dump(&wm->latency, wm->dev_path);
+        wm->active = 0;
+        retire(wiimotes, wm);
+        return;
+    }
+    uint64_t t_read = lat_now_ns();
+    uint8_t *buf = ur->rx + wm->slot * URING_RX_SIZE;
+    rt_hot_begin();
+    if (decode_wiimote_report(wm, buf, (size_t)res, t_read) < 0) {
+        post_read(ur, wm);
+        rt_hot_end();
+        return;
+    }
+    uint64_t t_parsed = lat_now_ns();
+    // handshake replies go out synchronously, they are rare
+    wm->hid_writable = 1;
+    flush_msg_queue(wm);
+    int queued = build_uinput_batch(&wm->state, &wm->uinput) > 0;
+    queued |= build_motion_batch(&wm->state, &wm->motion) > 0;
+    queued |= build_pointer_batch(&wm->state, &wm->pointer) > 0;
+    if (queued) {
+        post_writes_then_read(ur, wm);
+        // the batches stay untouched until the linked read completes
+        wm->uinput.batch.count = 0;
+        wm->motion.batch.count = 0;
+        wm->pointer.batch.count = 0;
+    } else {
+        post_read(ur, wm);
+    }
+    // emit is when the write is queued, it is submitted with the next wait
+    lat_record(&wm->latency, buf[0], t_read, t_parsed, lat_now_ns());
+    rt_hot_end();
+}
+
+// a write cancelled by a failed link ahead of it is dropped as well
+static void serve_write(uinput_batch_t *batch, int fd, int res) {
+    batch->dropped = res < 0 || res % (int)sizeof(struct input_event) != 0;
+    if (res == -EAGAIN) {
+        LOG_WARN("uinput fd %d busy, dropped a batch", fd);
+    } else if (res == -ECANCELED) {
+        LOG_WARN("uinput fd %d write cancelled, dropped a batch", fd);
+    } else if (res < 0) {
+        LOG_ERROR("Failed to write to uinput fd %d (errno=%d)", fd, -res);
+    } else if (res % (int)sizeof(struct input_event) != 0) {
+        LOG_ERROR("Short write to uinput fd %d: %d bytes", fd, res);
+    }
+}
+
+/*
+ * Submits everything queued, waits for at least one completion and serves
+ * all available ones. Returns 1 when the fd given to uring_poll_fd became
+ * readable (it has to be polled again), 0 otherwise, -1 with errno set on
+ * failure.
+ */
+int uring_run(uring_engine_t *ur, pool_t *wiimotes) {
+    int fd_ready = 0;
+    if (submit(ur, 1) < 0) {
+        return -1;
+    }
+    unsigned int head = *ur->cq_head;
+    unsigned int tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &ur->cqes[head & ur->cq_mask];
+        wiimote_context_t *wm =
+            (wiimote_context_t *)(uintptr_t)(cqe->user_data & ~URING_OP_MASK);
+        switch ((enum uring_op)(cqe->user_data & URING_OP_MASK)) {
+            case URING_OP_READ:
+                serve_read(ur, wiimotes, wm, cqe->res);
+                break;
+            case URING_OP_WRITE:
+                serve_write(&wm->uinput.batch, wm->uinput.fd, cqe->res);
+                break;
+            case URING_OP_WRITE_MOTION:
+                serve_write(&wm->motion.batch, wm->motion.fd, cqe->res);
+                break;
+            case URING_OP_WRITE_POINTER:
+                serve_write(&wm->pointer.batch, wm->pointer.fd, cqe->res);
+                break;
+            case URING_OP_POLL_DEVICE:
+                // errors show up on the linked read
+                break;
+            case URING_OP_POLL_FD:
+                fd_ready = 1;
+                break;
+            case URING_OP_TIMER:
+                if (poll_done(wiimotes, wm, cqe->res)) {
+                    wm->hid_writable = 1;
+                    handle_wiimote_timer(wm);
+                    post_poll(ur, wm, wm->cmd_timer_fd, URING_OP_TIMER);
+                }
+                break;
+            case URING_OP_FF:
+                if (poll_done(wiimotes, wm, cqe->res)) {
+                    wm->hid_writable = 1;
+                    handle_wiimote_ff(wm);
+                    post_poll(ur, wm, wm->uinput.fd, URING_OP_FF);
+                }
+                break;
+            case URING_OP_RUMBLE:
+                if (poll_done(wiimotes, wm, cqe->res)) {
+                    wm->hid_writable = 1;
+                    handle_wiimote_ff(wm);
+                    post_poll(ur, wm, wm->rumble_timer_fd, URING_OP_RUMBLE);
+                }
+                break;
+            case URING_OP_CANCEL:
+                break;
+            default:
+                break;
+        }
+    }
+    __atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+    return fd_ready;
+}
@@ -0,0 +1,56 @@
+#ifndef _GURING_H_
+#define _GURING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/io_uring.h>
+
+#include "device.h"
+#include "pool.h"
+
+/*
+ * io_uring event engine. Every Wiimote keeps one read pre-posted into a
+ * registered buffer; after a report is translated the uinput writes and
+ * the next read are queued as one linked chain, and all chains of a loop
+ * iteration are submitted together with the wait for the next completion.
+ * Timers and force feedback requests are waited for with one shot polls.
+ * One other fd (the epoll instance holding the udev monitor) can be
+ * polled through the ring as well.
+ */
+#define URING_ENTRIES 256
+#define URING_MAX_DEVICES 256
+#define URING_RX_SIZE 64
+
+typedef struct {
+    int fd;
+    // submission ring
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_array;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    unsigned int sq_local_tail;
+    struct io_uring_sqe *sqes;
+    // completion ring
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+    // mappings
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    size_t sqes_size;
+    // registered read buffers, one per pool slot
+    uint8_t *rx;
+} uring_engine_t;
+
+int uring_init(uring_engine_t *ur);
+void uring_destroy(uring_engine_t *ur);
+int uring_watch(uring_engine_t *ur, wiimote_context_t *wm);
+int uring_poll_fd(uring_engine_t *ur, int fd);
+int uring_run(uring_engine_t *ur, pool_t *wiimotes);
+
+#endif // _GURING_H_
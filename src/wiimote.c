@@ -33,114 +33,93 @@
 #include "wiimote.h"
 #include "logger.h"
 
-typedef enum {
-    RUMBLE = 0x10,
-    LEDS,
-    REPORTING_MODE,
-    IR_CAMERA_ENABLE,
-    SPEAKER_ENABLE,
-    STATUS_INFO_REQUEST,
-    WRITE_MEMREG_REQUEST,
-    READ_MEMREG_REQUEST,
-    SPEAKER_DATA,
-    SPEAKER_MUTE,
-    IR_CAMERA_ENABLE_2,
-
-    STATUS_INFO_REPLY = 0x20,
-    READ_MEMREG_REPLY,
-    ACK_OUT_RETURN,
-
-    DATA_REP_COREBTNS = 0x30,
-    DATA_REP_COREACC,
-    DATA_REP_COREEXT8,
-    DATA_REP_COREACCIR12,
-    DATA_REP_COREEXT19,
-    DATA_REP_COREACC16,
-    DATA_REP_COREIR10EXT9,
-    DATA_REP_COREACCIR10EXT6,
-
-    DATA_REP_EXT21 = 0x3D,
-    DATA_REP_INTERLEAVED1,
-    DATA_REP_INTERLEAVED2,
-} wiimote_report_type_t;
-
-// Messages
-
-uint8_t EXT_DECRYPT_PHASE1[22] = {
-    WRITE_MEMREG_REQUEST, // write
-    0x04, // addr space (in this case control registers)
-    0xa4, 0x00, 0xf0, // first encryption address
-    0x01, 0x55, // size and data
-                // 7 bytes written
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00 // padding
-};
-
-uint8_t EXT_DECRYPT_PHASE2[22] = {
-    WRITE_MEMREG_REQUEST, // write
-    0x04, // addr space (in this case control registers)
-    0xa4, 0x00, 0xfb, // first encryption address
-    0x01, 0x00, // size and data
-                // 7 bytes written
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00 // padding
-};
-
-const uint8_t CC_DATAMODE_REQ[] = {
-    READ_MEMREG_REQUEST,
-    0x04,
-    0xa4, 0x00, 0xfe,
-    0x00, 0x01,
-};
-
 // Enqueue requests
 
-// int enqueue_decrypt_req(msg_queue_t *msgs) {
-//     int ret = 0;
-//     if (msgs->count + 2 > MSGQ_SIZE) {
-//         LOG_ERROR("Message queue full, trying to decrypt extension later");
-//         ret = -1;
-//         goto decrypt_end;
-//     }
-//     uint8_t buf[22] = {
-//         WRITE_MEMREG_REQUEST, // write
-//         0x04, // addr space (in this case control registers)
-//         0xa4, 0x00, 0xf0, // first encryption address
-//         0x01, 0x55, // size and data
-//                     // 7 bytes written
-//         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-//         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-//         0x00 // padding
-//     };
-//     enqueue_msg(msgs, buf, 22);
-//     LOG_DEBUG("Enqueued first decryption write");
-//     buf[4] = 0xfb;
-//     buf[6] = 0x00;
-//     enqueue_msg(msgs, buf, 22);
-//     LOG_DEBUG("Enqueued second decryption write");
-// decrypt_end:
-//     return ret;
-// }
-
-int enqueue_ext_detect(msg_queue_t *msgs) {
-    int ret = 0;
-    if (msgs->count + 1 > MSGQ_SIZE) {
-        LOG_ERROR("Message queue full, trying to detect extension later");
-        ret = -1;
-        goto detect_end;
-    }
-    uint8_t buf[] = {
-        READ_MEMREG_REQUEST, // read
-        0x04, // addr space (in this case control registers)
-        0xa4, 0x00, 0xfa, // ext type address
-        0x00, 0x06, // size
-    };
-    enqueue_msg(msgs, buf, sizeof(buf));
-    LOG_DEBUG("Enqueued extension detection read");
-detect_end:
-    return ret;
+static inline int ext_identified(const wiimote_state_t *state) {
+    return state->ext_status == EXT_NUNCHUCK
+        || state->ext_status == EXT_CLASSIC_CONTROLLER
+        || state->mp.status == MP_ACTIVE;
+}
+
+// extended points carry the blob size, but only fit without extension
+static inline uint8_t wanted_ir_mode(const wiimote_state_t *state) {
+    if (ext_identified(state)) {
+        return IR_MODE_BASIC;
+    }
+    return state->features & WII_FEAT_IR_FULL
+        ? IR_MODE_FULL : IR_MODE_EXTENDED;
+}
+
+/*
+ * Smallest data reporting mode carrying everything we translate: the
+ * extension bytes are only requested once the extension is identified.
+ * With IR the report has to match the format the camera is being set up
+ * for, which catches up with the extension once that bring-up is done.
+ */
+static uint8_t pick_report_mode(const wiimote_state_t *state) {
+    int ext = ext_identified(state);
+    if (state->features & WII_FEAT_IR) {
+        uint8_t ir = state->ir_pending ? state->ir_pending
+            : state->ir.mode ? state->ir.mode : wanted_ir_mode(state);
+        switch (ir) {
+            case IR_MODE_FULL:
+                return DATA_REP_INTERLEAVED1;
+            case IR_MODE_EXTENDED:
+                return DATA_REP_COREACCIR12;
+            default:
+                return DATA_REP_COREACCIR10EXT6;
+        }
+    }
+    if (state->features & WII_FEAT_ACCEL) {
+        return ext ? DATA_REP_COREACC16 : DATA_REP_COREACC;
+    }
+    return ext ? DATA_REP_COREEXT8 : DATA_REP_COREBTNS;
+}
+
+/*
+ * Turns the camera on in the given format: both enables, then the
+ * register writes, all sent back to back. Points are ignored until the
+ * last write is acknowledged.
+ */
+static void start_ir_camera(msg_queue_t *msgs, wiimote_state_t *state,
+        uint8_t mode) {
+    state->ir.mode = IR_MODE_OFF;
+    state->ir.visible = 0;
+    state->ir_pending = mode;
+    if (enqueue_msg(msgs, CMD_IR_ENABLE, NULL) < 0
+        || enqueue_msg(msgs, CMD_IR_ENABLE_2, NULL) < 0
+        || enqueue_msg(msgs, CMD_IR_START, NULL) < 0
+        || enqueue_msg(msgs, CMD_IR_SENS_1, NULL) < 0
+        || enqueue_msg(msgs, CMD_IR_SENS_2, NULL) < 0
+        || enqueue_msg(msgs, CMD_IR_MODE, &mode) < 0
+        || enqueue_msg(msgs, CMD_IR_FINISH, NULL) < 0) {
+        LOG_ERROR("Failed to enqueue IR camera setup");
+        return;
+    }
+    LOG_INFO("Enabling IR camera (%s)", mode == IR_MODE_FULL ? "full"
+            : mode == IR_MODE_EXTENDED ? "extended" : "basic");
+}
+
+/*
+ * A Wiimote stops sending data reports after every status report, so this
+ * is sent again after each of them as well as on extension changes.
+ */
+int enqueue_report_mode(msg_queue_t *msgs, wiimote_state_t *state) {
+    if ((state->features & WII_FEAT_IR) && !state->ir_pending
+        && state->ir.mode != wanted_ir_mode(state)) {
+        start_ir_camera(msgs, state, wanted_ir_mode(state));
+    }
+    uint8_t mode = pick_report_mode(state);
+    // the Wiimote starts over with a 0x3e
+    state->interleave.pending = 0;
+    if (enqueue_msg(msgs, CMD_REPORT_MODE, &mode) < 0) {
+        return -1;
+    }
+    if (mode != state->report_mode) {
+        LOG_INFO("Requesting data reporting mode %hhx", mode);
+        state->report_mode = mode;
+    }
+    return 0;
 }
 
 // Parsers
@@ -151,56 +130,83 @@ void parse_wiimote(
         const uint8_t * NULLABLE ir_buf,
         wiimote_state_t *wm_state) {
     if (btns_buf != NULL) {
-        wm_state->btn_up = (btns_buf[0] & 0x08) >> 3;
-        wm_state->btn_down = (btns_buf[0] & 0x04) >> 2;
-        wm_state->btn_right = (btns_buf[0] & 0x02) >> 1;
-        wm_state->btn_left = (btns_buf[0] & 0x01);
-        wm_state->btn_minus = (btns_buf[1] & 0x10) >> 4;
-        wm_state->btn_plus = (btns_buf[0] & 0x10) >> 4;
-        wm_state->btn_home = (btns_buf[1] & 0x80) >> 7;
-        wm_state->btn_a = (btns_buf[1] & 0x08) >> 3;
-        wm_state->btn_b = (btns_buf[1] & 0x04) >> 2;
-        wm_state->btn_1 = (btns_buf[1] & 0x02) >> 1;
-        wm_state->btn_2 = (btns_buf[1] & 0x01);
+        wm_state->buttons = (uint16_t)
+            ((btns_buf[0] << 8 | btns_buf[1]) & WII_BTN_MASK);
+    }
+    if (btns_buf != NULL && acc_buf != NULL) {
+        decode_wiimote_accel(btns_buf, acc_buf, wm_state->accel);
+    }
+    if (ir_buf != NULL) {
+        parse_ir(ir_buf, &wm_state->ir);
+    }
+}
+
+/*
+ * Interleaved reports: 0x3e holds x and z bits 7:4, 0x3f y and z bits 3:0,
+ * each with half of the full IR data. A sample is only complete once both
+ * halves arrived in order; a half whose partner was lost is dropped, the
+ * buttons it carries are still taken.
+ */
+static void parse_interleaved(const uint8_t *buf, wiimote_state_t *state) {
+    interleave_t *il = &state->interleave;
+    uint8_t z = (uint8_t)((buf[1] >> 5 & 0x3) | (buf[2] >> 3 & 0xc));
+    parse_wiimote(buf+1, NULL, NULL, state);
+    if (buf[0] == DATA_REP_INTERLEAVED1) {
+        if (il->pending) {
+            il->dropped++;
+            LOG_DEBUG_ASYNC(
+                    "Lost second half of interleaved report (%lld so far)",
+                    (long long)il->dropped);
+        }
+        il->pending = 1;
+        il->accel_x = buf[3];
+        il->accel_z = (uint8_t)(z << 4);
+        memcpy(il->ir, buf+4, sizeof(il->ir));
+        return;
     }
+    if (!il->pending) {
+        il->dropped++;
+        LOG_DEBUG_ASYNC(
+                "Lost first half of interleaved report (%lld so far)",
+                (long long)il->dropped);
+        return;
+    }
+    uint8_t ir[IR_FULL_SIZE];
+    il->pending = 0;
+    memcpy(ir, il->ir, sizeof(il->ir));
+    memcpy(ir + sizeof(il->ir), buf+4, sizeof(il->ir));
+    // 8-bit samples, scaled like the 10-bit ones the calibration expects
+    state->accel[ACC_X] = (uint16_t)(il->accel_x << 2);
+    state->accel[ACC_Y] = (uint16_t)(buf[3] << 2);
+    state->accel[ACC_Z] = (uint16_t)((il->accel_z | z) << 2);
+    parse_ir(ir, &state->ir);
 }
 
 void parse_nunchuck(const uint8_t *nc_buf, nunchuck_state_t *nc_state) {
-    nc_state->sx = nc_buf[0] * 1023/255;
-    nc_state->sy = nc_buf[1] * 1023/255;
-    nc_state->c = ((nc_buf[5] >> 1) & 1) ^ 1;
-    nc_state->z = ((nc_buf[5] & 1) ^ 1);
+    nc_state->sx = nc_buf[0];
+    nc_state->sy = nc_buf[1];
     // c and z are inverted
+    nc_state->buttons = (uint8_t)(~nc_buf[5] & (NC_BTN_C | NC_BTN_Z));
+    decode_nunchuck_accel(nc_buf, nc_state->accel);
 }
 
 void parse_cc(const uint8_t *cc_buf, classic_controller_state_t *cc_state) {
-    // maximum analog range is [0;1023], so we scale accordingly
-    // maximum trigger range is [0;255], only case 1 uses [0;31]
+    // raw samples, scaled by the axis tables
     switch (cc_state->data_format) {
         case 1:
-            // lx [0;63] ly [0;63] rx [0;31] ry [0;31]
-            cc_state->lx = (cc_buf[0] & 0x3f) * 1023/63;
-            cc_state->ly = (cc_buf[1] & 0x3f) * 1023/63;
-            cc_state->rx = ((cc_buf[2] & 0x80) >> 7
+            // lx [0;63] ly [0;63] rx [0;31] ry [0;31] lt [0;31] rt [0;31]
+            cc_state->lx = cc_buf[0] & 0x3f;
+            cc_state->ly = cc_buf[1] & 0x3f;
+            cc_state->rx = (uint8_t)((cc_buf[2] & 0x80) >> 7
                             | (cc_buf[1] & 0xc0) >> 5
-                            | (cc_buf[0] & 0xc0) >> 3) * 1023/31;
-            cc_state->ry = (cc_buf[2] & 0x1f) * 1023/31;
-            cc_state->lt = ((cc_buf[3] & 0xe0) >> 5
-                            | (cc_buf[2] & 0x60) >> 2) * 255/31;
-            cc_state->rt = (cc_buf[3] & 0x1f) * 255/31;
-            cc_state->dr = !((cc_buf[4] >> 7) & 1);
-            cc_state->dd = !((cc_buf[4] >> 6) & 1);
-            cc_state->dl = !((cc_buf[5] >> 1) & 1);
-            cc_state->du = !(cc_buf[5] & 1);
-            cc_state->b = !((cc_buf[5] >> 6) & 1);
-            cc_state->y = !((cc_buf[5] >> 5) & 1);
-            cc_state->a = !((cc_buf[5] >> 4) & 1);
-            cc_state->x = !((cc_buf[5] >> 3) & 1);
-            cc_state->minus = !((cc_buf[4] >> 4) & 1);
-            cc_state->home = !((cc_buf[4] >> 3) & 1);
-            cc_state->plus = !((cc_buf[4] >> 2) & 1);
-            cc_state->lz = !((cc_buf[5] >> 7) & 1);
-            cc_state->rz = !((cc_buf[5] >> 2) & 1);
+                            | (cc_buf[0] & 0xc0) >> 3);
+            cc_state->ry = cc_buf[2] & 0x1f;
+            cc_state->lt = (uint8_t)((cc_buf[3] & 0xe0) >> 5
+                            | (cc_buf[2] & 0x60) >> 2);
+            cc_state->rt = cc_buf[3] & 0x1f;
+            // buttons are active low
+            cc_state->buttons = (uint16_t)
+                (~(cc_buf[4] << 8 | cc_buf[5]) & CC_BTN_MASK);
             break;
         case 2:
         case 3:
@@ -211,7 +217,36 @@ void parse_cc(const uint8_t *cc_buf, classic_controller_state_t *cc_state) {
     }
 }
 
+// gyro samples are integrated against the accelerometer of the same report
+static void parse_gyro(const uint8_t *buf, wiimote_state_t *state) {
+    int32_t accel[ACC_AXES];
+    for (int i = ACC_X; i < ACC_AXES; i++) {
+        accel[i] = calib_accel(&state->accel_calib, (enum accel_axis)i,
+                state->accel[i]);
+    }
+    motionplus_gyro(&state->mp, buf, accel);
+}
+
 void parse_generic(const uint8_t *cc_buf, wiimote_state_t *state) {
+    motionplus_t *mp = &state->mp;
+    uint8_t ext[6];
+    if (mp->status == MP_ACTIVE) {
+        if (motionplus_is_gyro(cc_buf)) {
+            parse_gyro(cc_buf, state);
+            return;
+        }
+        if (mp->skipped < UINT8_MAX) {
+            mp->skipped++;
+        }
+        if (!motionplus_passthrough(cc_buf, mp->mode, ext)) {
+            return;
+        }
+        cc_buf = ext;
+    } else if (mp->status == MP_ACTIVATING
+            || mp->status == MP_DEACTIVATING) {
+        // neither the MotionPlus nor the extension behind it
+        return;
+    }
     switch (state->ext_status) {
         case EXT_CLASSIC_CONTROLLER:
             parse_cc(cc_buf, &state->classic_controller);
@@ -231,6 +266,308 @@ void parse_generic(const uint8_t *cc_buf, wiimote_state_t *state) {
 
 // Handlers
 
+static inline int ext_handshaking(const wiimote_state_t *state) {
+    return state->ext_status == EXT_WAITING_DECRYPTION_0
+        || state->ext_status == EXT_WAITING_DECRYPTION_1
+        || state->ext_status == EXT_DECRYPTED
+        || state->ext_verify != EXT_VERIFY_NONE;
+}
+
+// nominal ranges until the calibration block arrived
+void build_axis_luts(wiimote_state_t *state) {
+    const uint8_t *calib = state->ext_calib_valid ? state->ext_calib : NULL;
+    switch (state->ext_status) {
+        case EXT_NUNCHUCK:
+            calib_build_nunchuck(&state->luts, calib);
+            // the block starts with the accelerometer points
+            calib_build_accel(&state->nc_accel_calib, calib,
+                    ACCEL_NOMINAL_NUNCHUCK);
+            break;
+        case EXT_CLASSIC_CONTROLLER:
+            calib_build_classic(&state->luts, calib);
+            break;
+        case EXT_NONE:
+        case EXT_WAITING_DECRYPTION_0:
+        case EXT_WAITING_DECRYPTION_1:
+        case EXT_DECRYPTED:
+        case EXT_UNKNOWN:
+        default:
+            break;
+    }
+}
+
+static void ext_calibration_read(
+        msg_queue_t *msgs,
+        wiimote_state_t *state,
+        const mem_read_t *rd) {
+    (void)msgs;
+    if (rd->error != 0) {
+        return;
+    }
+    if (!calib_valid(rd->data)) {
+        LOG_WARN("Extension calibration checksum mismatch, using defaults");
+        state->ext_calib_valid = 0;
+    } else {
+        LOG_INFO("Extension calibration loaded");
+        memcpy(state->ext_calib, rd->data, EXT_CALIB_SIZE);
+        state->ext_calib_valid = 1;
+    }
+    state->calib_gen++;
+    build_axis_luts(state);
+}
+
+static void wiimote_calibration_read(
+        msg_queue_t *msgs,
+        wiimote_state_t *state,
+        const mem_read_t *rd) {
+    (void)msgs;
+    if (rd->error != 0) {
+        return;
+    }
+    if (!calib_wiimote_valid(rd->data)) {
+        LOG_WARN("Accelerometer calibration checksum mismatch, "
+                "using defaults");
+        return;
+    }
+    LOG_INFO("Accelerometer calibration loaded");
+    calib_build_accel(&state->accel_calib, rd->data, ACCEL_NOMINAL_WIIMOTE);
+}
+
+// nominal values until the EEPROM answered
+void request_wiimote_calibration(msg_queue_t *msgs, wiimote_state_t *state) {
+    calib_build_accel(&state->accel_calib, NULL, ACCEL_NOMINAL_WIIMOTE);
+    if (memread_start(&state->reads, msgs, MEMREAD_EEPROM,
+            WII_CALIB_ADDR, WII_CALIB_SIZE, wiimote_calibration_read) < 0) {
+        LOG_ERROR("Failed to request accelerometer calibration");
+    }
+}
+
+// MotionPlus
+
+static void motionplus_absent(wiimote_state_t *state) {
+    if (state->mp.status == MP_PROBING
+        || state->mp.status == MP_ACTIVATING) {
+        LOG_INFO("No MotionPlus found");
+        state->mp.status = MP_ABSENT;
+    }
+}
+
+/*
+ * Activates a MotionPlus found inactive once the extension behind it, if
+ * any, is identified, in the passthrough mode for it. Another extension
+ * only shows as plugged in.
+ */
+static void settle_motionplus(msg_queue_t *msgs, wiimote_state_t *state) {
+    motionplus_t *mp = &state->mp;
+    if (mp->status != MP_INACTIVE || ext_handshaking(state)) {
+        return;
+    }
+    uint8_t mode = state->ext_status == EXT_NUNCHUCK ? MP_MODE_NUNCHUCK
+        : state->ext_status == EXT_CLASSIC_CONTROLLER ? MP_MODE_CLASSIC
+        : MP_MODE_ALONE;
+    if (enqueue_msg(msgs, CMD_MP_ACTIVATE, &mode) < 0) {
+        LOG_ERROR("Failed to enqueue MotionPlus activation");
+        return;
+    }
+    LOG_INFO("Activating MotionPlus (mode %hhx)", mode);
+    mp->status = MP_ACTIVATING;
+    mp->mode = mode;
+    mp->inner = state->ext_status != EXT_NONE;
+}
+
+static void motionplus_id_read(
+        msg_queue_t *msgs,
+        wiimote_state_t *state,
+        const mem_read_t *rd) {
+    const uint8_t *data = rd->data;
+    if (state->mp.status != MP_PROBING) {
+        return;
+    }
+    if (rd->error != 0 || data[2] != 0xa6 || data[3] != 0x20
+        || data[5] != 0x05) {
+        motionplus_absent(state);
+        return;
+    }
+    LOG_INFO("MotionPlus detected");
+    state->mp.status = MP_INACTIVE;
+    settle_motionplus(msgs, state);
+}
+
+// the active MotionPlus answers at the extension address with its mode
+static void motionplus_signature_read(
+        msg_queue_t *msgs,
+        wiimote_state_t *state,
+        const mem_read_t *rd) {
+    motionplus_t *mp = &state->mp;
+    const uint8_t *data = rd->data;
+    if (mp->status != MP_ACTIVATING) {
+        return;
+    }
+    if (rd->error != 0 || data[2] != 0xa4 || data[3] != 0x20
+        || data[4] != mp->mode || data[5] != 0x05) {
+        LOG_WARN("MotionPlus did not activate");
+        mp->status = MP_ABSENT;
+        return;
+    }
+    LOG_INFO("MotionPlus active");
+    motionplus_reset(mp);
+    mp->inner_seen = mp->inner;
+    mp->status = MP_ACTIVE;
+    enqueue_report_mode(msgs, state);
+}
+
+// answered after the status reply, like the calibration
+void request_motionplus(msg_queue_t *msgs, wiimote_state_t *state) {
+    if (enqueue_msg(msgs, CMD_MP_INIT, NULL) < 0
+        || memread_start(&state->reads, msgs, MEMREAD_REGISTER,
+                MP_ID_ADDR, 6, motionplus_id_read) < 0) {
+        LOG_ERROR("Failed to probe for MotionPlus");
+        return;
+    }
+    state->mp.status = MP_PROBING;
+}
+
+/*
+ * The Wiimote reports the extension change an activation or deactivation
+ * makes, but that report is not retried if lost; a status request is.
+ */
+static void motionplus_moved(msg_queue_t *msgs, wiimote_state_t *state) {
+    if (state->mp.status == MP_ACTIVATING
+        || state->mp.status == MP_DEACTIVATING) {
+        enqueue_msg(msgs, CMD_STATUS, NULL);
+    }
+}
+
+/*
+ * An extension plugged into or pulled out of the active MotionPlus only
+ * shows in its gyro samples. Deactivating it makes the Wiimote report the
+ * change, the extension is identified as usual and settle_motionplus()
+ * brings the MotionPlus back in the mode for it.
+ */
+static void replug_motionplus(msg_queue_t *msgs, wiimote_state_t *state) {
+    motionplus_t *mp = &state->mp;
+    // the write that starts decrypting a plain extension
+    if (enqueue_msg(msgs, CMD_EXT_DECRYPT_1, NULL) < 0) {
+        LOG_ERROR("Failed to enqueue MotionPlus deactivation");
+        return;
+    }
+    LOG_INFO("Extension %s MotionPlus, deactivating it",
+            mp->inner_seen ? "plugged into" : "removed from");
+    mp->inner = mp->inner_seen;
+    mp->status = MP_DEACTIVATING;
+}
+
+/*
+ * While the MotionPlus is active the extension flag is its own. Returns 1
+ * when the status reply was about it; after a deactivation the extension
+ * behind it is identified from scratch.
+ */
+static int motionplus_status_reply(msg_queue_t *msgs,
+        wiimote_state_t *state) {
+    motionplus_t *mp = &state->mp;
+    switch (mp->status) {
+        case MP_ACTIVATING:
+            // held back behind a signature read for another extension
+            if (WII_FLAG_EXT_CONNECTED(*state)
+                && memread_start(&state->reads, msgs, MEMREAD_REGISTER,
+                        EXT_ID_ADDR, 6, motionplus_signature_read) < 0) {
+                LOG_ERROR("Failed to enqueue MotionPlus signature read");
+            }
+            return 1;
+        case MP_ACTIVE:
+            if (WII_FLAG_EXT_CONNECTED(*state)) {
+                return 1;
+            }
+            LOG_WARN("MotionPlus disconnected");
+            mp->status = MP_ABSENT;
+            return 0;
+        case MP_DEACTIVATING:
+            mp->status = MP_INACTIVE;
+            state->ext_status = EXT_NONE;
+            state->ext_verify = EXT_VERIFY_NONE;
+            state->ext_attempts = 0;
+            return 0;
+        case MP_UNKNOWN:
+        case MP_ABSENT:
+        case MP_PROBING:
+        case MP_INACTIVE:
+        default:
+            return 0;
+    }
+}
+
+static void ext_signature_read(
+        msg_queue_t *msgs,
+        wiimote_state_t *state,
+        const mem_read_t *rd) {
+    if (rd->error != 0 || !ext_handshaking(state)) {
+        // unanswered reads restart the handshake in handle_command_failure
+        return;
+    }
+    const uint8_t *data = rd->data;
+    uint64_t ext_signature =
+        ((uint64_t)data[0] << 40) |
+        ((uint64_t)data[1] << 32) |
+        ((uint64_t)data[2] << 24) |
+        ((uint64_t)data[3] << 16) |
+        ((uint64_t)data[4] << 8)  |
+        ((uint64_t)data[5] << 0);
+    enum extension_status cached = state->ext_verify
+        ? state->ext_status : EXT_NONE;
+    LOG_INFO("Extension signature: %012llx",
+            (unsigned long long)ext_signature);
+    state->ext_verify = EXT_VERIFY_NONE;
+    switch (ext_signature & ~EXT_FORMAT_MASK) {
+        case NUNCHUCK_SIGNATURE & ~EXT_FORMAT_MASK:
+            LOG_INFO("Nunchuck extension detected");
+            state->ext_status = EXT_NUNCHUCK;
+            state->ext_attempts = 0;
+            break;
+        case CC_SIGNATURE & ~EXT_FORMAT_MASK:
+            LOG_INFO("Classic Controller extension detected");
+            state->ext_status = EXT_CLASSIC_CONTROLLER;
+            state->ext_attempts = 0;
+            // register 0xfe, no need to read it separately
+            state->classic_controller.data_format = data[4];
+            LOG_INFO("Classic Controller data mode set to %hhx",
+                    data[4]);
+            break;
+        default:
+            LOG_WARN("Unknown extension detected. Signature: "
+                    "%012llx",
+                    (unsigned long long)ext_signature);
+            state->ext_status = EXT_UNKNOWN;
+            break;
+    }
+    if (cached != EXT_NONE && cached == state->ext_status) {
+        LOG_INFO("Cached extension confirmed");
+    } else if (cached != EXT_NONE) {
+        // the cached calibration belongs to another extension
+        state->ext_calib_valid = 0;
+    }
+    build_axis_luts(state);
+    enqueue_report_mode(msgs, state);
+    settle_motionplus(msgs, state);
+}
+
+/*
+ * The Wiimote serves commands in order, so both decryption writes and the
+ * signature and calibration reads go out together instead of one per
+ * reply. The calibration answer comes after the signature one.
+ */
+static void start_ext_handshake(msg_queue_t *msgs, wiimote_state_t *state) {
+    if (enqueue_msg(msgs, CMD_EXT_DECRYPT_1, NULL) < 0
+        || enqueue_msg(msgs, CMD_EXT_DECRYPT_2, NULL) < 0
+        || memread_start(&state->reads, msgs, MEMREAD_REGISTER,
+                EXT_ID_ADDR, 6, ext_signature_read) < 0
+        || memread_start(&state->reads, msgs, MEMREAD_REGISTER,
+                EXT_CALIB_ADDR, EXT_CALIB_SIZE, ext_calibration_read) < 0) {
+        LOG_ERROR("Failed to enqueue extension handshake");
+        return;
+    }
+    LOG_INFO("Started extension decryption process");
+}
+
 void handle_status_input_reply(
         msg_queue_t *msgs,
         wiimote_state_t *state,
@@ -241,22 +578,111 @@ void handle_status_input_reply(
     state->battery = buf[7];
     parse_wiimote(buf+1, NULL, NULL, state);
 
+    if (motionplus_status_reply(msgs, state)) {
+        enqueue_report_mode(msgs, state);
+        return;
+    }
     if (WII_FLAG_EXT_CONNECTED(*state)
         && state->ext_status == EXT_NONE) {
         LOG_INFO("Connection to extension detected");
         state->ext_status = EXT_WAITING_DECRYPTION_0;
-        if (enqueue_msg(
-                msgs,
-                EXT_DECRYPT_PHASE1,
-                sizeof(EXT_DECRYPT_PHASE1)) == 0) {
-            LOG_INFO("Started extension decryption process");
-        } else {
-            LOG_ERROR("Failed to enqueue extension decryption request");
-        }
+        state->ext_calib_valid = 0;
+        start_ext_handshake(msgs, state);
+    } else if (WII_FLAG_EXT_CONNECTED(*state)
+               && state->ext_verify == EXT_VERIFY_CACHED) {
+        LOG_INFO("Verifying cached extension");
+        state->ext_verify = EXT_VERIFY_RUNNING;
+        start_ext_handshake(msgs, state);
     } else if (!WII_FLAG_EXT_CONNECTED(*state)
                 && state->ext_status != EXT_NONE) {
         LOG_INFO("Disconnection from extension detected");
         state->ext_status = EXT_NONE;
+        state->ext_verify = EXT_VERIFY_NONE;
+        state->ext_attempts = 0;
+    }
+    enqueue_report_mode(msgs, state);
+    // unless an extension is about to show up behind it
+    if (!WII_FLAG_EXT_CONNECTED(*state) && !state->mp.inner) {
+        settle_motionplus(msgs, state);
+    }
+}
+
+/*
+ * A tracked command ran out of retries. An extension handshake stuck on it
+ * starts over from a status request, a few times at most.
+ */
+void handle_command_failure(
+        msg_queue_t *msgs,
+        wiimote_state_t *state,
+        uint8_t cmd) {
+    LOG_WARN("Wiimote never answered command %hhx", cmd);
+    if (cmd == READ_MEMREG_REQUEST) {
+        memread_abort_oldest(&state->reads, msgs, state);
+    }
+    if (state->ir_pending && (cmd == IR_CAMERA_ENABLE
+            || cmd == IR_CAMERA_ENABLE_2 || cmd == WRITE_MEMREG_REQUEST)) {
+        // start over once the rest of the sequence drained, from the
+        // report mode sent after the status reply
+        state->ir_pending = 0;
+        if (++state->ir_attempts >= IR_MAX_ATTEMPTS) {
+            LOG_ERROR("IR camera setup failed %d times, giving up",
+                    IR_MAX_ATTEMPTS);
+            state->features &= (uint8_t)~WII_FEAT_IR;
+        }
+        enqueue_msg(msgs, CMD_STATUS, NULL);
+    }
+    if (cmd == WRITE_MEMREG_REQUEST) {
+        motionplus_absent(state);
+    }
+    if (!ext_handshaking(state)) {
+        return;
+    }
+    state->ext_verify = EXT_VERIFY_NONE;
+    if (++state->ext_attempts >= EXT_MAX_ATTEMPTS) {
+        LOG_ERROR("Extension handshake failed %d times, giving up",
+                EXT_MAX_ATTEMPTS);
+        state->ext_status = EXT_UNKNOWN;
+        enqueue_report_mode(msgs, state);
+        settle_motionplus(msgs, state);
+        return;
+    }
+    LOG_INFO("Restarting extension handshake");
+    state->ext_status = EXT_NONE;
+    enqueue_msg(msgs, CMD_STATUS, NULL);
+}
+
+static void handle_ack(msg_queue_t *msgs, wiimote_state_t *state, int cmd) {
+    switch (cmd) {
+        case CMD_EXT_DECRYPT_1:
+            // the signature read is already queued behind both writes
+            if (state->ext_status == EXT_WAITING_DECRYPTION_0) {
+                LOG_INFO("Extension decryption phase 1 write acknowledged");
+                state->ext_status = EXT_WAITING_DECRYPTION_1;
+            } else {
+                motionplus_moved(msgs, state);
+            }
+            break;
+        case CMD_MP_ACTIVATE:
+            motionplus_moved(msgs, state);
+            break;
+        case CMD_EXT_DECRYPT_2:
+            if (state->ext_status == EXT_WAITING_DECRYPTION_1) {
+                LOG_INFO("Extension decryption phase 2 write acknowledged");
+                state->ext_status = EXT_DECRYPTED;
+            }
+            break;
+        case CMD_IR_FINISH:
+            if (state->ir_pending) {
+                LOG_INFO("IR camera enabled");
+                state->ir.mode = state->ir_pending;
+                state->ir_pending = 0;
+                state->ir_attempts = 0;
+                // the extension may have changed while setting up
+                enqueue_report_mode(msgs, state);
+            }
+            break;
+        default:
+            break;
     }
 }
 
@@ -269,124 +695,70 @@ int handle_wiimote_event(
     // LOG_DEBUG("Wiimote event report type: %hhx", event_buffer[0]);
     switch (event_buffer[0]) {
         case DATA_REP_COREBTNS:
-        // accel not implemented yet
+            parse_wiimote(event_buffer+1, NULL, NULL, state);
+            break;
         case DATA_REP_COREACC:
+            parse_wiimote(event_buffer+1, event_buffer+3, NULL, state);
+            break;
         case DATA_REP_COREACCIR12:
-            parse_wiimote(event_buffer+1, NULL, NULL, state);
+            parse_wiimote(event_buffer+1, event_buffer+3, event_buffer+6,
+                    state);
             break;
         case DATA_REP_COREEXT8:
             parse_wiimote(event_buffer+1, NULL, NULL, state);
             parse_generic(event_buffer+3, state);
             break;
         case DATA_REP_COREACC16:
-            parse_wiimote(event_buffer+1, NULL, NULL, state);
+            parse_wiimote(event_buffer+1, event_buffer+3, NULL, state);
             parse_generic(event_buffer+6, state);
+            break;
         case DATA_REP_COREIR10EXT9:
-            parse_wiimote(event_buffer+1, NULL, NULL, state);
-            // parse ir data (not implemented here)
+            parse_wiimote(event_buffer+1, NULL, event_buffer+3, state);
             parse_generic(event_buffer+13, state);
             break;
         case DATA_REP_COREACCIR10EXT6:
-            parse_wiimote(event_buffer+1, NULL, NULL, state);
-            // parse accelerometer data (not implemented here)
+            parse_wiimote(event_buffer+1, event_buffer+3, event_buffer+6,
+                    state);
             parse_generic(event_buffer+16, state);
             break;
         case DATA_REP_EXT21:
             parse_generic(event_buffer+1, state);
             break;
+        case DATA_REP_INTERLEAVED1:
+        case DATA_REP_INTERLEAVED2:
+            parse_interleaved(event_buffer, state);
+            break;
         case STATUS_INFO_REPLY:
+            msg_replied(msgs, STATUS_INFO_REQUEST);
             handle_status_input_reply(
                 msgs, state, event_buffer);
             break;
-        case ACK_OUT_RETURN:
+        case ACK_OUT_RETURN: {
             parse_wiimote(event_buffer+1, NULL, NULL, state);
-            if (event_buffer[4] == 0x03) {
+            int cmd = msg_replied(msgs, event_buffer[3]);
+            if (cmd < 0 && event_buffer[3] == WRITE_MEMREG_REQUEST) {
+                // late ACK of a write we already retried
+                LOG_DEBUG_ASYNC("Ignoring unexpected ACK for %llx",
+                        (long long)event_buffer[3]);
+                break;
+            }
+            if (event_buffer[4] != 0x03) {
+                handle_ack(msgs, state, cmd);
+            } else if (cmd == CMD_MP_INIT) {
+                // nothing at 0xa600xx without MotionPlus
+                motionplus_absent(state);
+            } else if (cmd == CMD_MP_ACTIVATE) {
+                // a retry, the first write already moved it
+                motionplus_moved(msgs, state);
+            } else {
                 LOG_ERROR("Wiimote sent error for command %hhx (%hhx)",
                     event_buffer[3], event_buffer[4]);
-            } else if (event_buffer[3] == WRITE_MEMREG_REQUEST) {
-                if (state->ext_status == EXT_WAITING_DECRYPTION_0) {
-                    LOG_INFO("Extension decryption phase 1 write acknowledged");
-                    state->ext_status = EXT_WAITING_DECRYPTION_1;
-                    if (enqueue_msg(msgs, EXT_DECRYPT_PHASE2,
-                            sizeof(EXT_DECRYPT_PHASE2)) == 0) {
-                        LOG_INFO("Sent extension decryption phase 2 write");
-                    } else {
-                        LOG_ERROR("Failed to enqueue extension decryption "
-                            "phase 2 write");
-                    }
-                } else if (state->ext_status == EXT_WAITING_DECRYPTION_1) {
-                    LOG_INFO("Extension decryption phase 2 write acknowledged");
-                    state->ext_status = EXT_DECRYPTED;
-                    enqueue_ext_detect(msgs);
-                }
             }
             break;
+        }
         case READ_MEMREG_REPLY:
             parse_wiimote(event_buffer+1, NULL, NULL, state);
-            uint8_t se = event_buffer[3];
-            uint8_t errors = se & 0xf;
-            uint8_t size = ((se >> 4) & 0xf) + 1;
-            uint16_t abs_offset = (uint16_t)
-                (((uint16_t)event_buffer[4]) << 8
-                | event_buffer[5]);
-            LOG_DEBUG("    Read reply: size=%hhx offset=%04x errors=%hhx",
-                    size, abs_offset, errors);
-            if (errors == 7) {
-                if (size != 17) {
-                    LOG_DEBUG("    Attempted reading write-only register %04x"
-                              " (innocuous)",
-                            abs_offset);
-                } else {
-                    LOG_ERROR("    Attempted reading write-only register %04x",
-                            abs_offset);
-                    ret = -1;
-                }
-                break;
-            } else if (errors == 8) {
-                LOG_ERROR("    Attempted reading nonexistent register %04x",
-                        abs_offset);
-                ret = -1;
-                break;
-            }
-            uint8_t data[16];
-            memcpy(data, event_buffer+6, size);
-            if (abs_offset == 0x00fa
-                && size == 6
-                && state->ext_status == EXT_DECRYPTED) {
-                uint64_t ext_signature =
-                    ((uint64_t)data[0] << 40) |
-                    ((uint64_t)data[1] << 32) |
-                    ((uint64_t)data[2] << 24) |
-                    ((uint64_t)data[3] << 16) |
-                    ((uint64_t)data[4] << 8)  |
-                    ((uint64_t)data[5] << 0);
-                LOG_INFO("Extension signature: %012llx", ext_signature);
-                switch (ext_signature) {
-                    case NUNCHUCK_SIGNATURE:
-                        LOG_INFO("Nunchuck extension detected");
-                        state->ext_status = EXT_NUNCHUCK;
-                        break;
-                    case CC_SIGNATURE:
-                        LOG_INFO("Classic Controller extension detected");
-                        state->ext_status = EXT_CLASSIC_CONTROLLER;
-                        enqueue_msg(
-                                msgs,
-                                CC_DATAMODE_REQ,
-                                sizeof(CC_DATAMODE_REQ));
-                        break;
-                    default:
-                        LOG_WARN("Unknown extension detected. Signature: "
-                                "%012llx",
-                                ext_signature);
-                        state->ext_status = EXT_UNKNOWN;
-                        break;
-                }
-            } else if (abs_offset == 0x00fe
-                       && size == 1
-                       && state->ext_status == EXT_CLASSIC_CONTROLLER) {
-                state->classic_controller.data_format = data[0];
-                LOG_INFO("Classic Controller data mode set to %hhx", data[0]);
-            }
+            memread_reply(&state->reads, msgs, state, event_buffer);
             break;
         default:
             LOG_ERROR("Wiimote sent unrecognized report type: %hhx",
@@ -394,6 +766,10 @@ int handle_wiimote_event(
             ret = -1;
             break;
     }
+    if (state->mp.status == MP_ACTIVE
+        && state->mp.inner_seen != state->mp.inner) {
+        replug_motionplus(msgs, state);
+    }
 
     return ret;
 }
@@ -2,6 +2,10 @@
 #define _GWIIMOTE_H_
 #include <stddef.h>
 #include <stdint.h>
+#include "calib.h"
+#include "ir.h"
+#include "memread.h"
+#include "motionplus.h"
 #include "queue.h"
 
 enum extension_status {
@@ -14,30 +18,100 @@ enum extension_status {
     EXT_CLASSIC_CONTROLLER,
 };
 
+// extension handshakes restarted after a lost reply before giving up
+#define EXT_MAX_ATTEMPTS 3
+// IR camera bring-ups, likewise
+#define IR_MAX_ATTEMPTS 3
+
+// ext_status was taken from the extension cache and not confirmed yet;
+// RUNNING once the signature read is on its way
+#define EXT_VERIFY_NONE    0
+#define EXT_VERIFY_CACHED  1
+#define EXT_VERIFY_RUNNING 2
+
+// extension registers
+#define EXT_ID_ADDR 0xa400fa
+#define EXT_CALIB_ADDR 0xa40020
+// accelerometer calibration in the Wiimote EEPROM
+#define WII_CALIB_ADDR 0x16
+
+// signature byte 0xfe is the data format, it differs between controllers
+#define EXT_FORMAT_MASK 0xff00ULL
+
 #define NUNCHUCK_SIGNATURE 0xA4200000
+// button bits, already inverted to active high
+#define NC_BTN_Z 0x01
+#define NC_BTN_C 0x02
+// analog values are raw samples, see calib.h
 typedef struct {
-    uint16_t sx, sy;
-    uint8_t c, z;
+    uint8_t sx, sy;
+    uint8_t buttons;
+    uint16_t accel[ACC_AXES];
 } nunchuck_state_t;
 
 #define CC_SIGNATURE       0xA4200101
+// button bits, laid out as report bytes 4 and 5 (big endian, active high)
+#define CC_BTN_DU    0x0001
+#define CC_BTN_DL    0x0002
+#define CC_BTN_RZ    0x0004
+#define CC_BTN_X     0x0008
+#define CC_BTN_A     0x0010
+#define CC_BTN_Y     0x0020
+#define CC_BTN_B     0x0040
+#define CC_BTN_LZ    0x0080
+#define CC_BTN_PLUS  0x0400
+#define CC_BTN_HOME  0x0800
+#define CC_BTN_MINUS 0x1000
+#define CC_BTN_DD    0x4000
+#define CC_BTN_DR    0x8000
+#define CC_BTN_MASK  0xdcff
 typedef struct {
     uint8_t data_format;
-    uint16_t lx, ly, rx, ry;
+    uint8_t lx, ly, rx, ry;
     uint8_t lt, rt;
-    uint8_t lz, rz;
-    uint8_t du, dd, dl, dr;
-    uint8_t a, b, x, y;
-    uint8_t home, plus, minus;
+    uint16_t buttons;
 } classic_controller_state_t;
 
 
 #define WII_LED_ONEHOT(b) ((b).status_flags >> 0x08)
 #define WII_FLAG_EXT_CONNECTED(b) ((b).status_flags & 0x02)
+// core button bits, laid out as report bytes 1 and 2 (big endian)
+#define WII_BTN_2     0x0001
+#define WII_BTN_1     0x0002
+#define WII_BTN_B     0x0004
+#define WII_BTN_A     0x0008
+#define WII_BTN_MINUS 0x0010
+#define WII_BTN_HOME  0x0080
+#define WII_BTN_LEFT  0x0100
+#define WII_BTN_RIGHT 0x0200
+#define WII_BTN_DOWN  0x0400
+#define WII_BTN_UP    0x0800
+#define WII_BTN_PLUS  0x1000
+#define WII_BTN_MASK  0x1f9f
+// optional outputs, they decide which data reporting mode is requested
+#define WII_FEAT_ACCEL 0x01
+#define WII_FEAT_IR    0x02
+// full camera format over the interleaved reports, without extension only
+#define WII_FEAT_IR_FULL 0x04
+// gyro orientation, with the accelerometers it is corrected by
+#define WII_FEAT_MOTIONPLUS 0x08
+
+/*
+ * First half of an interleaved sample, kept until its 0x3f arrives. Each
+ * half carries one 8-bit accelerometer axis, half of z in the spare
+ * button bits and half of the full IR data.
+ */
 typedef struct {
-    uint8_t btn_a, btn_b, btn_1, btn_2;
-    uint8_t btn_plus, btn_minus, btn_home;
-    uint8_t btn_up, btn_down, btn_left, btn_right;
+    uint8_t pending;
+    uint8_t accel_x;
+    uint8_t accel_z; // bits 7:4
+    uint8_t ir[IR_FULL_SIZE / 2];
+    uint32_t dropped; // halves without their other half
+} interleave_t;
+
+typedef struct wiimote_state {
+    uint16_t buttons;
+    uint16_t accel[ACC_AXES];
 
     enum extension_status ext_status;
     nunchuck_state_t nunchuck;
@@ -47,9 +121,66 @@ typedef struct {
     uint8_t status_flags;
 
     uint8_t initialized;
+    uint8_t features;
+    uint8_t report_mode;
+    uint8_t ext_attempts;
+    uint8_t ext_verify;
+
+    mem_reads_t reads;
+
+    // extension calibration block, bumped calib_gen when it changes
+    uint8_t ext_calib[EXT_CALIB_SIZE];
+    uint8_t ext_calib_valid;
+    uint8_t calib_gen;
+    axis_luts_t luts;
+    accel_calib_t accel_calib;
+    accel_calib_t nc_accel_calib;
+
+    // ir.mode is IR_MODE_OFF until the camera confirmed ir_pending
+    ir_state_t ir;
+    uint8_t ir_pending;
+    uint8_t ir_attempts;
+    interleave_t interleave;
+
+    // ext_status stays the extension behind an active MotionPlus
+    motionplus_t mp;
 } wiimote_state_t;
 
+/*
+ * 10-bit accelerometer samples. The Wiimote keeps the low bits in the
+ * unused bits of the button bytes, only one of them for y and z; the
+ * nunchuck packs all of them into its last byte.
+ */
+static inline void decode_wiimote_accel(const uint8_t *btns_buf,
+        const uint8_t *acc_buf, uint16_t accel[ACC_AXES]) {
+    accel[ACC_X] = (uint16_t)(acc_buf[0] << 2 | (btns_buf[0] >> 5 & 0x3));
+    accel[ACC_Y] = (uint16_t)(acc_buf[1] << 2 | (btns_buf[1] >> 4 & 0x2));
+    accel[ACC_Z] = (uint16_t)(acc_buf[2] << 2 | (btns_buf[1] >> 5 & 0x2));
+}
+
+static inline void decode_nunchuck_accel(const uint8_t *nc_buf,
+        uint16_t accel[ACC_AXES]) {
+    accel[ACC_X] = (uint16_t)(nc_buf[2] << 2 | (nc_buf[5] >> 2 & 0x3));
+    accel[ACC_Y] = (uint16_t)(nc_buf[3] << 2 | (nc_buf[5] >> 4 & 0x3));
+    accel[ACC_Z] = (uint16_t)(nc_buf[4] << 2 | (nc_buf[5] >> 6 & 0x3));
+}
+
+void parse_wiimote(
+        const uint8_t *btns_buf,
+        const uint8_t *acc_buf,
+        const uint8_t *ir_buf,
+        wiimote_state_t *wm_state);
+void parse_nunchuck(const uint8_t *nc_buf, nunchuck_state_t *nc_state);
+void parse_cc(const uint8_t *cc_buf, classic_controller_state_t *cc_state);
 int connect_wiimote(const char *device_path, wiimote_state_t *initial_state);
+int enqueue_report_mode(msg_queue_t *msgs, wiimote_state_t *state);
+void build_axis_luts(wiimote_state_t *state);
+void request_wiimote_calibration(msg_queue_t *msgs, wiimote_state_t *state);
+void request_motionplus(msg_queue_t *msgs, wiimote_state_t *state);
+void handle_command_failure(
+        msg_queue_t *msgs,
+        wiimote_state_t *state,
+        uint8_t cmd);
 int handle_wiimote_event(
         msg_queue_t *msgs,
         wiimote_state_t *state,
@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "worker.h"
+
+#define HANDOFF_SIZE 64
+#define MAX_EVENTS 64
+
+typedef struct {
+    pthread_t thread;
+    size_t index;
+    int epoll_fd;
+    int wake_fd;
+    // lock-free SPSC handoff: the control thread produces, the worker
+    // consumes
+    wiimote_context_t *handoff[HANDOFF_SIZE];
+    _Atomic size_t handoff_head;
+    _Atomic size_t handoff_tail;
+    atomic_size_t load;
+    // only touched by the worker itself
+    wiimote_context_t **devices;
+    size_t n_devices;
+    size_t cap_devices;
+    unsigned int dump_seen;
+} worker_t;
+
+static worker_t *workers = NULL;
+static size_t n_workers = 0;
+static pool_t *pool = NULL;
+static atomic_int workers_running = 0;
+static atomic_uint dump_generation = 0;
+
+size_t workers_count(void) {
+    return n_workers;
+}
+
+static void wake(worker_t *w) {
+    uint64_t one = 1;
+    if (write(w->wake_fd, &one, sizeof(one)) < 0) {
+        LOG_ERROR("Cannot wake worker %zu (errno=%d)", w->index, errno);
+    }
+}
+
+static int handoff_push(worker_t *w, wiimote_context_t *wm) {
+    size_t tail = atomic_load_explicit(&w->handoff_tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&w->handoff_head, memory_order_acquire);
+    if (tail - head == HANDOFF_SIZE) {
+        return -1;
+    }
+    w->handoff[tail % HANDOFF_SIZE] = wm;
+    atomic_store_explicit(&w->handoff_tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+static wiimote_context_t *handoff_pop(worker_t *w) {
+    size_t head = atomic_load_explicit(&w->handoff_head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&w->handoff_tail, memory_order_acquire);
+    if (head == tail) {
+        return NULL;
+    }
+    wiimote_context_t *wm = w->handoff[head % HANDOFF_SIZE];
+    atomic_store_explicit(&w->handoff_head, head + 1, memory_order_release);
+    return wm;
+}
+
+static void adopt(worker_t *w, wiimote_context_t *wm) {
+    if (w->n_devices == w->cap_devices) {
+        size_t cap = w->cap_devices ? w->cap_devices * 2 : 8;
+        wiimote_context_t **devices =
+            realloc(w->devices, cap * sizeof(*devices));
+        if (devices == NULL) {
+            LOG_ERROR("Worker %zu cannot take more Wiimotes", w->index);
+            release_wiimote_context(pool, wm);
+            atomic_fetch_sub(&w->load, 1);
+            return;
+        }
+        w->devices = devices;
+        w->cap_devices = cap;
+    }
+    if (watch_wiimote(wm, w->epoll_fd) < 0) {
+        release_wiimote_context(pool, wm);
+        atomic_fetch_sub(&w->load, 1);
+        return;
+    }
+    w->devices[w->n_devices++] = wm;
+    LOG_INFO("  Wiimote %s served by worker %zu", wm->dev_path, w->index);
+    // the fd may already be readable: edge triggered epoll won't tell
+    handle_wiimote_fd(wm, EPOLLIN | EPOLLOUT, w->epoll_fd);
+}
+
+static void retire(worker_t *w, wiimote_context_t *wm) {
+    for (size_t i = 0; i < w->n_devices; i++) {
+        if (w->devices[i] == wm) {
+            w->devices[i] = w->devices[--w->n_devices];
+            break;
+        }
+    }
+    release_wiimote_context(pool, wm);
+    atomic_fetch_sub(&w->load, 1);
+}
+
+static void dump_devices(const worker_t *w) {
+    for (size_t i = 0; i < w->n_devices; i++) {
+        lat_dump(&w->devices[i]->latency, w->devices[i]->dev_path);
+    }
+}
+
+static void pin_to_cpu(const worker_t *w) {
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t cpu = w->index % (size_t)(n_cpus > 0 ? n_cpus : 1);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        LOG_WARN("Cannot pin worker %zu to a CPU", w->index);
+    }
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    struct epoll_event events[MAX_EVENTS];
+    pin_to_cpu(w);
+    while (atomic_load(&workers_running)) {
+        int n = epoll_wait(w->epoll_fd, events, MAX_EVENTS, 30000);
+        if (n < 0 && errno != EINTR) {
+            LOG_ERROR("Worker %zu epoll_wait failed (errno=%d)",
+                    w->index, errno);
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == w) {
+                uint64_t count;
+                wiimote_context_t *wm;
+                if (read(w->wake_fd, &count, sizeof(count)) < 0) {
+                    continue;
+                }
+                while ((wm = handoff_pop(w)) != NULL) {
+                    adopt(w, wm);
+                }
+                unsigned int gen = atomic_load(&dump_generation);
+                if (gen != w->dump_seen) {
+                    w->dump_seen = gen;
+                    dump_devices(w);
+                }
+                continue;
+            }
+            wiimote_context_t *gone = serve_wiimote_event(
+                    events[i].data.ptr, events[i].events, w->epoll_fd);
+            if (gone != NULL) {
+                retire(w, gone);
+            }
+        }
+    }
+    dump_devices(w);
+    return NULL;
+}
+
+int workers_start(size_t count, pool_t *wiimotes) {
+    struct epoll_event ev;
+    sigset_t block, old;
+    workers = calloc(count, sizeof(*workers));
+    if (workers == NULL) {
+        LOG_ERROR("Cannot allocate %zu workers", count);
+        return -1;
+    }
+    pool = wiimotes;
+    atomic_store(&workers_running, 1);
+    // signals are for the control thread
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    for (n_workers = 0; n_workers < count; n_workers++) {
+        worker_t *w = &workers[n_workers];
+        w->index = n_workers;
+        w->epoll_fd = epoll_create1(0);
+        w->wake_fd = eventfd(0, EFD_NONBLOCK);
+        if (w->epoll_fd < 0 || w->wake_fd < 0) {
+            LOG_ERROR("Cannot set up worker %zu (errno=%d)",
+                    n_workers, errno);
+            goto failed_worker;
+        }
+        ev.events = EPOLLIN;
+        ev.data.ptr = w;
+        epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->wake_fd, &ev);
+        if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            LOG_ERROR("Cannot start worker %zu", n_workers);
+            goto failed_worker;
+        }
+    }
+    goto workers_started;
+
+failed_worker:
+    if (workers[n_workers].epoll_fd >= 0) {
+        close(workers[n_workers].epoll_fd);
+    }
+    if (workers[n_workers].wake_fd >= 0) {
+        close(workers[n_workers].wake_fd);
+    }
+workers_started:
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    LOG_INFO("Started %zu worker threads", n_workers);
+    return n_workers == count ? 0 : -1;
+}
+
+int workers_assign(wiimote_context_t *wm) {
+    worker_t *best = NULL;
+    for (size_t i = 0; i < n_workers; i++) {
+        if (best == NULL
+            || atomic_load(&workers[i].load) < atomic_load(&best->load)) {
+            best = &workers[i];
+        }
+    }
+    if (best == NULL || handoff_push(best, wm) < 0) {
+        LOG_ERROR("No worker can take Wiimote %s", wm->dev_path);
+        return -1;
+    }
+    atomic_fetch_add(&best->load, 1);
+    wake(best);
+    return 0;
+}
+
+void workers_dump_latencies(void) {
+    atomic_fetch_add(&dump_generation, 1);
+    for (size_t i = 0; i < n_workers; i++) {
+        wake(&workers[i]);
+    }
+}
+
+void workers_stop(void) {
+    atomic_store(&workers_running, 0);
+    for (size_t i = 0; i < n_workers; i++) {
+        wake(&workers[i]);
+        pthread_join(workers[i].thread, NULL);
+        close(workers[i].epoll_fd);
+        close(workers[i].wake_fd);
+        free(workers[i].devices);
+    }
+    free(workers);
+    workers = NULL;
+    n_workers = 0;
+}
@@ -0,0 +1,20 @@
+#ifndef _GWORKER_H_
+#define _GWORKER_H_
+
+#include <stddef.h>
+
+#include "device.h"
+#include "pool.h"
+
+/*
+ * Optional sharded event loop: the control thread keeps udev and device
+ * registration, each Wiimote is then served by one of N worker threads,
+ * each pinned to a CPU and owning its own epoll instance.
+ */
+int workers_start(size_t n_workers, pool_t *wiimotes);
+int workers_assign(wiimote_context_t *wm);
+void workers_dump_latencies(void);
+void workers_stop(void);
+size_t workers_count(void);
+
+#endif // _GWORKER_H_